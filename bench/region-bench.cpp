@@ -0,0 +1,137 @@
+/* region-bench: measures the wf_region operations used when computing the
+ * damage of a frame, and the same operations done directly with pixman,
+ * the way wf_region did them before small regions were stored inline. */
+
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+
+#include <util.hpp>
+
+static int64_t get_time_nsec()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ll + ts.tv_nsec;
+}
+
+template<class Op>
+static void run(const char *name, int iterations, Op op)
+{
+    /* warm up */
+    for (int i = 0; i < iterations / 10; i++)
+        op();
+
+    auto start = get_time_nsec();
+    for (int i = 0; i < iterations; i++)
+        op();
+    auto end = get_time_nsec();
+
+    std::printf("%-40s %8.2f ns/op\n", name, 1.0 * (end - start) / iterations);
+}
+
+static const wlr_box output_box = {0, 0, 1920, 1080};
+static const wlr_box view_boxes[] = {
+    {100, 100, 800, 600},
+    {500, 300, 800, 600},
+    {1200, 50, 600, 900},
+};
+
+int main(int argc, char *argv[])
+{
+    int iterations = argc > 1 ? std::atoi(argv[1]) : 1000000;
+    if (iterations <= 0)
+    {
+        std::fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+        return 1;
+    }
+
+    volatile int sink = 0;
+
+    /* Damage of a view clipped to the output, as done for each damaged view */
+    run("wf_region: view damage & output", iterations, [&] () {
+        wf_region damage{view_boxes[0]};
+        damage &= output_box;
+        sink = sink + damage.empty();
+    });
+
+    run("pixman: view damage & output", iterations, [&] () {
+        pixman_region32_t damage;
+        pixman_region32_init_rect(&damage, view_boxes[0].x, view_boxes[0].y,
+            view_boxes[0].width, view_boxes[0].height);
+        pixman_region32_intersect_rect(&damage, &damage, output_box.x,
+            output_box.y, output_box.width, output_box.height);
+        sink = sink + !pixman_region32_not_empty(&damage);
+        pixman_region32_fini(&damage);
+    });
+
+    /* Accumulating the damage of a few views in a frame */
+    run("wf_region: union of 3 views", iterations, [&] () {
+        wf_region damage;
+        for (auto& box : view_boxes)
+            damage |= box;
+        sink = sink + damage.empty();
+    });
+
+    run("pixman: union of 3 views", iterations, [&] () {
+        pixman_region32_t damage;
+        pixman_region32_init(&damage);
+        for (auto& box : view_boxes)
+        {
+            pixman_region32_union_rect(&damage, &damage, box.x, box.y,
+                box.width, box.height);
+        }
+        sink = sink + !pixman_region32_not_empty(&damage);
+        pixman_region32_fini(&damage);
+    });
+
+    /* Subtracting the opaque region of a view on top */
+    run("wf_region: view ^ view on top", iterations, [&] () {
+        wf_region damage{view_boxes[0]};
+        damage ^= view_boxes[1];
+        int count = 0;
+        for (auto& box : damage)
+            count += box.x2 - box.x1;
+        sink = sink + count;
+    });
+
+    run("pixman: view ^ view on top", iterations, [&] () {
+        pixman_region32_t damage, opaque;
+        pixman_region32_init_rect(&damage, view_boxes[0].x, view_boxes[0].y,
+            view_boxes[0].width, view_boxes[0].height);
+        pixman_region32_init_rect(&opaque, view_boxes[1].x, view_boxes[1].y,
+            view_boxes[1].width, view_boxes[1].height);
+        pixman_region32_subtract(&damage, &damage, &opaque);
+
+        int n, count = 0;
+        auto boxes = pixman_region32_rectangles(&damage, &n);
+        for (int i = 0; i < n; i++)
+            count += boxes[i].x2 - boxes[i].x1;
+        sink = sink + count;
+
+        pixman_region32_fini(&opaque);
+        pixman_region32_fini(&damage);
+    });
+
+    /* Copying and translating, as done for damage in surface-local coordinates */
+    wf_region two_views = wf_region{view_boxes[0]} | view_boxes[2];
+    run("wf_region: copy + translate", iterations, [&] () {
+        auto copy = two_views + wf_point{-100, -100};
+        sink = sink + copy.empty();
+    });
+
+    pixman_region32_t two_views_pixman;
+    pixman_region32_init(&two_views_pixman);
+    pixman_region32_copy(&two_views_pixman, two_views.to_pixman());
+    run("pixman: copy + translate", iterations, [&] () {
+        pixman_region32_t copy;
+        pixman_region32_init(&copy);
+        pixman_region32_copy(&copy, &two_views_pixman);
+        pixman_region32_translate(&copy, -100, -100);
+        sink = sink + !pixman_region32_not_empty(&copy);
+        pixman_region32_fini(&copy);
+    });
+    pixman_region32_fini(&two_views_pixman);
+
+    return 0;
+}
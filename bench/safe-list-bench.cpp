@@ -0,0 +1,79 @@
+/* safe-list-bench: measures the cost of the wf::safe_list_t operations signal
+ * emission and render hooks rely on: iterating a short list, and adding and
+ * removing an element. The correctness checks are in test/safe-list-check. */
+
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+
+#include <nonstd/safe-list.hpp>
+
+namespace wf
+{
+    namespace _safe_list_detail
+    {
+        wl_event_loop* event_loop;
+        void idle_cleanup_func(void *data)
+        {
+            auto priv = reinterpret_cast<std::function<void()>*> (data);
+            (*priv)();
+        }
+    }
+}
+
+static void idle()
+{
+    wl_event_loop_dispatch_idle(wf::_safe_list_detail::event_loop);
+}
+
+static int64_t get_time_nsec()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ll + ts.tv_nsec;
+}
+
+template<class Op>
+static void run(const char *name, int iterations, Op op)
+{
+    /* warm up */
+    for (int i = 0; i < iterations / 10; i++)
+        op();
+
+    auto start = get_time_nsec();
+    for (int i = 0; i < iterations; i++)
+        op();
+    auto end = get_time_nsec();
+
+    std::printf("%-32s %8.2f ns/op\n", name, 1.0 * (end - start) / iterations);
+}
+
+int main(int argc, char *argv[])
+{
+    int iterations = argc > 1 ? std::atoi(argv[1]) : 10000000;
+    if (iterations <= 0)
+    {
+        std::fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+        return 1;
+    }
+
+    wf::_safe_list_detail::event_loop = wl_event_loop_create();
+
+    wf::safe_list_t<int> list;
+    for (int i = 0; i < 8; i++)
+        list.push_back(i);
+
+    volatile int sum = 0;
+    run("for_each, 8 elements", iterations, [&] () {
+        list.for_each([&] (int& el) { sum = sum + el; });
+    });
+
+    run("push_back + remove_all", iterations, [&] () {
+        list.push_back(100);
+        list.remove_all(100);
+        idle();
+    });
+
+    wl_event_loop_destroy(wf::_safe_list_detail::event_loop);
+    return 0;
+}
@@ -0,0 +1,116 @@
+/* signal-bench: measures the cost of emitting a signal on an object which has
+ * handlers for a few signals, comparing the previous string-keyed signal
+ * storage with the current one, both through the string API and through
+ * signal IDs. */
+
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <string>
+
+#include <object.hpp>
+
+namespace wf
+{
+    namespace _safe_list_detail
+    {
+        wl_event_loop* event_loop;
+        void idle_cleanup_func(void *data)
+        {
+            auto priv = reinterpret_cast<std::function<void()>*> (data);
+            (*priv)();
+        }
+    }
+}
+
+/* The signal storage before signal IDs were introduced */
+class string_signal_provider_t
+{
+    public:
+    void connect_signal(std::string name, signal_callback_t* callback)
+    {
+        signals[name].push_back(callback);
+    }
+
+    void emit_signal(std::string name, signal_data *data)
+    {
+        signals[name].for_each([data] (auto call) {
+            (*call) (data);
+        });
+    }
+
+    private:
+    std::unordered_map<std::string, wf::safe_list_t<signal_callback_t*>> signals;
+};
+
+static const char *signal_names[] = {
+    "map", "unmap", "set-output", "geometry-changed", "title-changed",
+    "app-id-changed", "layer-changed", "damaged-region",
+};
+
+static int64_t get_time_nsec()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ll + ts.tv_nsec;
+}
+
+template<class Emit>
+static void run(const char *name, int iterations, Emit emit)
+{
+    /* warm up */
+    for (int i = 0; i < iterations / 10; i++)
+        emit();
+
+    auto start = get_time_nsec();
+    for (int i = 0; i < iterations; i++)
+        emit();
+    auto end = get_time_nsec();
+
+    std::printf("%-32s %8.2f ns/emission\n", name,
+        1.0 * (end - start) / iterations);
+}
+
+int main(int argc, char *argv[])
+{
+    int iterations = argc > 1 ? std::atoi(argv[1]) : 10000000;
+    if (iterations <= 0)
+    {
+        std::fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+        return 1;
+    }
+
+    wf::_safe_list_detail::event_loop = wl_event_loop_create();
+
+    volatile int counter = 0;
+    signal_callback_t handler = [&] (signal_data*) { counter = counter + 1; };
+
+    string_signal_provider_t old_provider;
+    wf_signal_provider_t provider;
+    for (auto name : signal_names)
+    {
+        old_provider.connect_signal(name, &handler);
+        provider.connect_signal(name, &handler);
+    }
+
+    run("string map, string name", iterations, [&] () {
+        old_provider.emit_signal("damaged-region", nullptr);
+    });
+
+    run("signal ids, string name", iterations, [&] () {
+        provider.emit_signal("damaged-region", nullptr);
+    });
+
+    wf_signal_id damaged_region = wf_get_signal_id("damaged-region");
+    run("signal ids, id", iterations, [&] () {
+        provider.emit_signal(damaged_region, nullptr);
+    });
+
+    wf_signal_id no_handlers = wf_get_signal_id("no-handlers");
+    run("signal ids, id, no handlers", iterations, [&] () {
+        provider.emit_signal(no_handlers, nullptr);
+    });
+
+    wl_event_loop_destroy(wf::_safe_list_detail::event_loop);
+    return 0;
+}
@@ -0,0 +1,747 @@
+/* wayfire-bench: starts the compositor on the headless wlroots backend with
+ * software rendering, connects a number of synthetic xdg-shell clients which
+ * damage their wl_shm buffers at a configurable rate, and reports the
+ * observed frame rate, frame latency and compositor CPU usage, together with
+ * the frame timing statistics of the render manager.
+ *
+ * It is meant to be run on machines without a GPU, e.g CI boxes, to catch
+ * performance regressions in the rendering and damage tracking paths. */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <ctime>
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+#include <getopt.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <wayland-client.h>
+#include "xdg-shell-client-protocol.h"
+
+struct bench_options
+{
+    int clients = 4;
+    /* commits per second for each client */
+    int rate = 60;
+    int width = 400, height = 300;
+    /* size of the rectangle each client damages on each commit */
+    int damage_width = 64, damage_height = 64;
+    int duration = 10;
+
+    /* Clients request to be fullscreen and use buffers of the output size */
+    bool fullscreen = false;
+
+    std::string compositor = WAYFIRE_BENCH_COMPOSITOR;
+    std::string plugin_dir = WAYFIRE_BENCH_PLUGIN_DIR;
+};
+
+static int64_t get_time_usec()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ll + ts.tv_nsec / 1000ll;
+}
+
+static int64_t percentile(std::vector<int64_t> samples, float p)
+{
+    if (samples.empty())
+        return 0;
+
+    size_t idx = (samples.size() - 1) * p / 100.0;
+    std::nth_element(samples.begin(), samples.begin() + idx, samples.end());
+    return samples[idx];
+}
+
+/* ------------------------- synthetic client ------------------------------ */
+struct bench_buffer
+{
+    wl_buffer *buffer = nullptr;
+    uint32_t *data = nullptr;
+    bool busy = false;
+};
+
+struct bench_client
+{
+    const bench_options *options;
+    int index;
+
+    wl_display *display = nullptr;
+    wl_compositor *compositor = nullptr;
+    wl_shm *shm = nullptr;
+    xdg_wm_base *wm_base = nullptr;
+
+    wl_surface *surface = nullptr;
+    xdg_surface *xsurface = nullptr;
+    xdg_toplevel *toplevel = nullptr;
+
+    bench_buffer buffers[2];
+    bool configured = false;
+    /* Size of the buffers, the size requested by the compositor in
+     * fullscreen mode, otherwise the size from the options */
+    int width = 0, height = 0;
+
+    /* Results, read after the client thread has finished */
+    std::vector<int64_t> latencies;
+    int64_t frames = 0, commits = 0, skipped_commits = 0;
+    bool failed = false;
+
+    /* Time of the commit for which the last frame callback was requested */
+    int64_t pending_commit_time = -1;
+    uint32_t frame_counter = 0;
+
+    void run(const std::atomic<bool>& running);
+
+    bool setup();
+    bool create_buffers();
+    void commit_damage();
+    void teardown();
+};
+
+static void handle_global(void *data, wl_registry *registry, uint32_t name,
+    const char *interface, uint32_t version)
+{
+    auto client = static_cast<bench_client*> (data);
+    if (strcmp(interface, wl_compositor_interface.name) == 0)
+    {
+        client->compositor = (wl_compositor*) wl_registry_bind(registry, name,
+            &wl_compositor_interface, 3);
+    } else if (strcmp(interface, wl_shm_interface.name) == 0)
+    {
+        client->shm = (wl_shm*) wl_registry_bind(registry, name,
+            &wl_shm_interface, 1);
+    } else if (strcmp(interface, xdg_wm_base_interface.name) == 0)
+    {
+        client->wm_base = (xdg_wm_base*) wl_registry_bind(registry, name,
+            &xdg_wm_base_interface, 1);
+    }
+}
+
+static void handle_global_remove(void*, wl_registry*, uint32_t) {}
+
+static const wl_registry_listener registry_listener = {
+    handle_global,
+    handle_global_remove,
+};
+
+static void handle_wm_base_ping(void*, xdg_wm_base *wm_base, uint32_t serial)
+{
+    xdg_wm_base_pong(wm_base, serial);
+}
+
+static const xdg_wm_base_listener wm_base_listener = {
+    handle_wm_base_ping,
+};
+
+static void handle_xdg_surface_configure(void *data, xdg_surface *xsurface,
+    uint32_t serial)
+{
+    auto client = static_cast<bench_client*> (data);
+    xdg_surface_ack_configure(xsurface, serial);
+    client->configured = true;
+}
+
+static const xdg_surface_listener xdg_surface_listener_impl = {
+    handle_xdg_surface_configure,
+};
+
+static void handle_toplevel_configure(void *data, xdg_toplevel*,
+    int32_t width, int32_t height, wl_array*)
+{
+    auto client = static_cast<bench_client*> (data);
+    if (client->options->fullscreen && width > 0 && height > 0)
+    {
+        client->width = width;
+        client->height = height;
+    }
+}
+static void handle_toplevel_close(void*, xdg_toplevel*) {}
+
+static const xdg_toplevel_listener toplevel_listener = {
+    handle_toplevel_configure,
+    handle_toplevel_close,
+};
+
+static void handle_buffer_release(void *data, wl_buffer*)
+{
+    auto buffer = static_cast<bench_buffer*> (data);
+    buffer->busy = false;
+}
+
+static const wl_buffer_listener buffer_listener = {
+    handle_buffer_release,
+};
+
+static void handle_frame_done(void *data, wl_callback *callback, uint32_t)
+{
+    auto client = static_cast<bench_client*> (data);
+    wl_callback_destroy(callback);
+
+    if (client->pending_commit_time >= 0)
+    {
+        client->latencies.push_back(
+            get_time_usec() - client->pending_commit_time);
+        client->pending_commit_time = -1;
+    }
+
+    ++client->frames;
+}
+
+static const wl_callback_listener frame_listener = {
+    handle_frame_done,
+};
+
+bool bench_client::setup()
+{
+    display = wl_display_connect(NULL);
+    if (!display)
+    {
+        fprintf(stderr, "client %d: failed to connect to the compositor\n", index);
+        return false;
+    }
+
+    auto registry = wl_display_get_registry(display);
+    wl_registry_add_listener(registry, &registry_listener, this);
+    wl_display_roundtrip(display);
+    wl_registry_destroy(registry);
+
+    if (!compositor || !shm || !wm_base)
+    {
+        fprintf(stderr, "client %d: missing required globals\n", index);
+        return false;
+    }
+
+    xdg_wm_base_add_listener(wm_base, &wm_base_listener, this);
+
+    surface = wl_compositor_create_surface(compositor);
+    xsurface = xdg_wm_base_get_xdg_surface(wm_base, surface);
+    xdg_surface_add_listener(xsurface, &xdg_surface_listener_impl, this);
+    toplevel = xdg_surface_get_toplevel(xsurface);
+    xdg_toplevel_add_listener(toplevel, &toplevel_listener, this);
+    xdg_toplevel_set_title(toplevel, ("wayfire-bench-" + std::to_string(index)).c_str());
+    if (options->fullscreen)
+        xdg_toplevel_set_fullscreen(toplevel, NULL);
+    wl_surface_commit(surface);
+
+    width = options->width;
+    height = options->height;
+
+    while (!configured)
+    {
+        if (wl_display_dispatch(display) < 0)
+            return false;
+    }
+
+    return create_buffers();
+}
+
+bool bench_client::create_buffers()
+{
+    const int stride = width * 4;
+    const int size = stride * height;
+
+    std::string name = "/wayfire-bench-" + std::to_string(getpid()) +
+        "-" + std::to_string(index);
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0)
+    {
+        fprintf(stderr, "client %d: shm_open failed: %s\n", index, strerror(errno));
+        return false;
+    }
+
+    shm_unlink(name.c_str());
+    if (ftruncate(fd, 2 * size) < 0)
+    {
+        close(fd);
+        return false;
+    }
+
+    auto data = mmap(NULL, 2 * size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED)
+    {
+        close(fd);
+        return false;
+    }
+
+    auto pool = wl_shm_create_pool(shm, fd, 2 * size);
+    for (int i = 0; i < 2; i++)
+    {
+        buffers[i].buffer = wl_shm_pool_create_buffer(pool, i * size,
+            width, height, stride, WL_SHM_FORMAT_XRGB8888);
+        buffers[i].data = (uint32_t*) ((char*)data + i * size);
+        wl_buffer_add_listener(buffers[i].buffer, &buffer_listener, &buffers[i]);
+
+        /* Fully opaque, different base color for each client */
+        std::fill(buffers[i].data, buffers[i].data + width * height,
+            0xff000000 | (0x202020 * (index % 8)));
+    }
+
+    wl_shm_pool_destroy(pool);
+    close(fd);
+
+    /* Initial full-size commit */
+    wl_surface_attach(surface, buffers[0].buffer, 0, 0);
+    wl_surface_damage(surface, 0, 0, width, height);
+    wl_surface_commit(surface);
+    buffers[0].busy = true;
+
+    return true;
+}
+
+/* Draw a rectangle at a position which changes with each commit, and commit
+ * only the damaged part of the buffer */
+void bench_client::commit_damage()
+{
+    bench_buffer *buffer = nullptr;
+    for (auto& b : buffers)
+    {
+        if (!b.busy)
+            buffer = &b;
+    }
+
+    /* Compositor still holds both buffers */
+    if (!buffer)
+    {
+        ++skipped_commits;
+        return;
+    }
+
+    ++frame_counter;
+    int dw = std::min(options->damage_width, width);
+    int dh = std::min(options->damage_height, height);
+    int dx = (frame_counter * 7 * dw / 4) % (width - dw + 1);
+    int dy = (frame_counter * dh / 3) % (height - dh + 1);
+
+    uint32_t color = 0xff000000 | (frame_counter * 0x010305);
+    for (int y = dy; y < dy + dh; y++)
+    {
+        std::fill(buffer->data + y * width + dx,
+            buffer->data + y * width + dx + dw, color);
+    }
+
+    wl_surface_attach(surface, buffer->buffer, 0, 0);
+    /* Only the changed rectangle is damaged, to exercise the damage tracking
+     * path. The rest of the buffer may be stale, which doesn't matter here */
+    wl_surface_damage(surface, dx, dy, dw, dh);
+
+    if (pending_commit_time < 0)
+    {
+        auto callback = wl_surface_frame(surface);
+        wl_callback_add_listener(callback, &frame_listener, this);
+        pending_commit_time = get_time_usec();
+    }
+
+    wl_surface_commit(surface);
+    buffer->busy = true;
+    ++commits;
+}
+
+void bench_client::teardown()
+{
+    for (auto& b : buffers)
+    {
+        if (b.buffer)
+            wl_buffer_destroy(b.buffer);
+    }
+
+    if (toplevel)
+        xdg_toplevel_destroy(toplevel);
+    if (xsurface)
+        xdg_surface_destroy(xsurface);
+    if (surface)
+        wl_surface_destroy(surface);
+
+    if (display)
+    {
+        wl_display_flush(display);
+        wl_display_disconnect(display);
+    }
+}
+
+void bench_client::run(const std::atomic<bool>& running)
+{
+    if (!setup())
+    {
+        failed = true;
+        teardown();
+        return;
+    }
+
+    const int64_t interval = 1000000 / std::max(options->rate, 1);
+    int64_t next_commit = get_time_usec();
+
+    pollfd pfd;
+    pfd.fd = wl_display_get_fd(display);
+    pfd.events = POLLIN;
+
+    while (running)
+    {
+        int64_t now = get_time_usec();
+        if (now >= next_commit)
+        {
+            commit_damage();
+            next_commit += interval;
+            /* We are lagging behind, don't try to catch up */
+            if (next_commit < now)
+                next_commit = now + interval;
+        }
+
+        while (wl_display_prepare_read(display) != 0)
+            wl_display_dispatch_pending(display);
+        wl_display_flush(display);
+
+        int timeout = std::max<int64_t>(0, (next_commit - get_time_usec()) / 1000);
+        if (poll(&pfd, 1, timeout) > 0 && (pfd.revents & POLLIN))
+        {
+            wl_display_read_events(display);
+        } else
+        {
+            wl_display_cancel_read(display);
+        }
+
+        if (pfd.revents & (POLLERR | POLLHUP))
+        {
+            fprintf(stderr, "client %d: lost connection\n", index);
+            failed = true;
+            break;
+        }
+
+        wl_display_dispatch_pending(display);
+    }
+
+    teardown();
+}
+
+/* ------------------------------ compositor ------------------------------- */
+struct bench_compositor
+{
+    pid_t pid = -1;
+    std::string runtime_dir, config_file, log_file;
+
+    bool start(const bench_options& options);
+    /* Returns the user+system time of the compositor process in usec */
+    int64_t get_cpu_time();
+    std::string dump_frame_stats();
+    void stop();
+};
+
+bool bench_compositor::start(const bench_options& options)
+{
+    char dir_template[] = "/tmp/wayfire-bench-XXXXXX";
+    if (!mkdtemp(dir_template))
+    {
+        fprintf(stderr, "failed to create runtime dir: %s\n", strerror(errno));
+        return false;
+    }
+
+    runtime_dir = dir_template;
+    config_file = runtime_dir + "/wayfire.ini";
+    log_file = runtime_dir + "/wayfire.log";
+
+    std::ofstream config(config_file);
+    /* The grid plugin resizes fullscreen views to the output size */
+    config << "[core]\n"
+        << "plugins = " << options.plugin_dir << "/libviewport_impl.so"
+        << (options.fullscreen ? " " + options.plugin_dir + "/libgrid.so" : "")
+        << "\n"
+        << "vwidth = 1\n"
+        << "vheight = 1\n";
+    config.close();
+
+    /* The compositor and the clients share the runtime dir, so that
+     * the clients can find the socket as "wayland-0" */
+    setenv("XDG_RUNTIME_DIR", runtime_dir.c_str(), 1);
+    setenv("WAYLAND_DISPLAY", "wayland-0", 1);
+    unsetenv("DISPLAY");
+
+    pid = fork();
+    if (pid < 0)
+        return false;
+
+    if (pid == 0)
+    {
+        setenv("WLR_BACKENDS", "headless", 1);
+        setenv("WLR_HEADLESS_OUTPUTS", "1", 1);
+        setenv("WLR_LIBINPUT_NO_DEVICES", "1", 1);
+        setenv("LIBGL_ALWAYS_SOFTWARE", "1", 1);
+        unsetenv("WAYLAND_DISPLAY");
+
+        int log_fd = open(log_file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (log_fd >= 0)
+        {
+            dup2(log_fd, STDOUT_FILENO);
+            dup2(log_fd, STDERR_FILENO);
+            close(log_fd);
+        }
+
+        execl(options.compositor.c_str(), options.compositor.c_str(),
+            "-c", config_file.c_str(), (char*)NULL);
+        _exit(127);
+    }
+
+    /* Wait for the compositor socket to show up */
+    std::string socket = runtime_dir + "/wayland-0";
+    for (int i = 0; i < 100; i++)
+    {
+        struct stat st;
+        if (stat(socket.c_str(), &st) == 0)
+        {
+            /* Give the compositor time to create its output */
+            usleep(500 * 1000);
+            return true;
+        }
+
+        int status;
+        if (waitpid(pid, &status, WNOHANG) == pid)
+        {
+            fprintf(stderr, "compositor exited prematurely, see %s\n",
+                log_file.c_str());
+            pid = -1;
+            return false;
+        }
+
+        usleep(100 * 1000);
+    }
+
+    fprintf(stderr, "timeout while waiting for the compositor to start\n");
+    return false;
+}
+
+int64_t bench_compositor::get_cpu_time()
+{
+    std::ifstream stat("/proc/" + std::to_string(pid) + "/stat");
+    std::string line;
+    if (!std::getline(stat, line))
+        return 0;
+
+    /* The command name may contain spaces, skip until after it */
+    auto pos = line.rfind(')');
+    if (pos == std::string::npos)
+        return 0;
+
+    std::istringstream fields(line.substr(pos + 2));
+    std::string field;
+    long long utime = 0, stime = 0;
+
+    /* utime and stime are fields 14 and 15, we start at field 3 */
+    for (int i = 3; i <= 15 && fields >> field; i++)
+    {
+        if (i == 14)
+            utime = std::stoll(field);
+        if (i == 15)
+            stime = std::stoll(field);
+    }
+
+    return (utime + stime) * 1000000ll / sysconf(_SC_CLK_TCK);
+}
+
+std::string bench_compositor::dump_frame_stats()
+{
+    std::ifstream log_before(log_file, std::ios::ate);
+    auto offset = log_before.tellg();
+    log_before.close();
+
+    kill(pid, SIGUSR1);
+    usleep(200 * 1000);
+
+    std::ifstream log(log_file);
+    if (offset > 0)
+        log.seekg(offset);
+
+    std::string line, result;
+    bool in_stats = false;
+    while (std::getline(log, line))
+    {
+        if (line.find("frame timings for output") != std::string::npos)
+            in_stats = true;
+
+        if (in_stats)
+            result += line + "\n";
+    }
+
+    return result;
+}
+
+void bench_compositor::stop()
+{
+    if (pid > 0)
+    {
+        kill(pid, SIGTERM);
+        waitpid(pid, NULL, 0);
+        pid = -1;
+    }
+
+    unlink(config_file.c_str());
+    unlink(log_file.c_str());
+    rmdir(runtime_dir.c_str());
+}
+
+/* ------------------------------- main ------------------------------------ */
+static void print_usage(const char *name)
+{
+    printf("Usage: %s [options]\n"
+        "  -c, --clients N       number of synthetic clients (default 4)\n"
+        "  -r, --rate HZ         commits per second of each client (default 60)\n"
+        "  -s, --size WxH        size of the client windows (default 400x300)\n"
+        "  -D, --damage WxH      damaged area per commit (default 64x64)\n"
+        "  -t, --duration SEC    duration of the benchmark (default 10)\n"
+        "  -F, --fullscreen      clients are fullscreen, with output-sized buffers\n"
+        "  -w, --wayfire PATH    compositor binary to benchmark\n"
+        "  -p, --plugins DIR     directory with the compositor plugins\n"
+        "  -h, --help            show this help\n", name);
+}
+
+static bool parse_size(const char *arg, int& w, int& h)
+{
+    return sscanf(arg, "%dx%d", &w, &h) == 2 && w > 0 && h > 0;
+}
+
+int main(int argc, char *argv[])
+{
+    bench_options options;
+
+    struct option opts[] = {
+        { "clients",  required_argument, NULL, 'c' },
+        { "rate",     required_argument, NULL, 'r' },
+        { "size",     required_argument, NULL, 's' },
+        { "damage",   required_argument, NULL, 'D' },
+        { "duration", required_argument, NULL, 't' },
+        { "fullscreen", no_argument,     NULL, 'F' },
+        { "wayfire",  required_argument, NULL, 'w' },
+        { "plugins",  required_argument, NULL, 'p' },
+        { "help",     no_argument,       NULL, 'h' },
+        { 0,          0,                 NULL,  0  }
+    };
+
+    int c, i;
+    while ((c = getopt_long(argc, argv, "c:r:s:D:t:Fw:p:h", opts, &i)) != -1)
+    {
+        switch (c)
+        {
+            case 'c':
+                options.clients = std::max(1, atoi(optarg));
+                break;
+            case 'r':
+                options.rate = std::max(1, atoi(optarg));
+                break;
+            case 's':
+                if (!parse_size(optarg, options.width, options.height))
+                {
+                    fprintf(stderr, "invalid size %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'D':
+                if (!parse_size(optarg, options.damage_width, options.damage_height))
+                {
+                    fprintf(stderr, "invalid damage size %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 't':
+                options.duration = std::max(1, atoi(optarg));
+                break;
+            case 'F':
+                options.fullscreen = true;
+                break;
+            case 'w':
+                options.compositor = optarg;
+                break;
+            case 'p':
+                options.plugin_dir = optarg;
+                break;
+            case 'h':
+                print_usage(argv[0]);
+                return EXIT_SUCCESS;
+            default:
+                print_usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    bench_compositor compositor;
+    if (!compositor.start(options))
+    {
+        compositor.stop();
+        return EXIT_FAILURE;
+    }
+
+    std::vector<bench_client> clients(options.clients);
+    std::vector<std::thread> threads;
+    std::atomic<bool> running{true};
+
+    int64_t cpu_start = compositor.get_cpu_time();
+    int64_t time_start = get_time_usec();
+
+    for (int i = 0; i < options.clients; i++)
+    {
+        clients[i].options = &options;
+        clients[i].index = i;
+        threads.emplace_back([&clients, &running, i] () {
+            clients[i].run(running);
+        });
+    }
+
+    sleep(options.duration);
+    running = false;
+    for (auto& t : threads)
+        t.join();
+
+    int64_t elapsed = get_time_usec() - time_start;
+    int64_t cpu_time = compositor.get_cpu_time() - cpu_start;
+    auto frame_stats = compositor.dump_frame_stats();
+    compositor.stop();
+
+    std::vector<int64_t> latencies;
+    int64_t total_commits = 0, total_skipped = 0, max_frames = 0;
+    int failed = 0;
+    for (auto& client : clients)
+    {
+        latencies.insert(latencies.end(),
+            client.latencies.begin(), client.latencies.end());
+        total_commits += client.commits;
+        total_skipped += client.skipped_commits;
+        max_frames = std::max(max_frames, client.frames);
+        failed += client.failed;
+    }
+
+    if (failed == options.clients)
+    {
+        fprintf(stderr, "all clients failed\n");
+        return EXIT_FAILURE;
+    }
+
+    /* Every repaint of the output sends a frame callback to all visible
+     * clients which requested one, so the client with the most frame
+     * callbacks is a good approximation of the output frame count */
+    double seconds = elapsed / 1e6;
+    printf("clients: %d (%d failed), %dx%d, damage %dx%d at %d Hz, %.1fs\n",
+        options.clients, failed, options.width, options.height,
+        options.damage_width, options.damage_height, options.rate, seconds);
+    printf("commits: %lld (%lld skipped, buffers busy)\n",
+        (long long)total_commits, (long long)total_skipped);
+    printf("fps: %.1f\n", max_frames / seconds);
+    printf("frame latency (usec): p50 %lld p90 %lld p99 %lld max %lld\n",
+        (long long)percentile(latencies, 50), (long long)percentile(latencies, 90),
+        (long long)percentile(latencies, 99), (long long)percentile(latencies, 100));
+    printf("compositor cpu time: %.1f%%, %lld usec per frame\n",
+        100.0 * cpu_time / elapsed,
+        (long long)(max_frames ? cpu_time / max_frames : 0));
+    printf("%s", frame_stats.c_str());
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -133,6 +133,8 @@ class wayfire_animation : public wayfire_plugin_t
             section->get_option("fire_particles", "2000");
         FireAnimation::fire_particle_size =
             section->get_option("fire_particle_size", "16");
+        FireAnimation::fire_backend =
+            section->get_option("fire_backend", "cpu");
 
         output->connect_signal("map-view", &on_view_mapped);
         output->connect_signal("unmap-view", &on_view_unmapped);
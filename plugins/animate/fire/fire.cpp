@@ -2,16 +2,20 @@
 #include "particle.hpp"
 
 #include <thread>
+#include <random>
 #include <output.hpp>
 #include <core.hpp>
 
 wf_option FireAnimation::fire_particles;
 wf_option FireAnimation::fire_particle_size;
+wf_option FireAnimation::fire_backend;
 
 // generate a random float between s and e
+// particles are spawned from several threads, so each has its own engine
 static float random(float s, float e)
 {
-    double r = 1.0 * (std::rand() % RAND_MAX) / (RAND_MAX - 1);
+    static thread_local std::minstd_rand engine{std::random_device{}()};
+    double r = std::uniform_real_distribution<double>(0, 1)(engine);
     return (s * r + (1 - r) * e);
 }
 
@@ -22,6 +26,14 @@ static int particle_count_for_width(int width)
     return particles * std::min(width / 400.0, 3.5);
 }
 
+static ParticleBackend get_particle_backend()
+{
+    if (FireAnimation::fire_backend->as_string() == "gpu")
+        return PARTICLE_BACKEND_GPU;
+
+    return PARTICLE_BACKEND_CPU;
+}
+
 class FireTransformer : public wf_view_transformer_t
 {
     effect_hook_t pre_paint;
@@ -33,7 +45,8 @@ class FireTransformer : public wf_view_transformer_t
 
     FireTransformer(wayfire_view view) :
         ps(FireAnimation::fire_particles->as_cached_int(),
-           [=] (Particle& p) {init_particle(p); })
+           [=] (Particle& p) {init_particle(p); },
+           get_particle_backend())
     {
         last_boundingbox = view->get_bounding_box();
         ps.resize(particle_count_for_width(last_boundingbox.width));
@@ -71,6 +84,13 @@ class FireTransformer : public wf_view_transformer_t
         progress_line = line;
     }
 
+    /* Read on the main thread, the initer runs in the worker threads */
+    double particle_size = 0;
+    void set_particle_size(double size)
+    {
+        particle_size = size;
+    }
+
     void init_particle(Particle& p)
     {
         p.life = 1;
@@ -86,8 +106,8 @@ class FireTransformer : public wf_view_transformer_t
         p.speed = {random(-10, 10), random(-25, 5)};
         p.g = {-1, -3};
 
-        double size = FireAnimation::fire_particle_size->as_double();
-        p.base_radius = p.radius = random(size * 0.8, size * 1.2);
+        p.base_radius = p.radius =
+            random(particle_size * 0.8, particle_size * 1.2);
     }
 
     virtual void render_box(uint32_t src_tex, wlr_box src_box,
@@ -149,9 +169,14 @@ bool FireAnimation::step()
 {
     transformer->set_progress_line(duration.progress());
     if (duration.running())
+    {
+        transformer->set_particle_size(fire_particle_size->as_double());
         transformer->ps.spawn(transformer->ps.size() / 10);
+    }
 
     transformer->ps.update();
+    /* The particles move without damaging the view */
+    transformer->damage();
     return duration.running() || transformer->ps.statistic();
 }
 
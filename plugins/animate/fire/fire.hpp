@@ -18,7 +18,7 @@ class FireAnimation : public animation_base
 
     public:
 
-    static wf_option fire_particles, fire_particle_size;
+    static wf_option fire_particles, fire_particle_size, fire_backend;
 
     ~FireAnimation();
     virtual void init(wayfire_view view, wf_option duration, wf_animation_type type);
@@ -1,45 +1,25 @@
 #include "particle.hpp"
 #include "shaders.hpp"
 #include <core.hpp>
-#include <thread>
+#include <worker-pool.hpp>
 #include <debug.hpp>
+#include <cmath>
 
-void Particle::update(float time)
+ParticleSystem::ParticleSystem(int particles, ParticleIniter init_func,
+    ParticleBackend backend)
 {
-    if (life <= 0) // ignore
-        return;
-
-    const float slowdown = 0.8;
-
-    pos += speed * 0.2f * slowdown;
-    speed += g * 0.3f * slowdown;
-
-    if (life != 0)
-        color.a /= life;
-
-    life -= fade * 0.3 * slowdown;
-    radius = base_radius * std::pow(life, 0.5);
-    color.a *= life;
-
-    if (start_pos.x < pos.x)
-        g.x = -1;
-    else
-        g.x = 1;
+    this->pinit_func = init_func;
+    this->backend = backend;
 
-    if (life <= 0)
+    create_program();
+    if (backend == PARTICLE_BACKEND_GPU && !create_gpu_program())
     {
-        /* move outside */
-        pos = {-10000, -10000};
+        log_error("fire: GPU particle backend not supported, using the CPU");
+        this->backend = PARTICLE_BACKEND_CPU;
     }
-}
-
-ParticleSystem::ParticleSystem(int particles, ParticleIniter init_func)
-{
-    this->pinit_func = init_func;
 
     resize(particles);
     last_update_msec = get_current_time();
-    create_program();
 
     particles_alive.store(0);
 }
@@ -47,99 +27,168 @@ ParticleSystem::ParticleSystem(int particles, ParticleIniter init_func)
 ParticleSystem::~ParticleSystem()
 {
     OpenGL::render_begin();
-    GL_CALL(glDeleteProgram(program.id));
+    OpenGL::destroy_program(program.id);
+    if (backend == PARTICLE_BACKEND_GPU)
+    {
+        OpenGL::destroy_program(gpu.id);
+        GL_CALL(glDeleteBuffers(2, gpu.buffers));
+    }
     OpenGL::render_end();
 }
 
+void ParticleSystem::spawn_particle(int i)
+{
+    Particle p;
+    pinit_func(p);
+
+    life[i] = p.life;
+    fade[i] = p.fade;
+    base_radius[i] = p.base_radius;
+    radius[i] = p.radius;
+
+    center_x[i] = p.pos.x;
+    center_y[i] = p.pos.y;
+    speed_x[i] = p.speed.x;
+    speed_y[i] = p.speed.y;
+    g_x[i] = p.g.x;
+    g_y[i] = p.g.y;
+    start_x[i] = p.start_pos.x;
+
+    for (int j = 0; j < color_per_particle; j++)
+        color[color_per_particle * i + j] = p.color[j];
+
+    alpha[i] = p.color.a;
+    alpha_per_life[i] = p.color.a / p.life;
+}
+
 int ParticleSystem::spawn(int num)
 {
-    // TODO: multithread this
-    int spawned = 0;
-    for (size_t i = 0; i < ps.size() && spawned < num; i++)
+    if (backend == PARTICLE_BACKEND_GPU)
+        return gpu_spawn(num);
+
+    std::atomic<int> spawned{0};
+    exec_worker_threads([&] (int start, int end)
     {
-        if (ps[i].life <= 0)
+        for (int i = start; i < end && spawned < num; i++)
         {
-            pinit_func(ps[i]);
-            ++spawned;
+            if (life[i] > 0)
+                continue;
+
+            /* Another worker might have spawned the last particles */
+            if (spawned.fetch_add(1) >= num)
+                break;
+
+            spawn_particle(i);
             ++particles_alive;
         }
-    }
+    });
 
-    return spawned;
+    return std::min(num, spawned.load());
 }
 
 void ParticleSystem::resize(int num)
 {
-    if (num == (int)ps.size())
+    if (num == num_particles)
         return;
 
-    // TODO: multithread this
-    for (int i = num; i < (int)ps.size(); i++)
+    std::atomic<int> removed_alive{0};
+    exec_worker_threads([&] (int start, int end)
     {
-        if (ps[i].life >= 0)
-            --particles_alive;
-    }
+        int alive = 0;
+        for (int i = std::max(start, num); i < end; i++)
+            alive += (life[i] > 0);
+
+        removed_alive += alive;
+    });
 
-    ps.resize(num);
+    particles_alive -= removed_alive;
+    num_particles = num;
+
+    life.resize(num, -1);
+    fade.resize(num);
+
+    /* With the GPU backend, the buffers are resized on the next spawn or
+     * update, because we may be in the middle of rendering here */
+    if (backend == PARTICLE_BACKEND_GPU)
+        return;
+
+    base_radius.resize(num);
+    alpha_per_life.resize(num);
+
+    speed_x.resize(num);
+    speed_y.resize(num);
+    g_x.resize(num);
+    g_y.resize(num);
+    start_x.resize(num);
 
     color.resize(color_per_particle * num);
-    dark_color.resize(color_per_particle * num);
-    radius.resize(radius_per_particle * num);
-    center.resize(center_per_particle * num);
+    alpha.resize(num);
+    radius.resize(num, 0);
+    center_x.resize(num);
+    center_y.resize(num);
 }
 
 int ParticleSystem::size()
 {
-    return ps.size();
+    return num_particles;
 }
 
-void ParticleSystem::update_worker(float time, int start, int end)
+/* Advances particles [start, end) by one step, returns the number of
+ * particles which died. The arrays never overlap, and telling the compiler so
+ * with __restrict lets it vectorize the loop. */
+static int update_particles(int start, int end,
+    float *__restrict life, const float *__restrict fade,
+    float *__restrict center_x, float *__restrict center_y,
+    float *__restrict speed_x, float *__restrict speed_y,
+    float *__restrict g_x, const float *__restrict g_y,
+    const float *__restrict start_x,
+    float *__restrict alpha, const float *__restrict alpha_per_life,
+    float *__restrict radius, const float *__restrict base_radius)
 {
-    end = std::min(end, (int)ps.size());
+    const float slowdown = 0.8;
+
+    /* There are no branches in the loop: dead particles are updated too,
+     * but multiplied by a zero mask, so they don't change */
+    int died = 0;
     for (int i = start; i < end; ++i)
     {
-        if (ps[i].life <= 0)
-            continue;
+        float alive = life[i] > 0 ? 1.0f : 0.0f;
 
-    //    printf("%d\n", i);
-        ps[i].update(time);
+        center_x[i] += alive * speed_x[i] * (0.2f * slowdown);
+        center_y[i] += alive * speed_y[i] * (0.2f * slowdown);
+        speed_x[i]  += alive * g_x[i]     * (0.3f * slowdown);
+        speed_y[i]  += alive * g_y[i]     * (0.3f * slowdown);
+        life[i]     -= alive * fade[i]    * (0.3f * slowdown);
 
-        if (ps[i].life <= 0)
-            --particles_alive;
+        /* Alpha is proportional to the remaining life */
+        float remaining = std::max(life[i], 0.0f);
+        alpha[i] = alpha_per_life[i] * remaining;
+        radius[i] = base_radius[i] * std::sqrt(remaining);
+        g_x[i] = (start_x[i] < center_x[i]) ? -1.0f : 1.0f;
 
-        for (int j = 0; j < 4; j++) // maybe use memcpy?
-        {
-            color[4 * i + j] = ps[i].color[j];
-            dark_color[4 * i + j] = ps[i].color[j] * 0.5;
-        }
+        /* move outside */
+        bool dying = alive > 0 && life[i] <= 0;
+        center_x[i] = dying ? -10000.0f : center_x[i];
+        center_y[i] = dying ? -10000.0f : center_y[i];
+        died += dying;
+    }
 
-     //   printf("center %d gets %f", 2 * i, ps[i].pos[0]);
-        center[2 * i] = ps[i].pos[0];
-        center[2 * i + 1] = ps[i].pos[1];
+    return died;
+}
 
-        radius[i] = ps[i].radius;
-    }
+void ParticleSystem::update_worker(float time, int start, int end)
+{
+    end = std::min(end, num_particles);
+    particles_alive -= update_particles(start, end, life.data(), fade.data(),
+        center_x.data(), center_y.data(), speed_x.data(), speed_y.data(),
+        g_x.data(), g_y.data(), start_x.data(), alpha.data(),
+        alpha_per_life.data(), radius.data(), base_radius.data());
 }
 
 void ParticleSystem::exec_worker_threads(std::function<void(int, int)> spawn_worker)
 {
-//    return spawn_worker(0, ps.size());
-
-    const int num_threads = std::thread::hardware_concurrency();
-    const int worker_load = (ps.size() + num_threads - 1) / num_threads;
-
-    std::thread workers[num_threads];
-    for (int i = 0; i < num_threads; i++)
-    {
-        int thread_start = i * worker_load;
-        int thread_end = (i + 1) * worker_load;
-        thread_end = std::min(thread_end, (int)ps.size());
-
-        workers[i] = std::thread([=] () { spawn_worker(thread_start, thread_end); });
-    }
-
-    for (auto& w : workers)
-        w.join();
+    wf::worker_pool_t::get().parallel_for(num_particles, particles_per_chunk,
+        spawn_worker);
 }
 
 void ParticleSystem::update()
@@ -148,6 +197,9 @@ void ParticleSystem::update()
     float time = (get_current_time() - last_update_msec) / 16.0;
     last_update_msec = get_current_time();
 
+    if (backend == PARTICLE_BACKEND_GPU)
+        return gpu_update();
+
     exec_worker_threads([=] (int start, int end) {
         update_worker(time, start, end);
     });
@@ -168,10 +220,14 @@ void ParticleSystem::create_program()
 
     program.radius    = GL_CALL(glGetAttribLocation(program.id, "radius"));
     program.position  = GL_CALL(glGetAttribLocation(program.id, "position"));
-    program.center    = GL_CALL(glGetAttribLocation(program.id, "center"));
+    program.center_x  = GL_CALL(glGetAttribLocation(program.id, "center_x"));
+    program.center_y  = GL_CALL(glGetAttribLocation(program.id, "center_y"));
     program.color     = GL_CALL(glGetAttribLocation(program.id, "color"));
+    program.alpha     = GL_CALL(glGetAttribLocation(program.id, "alpha"));
     program.matrix    = GL_CALL(glGetUniformLocation(program.id, "matrix"));
     program.smoothing = GL_CALL(glGetUniformLocation(program.id, "smoothing"));
+    program.color_factor =
+        GL_CALL(glGetUniformLocation(program.id, "color_factor"));
 
     OpenGL::render_end();
 }
@@ -193,56 +249,305 @@ void ParticleSystem::render(glm::mat4 matrix)
                                   false, 0, vertex_data));
     GL_CALL(glVertexAttribDivisor(program.position, 0));
 
-    // particle radius
-    GL_CALL(glEnableVertexAttribArray(program.radius));
-    GL_CALL(glVertexAttribPointer(program.radius, 1, GL_FLOAT,
-                                  false, 0, radius.data()));
-    GL_CALL(glVertexAttribDivisor(program.radius, 1));;
+    /* The attributes of each particle */
+    const GLuint instanced[] = {program.radius, program.center_x,
+        program.center_y, program.color, program.alpha};
+    for (auto attrib : instanced)
+    {
+        GL_CALL(glEnableVertexAttribArray(attrib));
+    }
+
+    int count = num_particles;
+    if (backend == PARTICLE_BACKEND_GPU)
+    {
+        /* Render straight from the simulation state */
+        const int stride = gpu_floats_per_particle * sizeof(float);
+        GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, gpu.buffers[gpu.current]));
+        GL_CALL(glVertexAttribPointer(program.center_x, 1, GL_FLOAT,
+                false, stride, (void*)0));
+        GL_CALL(glVertexAttribPointer(program.center_y, 1, GL_FLOAT,
+                false, stride, (void*)(1 * sizeof(float))));
+        GL_CALL(glVertexAttribPointer(program.radius, 1, GL_FLOAT,
+                false, stride, (void*)(11 * sizeof(float))));
+        GL_CALL(glVertexAttribPointer(program.color, 3, GL_FLOAT,
+                false, stride, (void*)(12 * sizeof(float))));
+        GL_CALL(glVertexAttribPointer(program.alpha, 1, GL_FLOAT,
+                false, stride, (void*)(15 * sizeof(float))));
+        GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, 0));
+
+        count = std::min(count, gpu.allocated);
+    } else
+    {
+        GL_CALL(glVertexAttribPointer(program.radius, 1, GL_FLOAT,
+                false, 0, radius.data()));
+        GL_CALL(glVertexAttribPointer(program.center_x, 1, GL_FLOAT,
+                false, 0, center_x.data()));
+        GL_CALL(glVertexAttribPointer(program.center_y, 1, GL_FLOAT,
+                false, 0, center_y.data()));
+        GL_CALL(glVertexAttribPointer(program.color, 3, GL_FLOAT,
+                false, 0, color.data()));
+        GL_CALL(glVertexAttribPointer(program.alpha, 1, GL_FLOAT,
+                false, 0, alpha.data()));
+    }
 
-    // particle center (offset)
-    GL_CALL(glEnableVertexAttribArray(program.center));
-    GL_CALL(glVertexAttribPointer(program.center, 2, GL_FLOAT,
-                                  false, 0, center.data()));
-    GL_CALL(glVertexAttribDivisor(program.center, 1));
+    for (auto attrib : instanced)
+    {
+        GL_CALL(glVertexAttribDivisor(attrib, 1));
+    }
 
     // matrix
     GL_CALL(glUniformMatrix4fv(program.matrix, 1, false, &matrix[0][0]));
 
-    GL_CALL(glEnableVertexAttribArray(program.color));
-    GL_CALL(glVertexAttribDivisor(program.color, 1));
-
     /* Darken the background */
-    GL_CALL(glVertexAttribPointer(program.color, 4, GL_FLOAT,
-                                  false, 0, dark_color.data()));
-
     GL_CALL(glEnable(GL_BLEND));
     GL_CALL(glBlendFunc(GL_ZERO, GL_ONE_MINUS_SRC_ALPHA));
     GL_CALL(glUniform1f(program.smoothing, 0.7f));
+    GL_CALL(glUniform1f(program.color_factor, 0.5f));
     // TODO: optimize shaders for this case
-    GL_CALL(glDrawArraysInstanced(GL_TRIANGLE_FAN, 0, 4, ps.size()));
+    GL_CALL(glDrawArraysInstanced(GL_TRIANGLE_FAN, 0, 4, count));
 
     // particle color
-    GL_CALL(glVertexAttribPointer(program.color, 4, GL_FLOAT,
-                                  false, 0, color.data()));
     GL_CALL(glBlendFunc(GL_SRC_ALPHA, GL_ONE));
     GL_CALL(glUniform1f(program.smoothing, 0.5f));
-    GL_CALL(glDrawArraysInstanced(GL_TRIANGLE_FAN, 0, 4, ps.size()));
+    GL_CALL(glUniform1f(program.color_factor, 1.0f));
+    GL_CALL(glDrawArraysInstanced(GL_TRIANGLE_FAN, 0, 4, count));
 
     GL_CALL(glDisable(GL_BLEND));
 
     // reset vertex attrib state, other renderers may need this
     GL_CALL(glVertexAttribDivisor(program.position, 0));
-    GL_CALL(glVertexAttribDivisor(program.radius, 0));;
-    GL_CALL(glVertexAttribDivisor(program.center, 0));
-    GL_CALL(glVertexAttribDivisor(program.color, 0));
+    for (auto attrib : instanced)
+    {
+        GL_CALL(glVertexAttribDivisor(attrib, 0));
+    }
 
     GL_CALL(glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA));
     GL_CALL(glUseProgram(0));
 
     GL_CALL(glDisableVertexAttribArray(program.position));
-    GL_CALL(glDisableVertexAttribArray(program.radius));
-    GL_CALL(glDisableVertexAttribArray(program.center));
-    GL_CALL(glDisableVertexAttribArray(program.color));
+    for (auto attrib : instanced)
+    {
+        GL_CALL(glDisableVertexAttribArray(attrib));
+    }
+}
+
+
+
+ParticleBackend ParticleSystem::get_backend()
+{
+    return backend;
 }
 
+bool ParticleSystem::create_gpu_program()
+{
+    OpenGL::render_begin();
+
+    /* The varyings have to be specified before linking */
+    static const char *varyings[] = {
+        "out_pos_speed", "out_g_start", "out_life", "out_color"
+    };
+
+    auto set_varyings = [] (GLuint program)
+    {
+        GL_CALL(glTransformFeedbackVaryings(program, 4, varyings,
+                GL_INTERLEAVED_ATTRIBS));
+    };
 
+    gpu.id = OpenGL::create_program_from_source(particle_update_vert_source,
+        particle_update_frag_source, {}, set_varyings,
+        "interleaved out_pos_speed out_g_start out_life out_color");
+
+    if (gpu.id == (GLuint)-1)
+    {
+        log_error("fire: failed to create the particle update program");
+        gpu.id = 0;
+
+        OpenGL::render_end();
+        return false;
+    }
+
+    gpu.pos_speed = GL_CALL(glGetAttribLocation(gpu.id, "pos_speed"));
+    gpu.g_start   = GL_CALL(glGetAttribLocation(gpu.id, "g_start"));
+    gpu.life      = GL_CALL(glGetAttribLocation(gpu.id, "life"));
+    gpu.color     = GL_CALL(glGetAttribLocation(gpu.id, "color"));
+
+    OpenGL::render_end();
+    return true;
+}
+
+/* Must be called with the GL context current */
+void ParticleSystem::gpu_resize_buffers()
+{
+    if (gpu.allocated == num_particles)
+        return;
+
+    /* New particles are dead, and outside of the screen */
+    const float dead_particle[gpu_floats_per_particle] = {
+        -10000, -10000, 0, 0,
+        0, 0, 0, 0,
+        -1, 0, 0, 0,
+        0, 0, 0, 0,
+    };
+
+    std::vector<float> data(gpu_floats_per_particle * num_particles);
+    for (int i = 0; i < num_particles; i++)
+    {
+        std::copy(dead_particle, dead_particle + gpu_floats_per_particle,
+            data.begin() + i * gpu_floats_per_particle);
+    }
+
+    GLuint buffers[2];
+    GL_CALL(glGenBuffers(2, buffers));
+    for (int i = 0; i < 2; i++)
+    {
+        GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, buffers[i]));
+        GL_CALL(glBufferData(GL_ARRAY_BUFFER, data.size() * sizeof(float),
+                data.data(), GL_DYNAMIC_COPY));
+    }
+    GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, 0));
+
+    /* Keep the particles which are still in range */
+    int kept = std::min(gpu.allocated, num_particles);
+    if (kept > 0)
+    {
+        GL_CALL(glBindBuffer(GL_COPY_READ_BUFFER, gpu.buffers[gpu.current]));
+        GL_CALL(glBindBuffer(GL_COPY_WRITE_BUFFER, buffers[0]));
+        GL_CALL(glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+                0, 0, kept * gpu_floats_per_particle * sizeof(float)));
+        GL_CALL(glBindBuffer(GL_COPY_READ_BUFFER, 0));
+        GL_CALL(glBindBuffer(GL_COPY_WRITE_BUFFER, 0));
+    }
+
+    if (gpu.allocated > 0)
+        GL_CALL(glDeleteBuffers(2, gpu.buffers));
+
+    gpu.buffers[0] = buffers[0];
+    gpu.buffers[1] = buffers[1];
+    gpu.current = 0;
+    gpu.allocated = num_particles;
+}
+
+int ParticleSystem::gpu_spawn(int num)
+{
+    OpenGL::render_begin();
+    gpu_resize_buffers();
+    GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, gpu.buffers[gpu.current]));
+
+    /* Upload consecutive new particles with a single call */
+    std::vector<float> run;
+    int run_start = 0;
+    auto flush_run = [&] ()
+    {
+        if (run.empty())
+            return;
+
+        GL_CALL(glBufferSubData(GL_ARRAY_BUFFER,
+                run_start * gpu_floats_per_particle * sizeof(float),
+                run.size() * sizeof(float), run.data()));
+        run.clear();
+    };
+
+    int spawned = 0;
+    for (int i = 0; i < num_particles && spawned < num; i++)
+    {
+        if (life[i] > 0)
+            continue;
+
+        Particle p;
+        pinit_func(p);
+        life[i] = p.life;
+        fade[i] = p.fade;
+
+        if (run_start + (int)run.size() / gpu_floats_per_particle != i)
+        {
+            flush_run();
+            run_start = i;
+        }
+
+        const float data[gpu_floats_per_particle] = {
+            p.pos.x, p.pos.y, p.speed.x, p.speed.y,
+            p.g.x, p.g.y, p.start_pos.x, p.start_pos.y,
+            p.life, p.fade, p.base_radius, p.radius,
+            p.color.r, p.color.g, p.color.b, p.color.a,
+        };
+        run.insert(run.end(), data, data + gpu_floats_per_particle);
+
+        ++spawned;
+        ++particles_alive;
+    }
+
+    flush_run();
+    GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, 0));
+    OpenGL::render_end();
+
+    return spawned;
+}
+
+void ParticleSystem::gpu_update_life_worker(int start, int end)
+{
+    const float slowdown = 0.8;
+
+    int died = 0;
+    end = std::min(end, num_particles);
+    for (int i = start; i < end; ++i)
+    {
+        if (life[i] <= 0)
+            continue;
+
+        life[i] -= fade[i] * 0.3f * slowdown;
+        if (life[i] <= 0)
+            ++died;
+    }
+
+    particles_alive -= died;
+}
+
+void ParticleSystem::set_gpu_state_attribs(GLuint pos_speed, GLuint g_start,
+    GLuint life, GLuint color)
+{
+    const int stride = gpu_floats_per_particle * sizeof(float);
+    const GLuint attribs[] = {pos_speed, g_start, life, color};
+    for (int i = 0; i < 4; i++)
+    {
+        GL_CALL(glEnableVertexAttribArray(attribs[i]));
+        GL_CALL(glVertexAttribPointer(attribs[i], 4, GL_FLOAT, false,
+                stride, (void*)(4 * i * sizeof(float))));
+    }
+}
+
+void ParticleSystem::gpu_update()
+{
+    /* Track which particles are alive on the CPU as well, so that we don't
+     * have to read anything back from the GPU */
+    exec_worker_threads([=] (int start, int end) {
+        gpu_update_life_worker(start, end);
+    });
+
+    OpenGL::render_begin();
+    gpu_resize_buffers();
+
+    GL_CALL(glUseProgram(gpu.id));
+    GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, gpu.buffers[gpu.current]));
+    set_gpu_state_attribs(gpu.pos_speed, gpu.g_start, gpu.life, gpu.color);
+
+    GL_CALL(glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0,
+            gpu.buffers[1 - gpu.current]));
+
+    GL_CALL(glEnable(GL_RASTERIZER_DISCARD));
+    GL_CALL(glBeginTransformFeedback(GL_POINTS));
+    GL_CALL(glDrawArrays(GL_POINTS, 0, gpu.allocated));
+    GL_CALL(glEndTransformFeedback());
+    GL_CALL(glDisable(GL_RASTERIZER_DISCARD));
+
+    GL_CALL(glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0));
+    GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, 0));
+
+    GL_CALL(glDisableVertexAttribArray(gpu.pos_speed));
+    GL_CALL(glDisableVertexAttribArray(gpu.g_start));
+    GL_CALL(glDisableVertexAttribArray(gpu.life));
+    GL_CALL(glDisableVertexAttribArray(gpu.color));
+    GL_CALL(glUseProgram(0));
+
+    gpu.current = 1 - gpu.current;
+    OpenGL::render_end();
+}
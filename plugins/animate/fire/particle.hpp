@@ -6,6 +6,7 @@
 #include <atomic>
 #include <vector>
 
+/* The initial state of a particle, filled by the ParticleIniter */
 struct Particle
 {
     float life = -1;
@@ -17,23 +18,29 @@ struct Particle
     glm::vec2 start_pos;
 
     glm::vec4 color{1.0, 1.0, 1.0, 1.0};
-
-    /* update the given particle
-     * time is the percentage of the frame which has elapsed
-     * must be thread-safe */
-    void update(float time);
 };
 
-/* a function to initialize a particle */
+/* a function to initialize a particle
+ * must be thread-safe, particles are spawned in parallel */
 using ParticleIniter = std::function<void(Particle&)>;
 
+enum ParticleBackend
+{
+    /* Simulate the particles on the CPU, using the worker pool */
+    PARTICLE_BACKEND_CPU,
+    /* Keep the particles in GL buffers and simulate them with transform
+     * feedback. Needs OpenGL ES 3.0, otherwise the CPU backend is used */
+    PARTICLE_BACKEND_GPU,
+};
+
 class ParticleSystem
 {
     public:
         /* the user of this class has to set up a proper GL context
          * before creating the ParticleSystem */
         ParticleSystem(int num_part,
-                       ParticleIniter part_init_func);
+                       ParticleIniter part_init_func,
+                       ParticleBackend backend = PARTICLE_BACKEND_CPU);
         ~ParticleSystem();
 
         /* spawn at most num new particles.
@@ -58,35 +65,77 @@ class ParticleSystem
          * used during the creation of the particle system */
         void render(glm::mat4 matrix);
 
+        /* The backend actually used, which may differ from the requested
+         * one if it isn't supported */
+        ParticleBackend get_backend();
+
     private:
         ParticleSystem() = delete;
 
         ParticleIniter pinit_func;
+        ParticleBackend backend;
         uint32_t last_update_msec;
 
-        std::atomic<int> particles_alive;
-        std::vector<Particle> ps;
+        std::atomic<int> particles_alive{0};
+        int num_particles = 0;
 
-        static constexpr int color_per_particle = 4;
-        std::vector<float> color, dark_color;
+        /* The particles are stored as a structure of arrays, with separate
+         * arrays for the x and y coordinates, so that update_worker() can be
+         * vectorized. The color, alpha, radius and center arrays are used
+         * directly as vertex attributes when rendering. */
+        std::vector<float> life, fade, base_radius;
+        /* The initial alpha divided by the initial life, alpha decreases
+         * linearly with the remaining life */
+        std::vector<float> alpha_per_life;
 
-        static constexpr int radius_per_particle = 1;
-        std::vector<float> radius;
+        std::vector<float> speed_x, speed_y, g_x, g_y, start_x;
 
-        static constexpr int center_per_particle = 2;
-        std::vector<float> center;
+        static constexpr int color_per_particle = 3;
+        std::vector<float> color, alpha;
 
+        std::vector<float> radius;
+        std::vector<float> center_x, center_y;
+
+        /* Number of particles processed by a worker at once */
+        static constexpr int particles_per_chunk = 512;
 
         struct {
             GLuint id;
-            GLuint radius, position, center, color;
-            GLuint smoothing;
+            GLuint radius, position, center_x, center_y, color, alpha;
+            GLuint smoothing, color_factor;
             GLuint matrix;
         } program;
 
+        /* The GPU backend keeps the whole state of each particle interleaved
+         * in a GL buffer: position and speed, gravity and start position,
+         * life, fade, base radius and radius, and color.
+         *
+         * There are two buffers, each update reads from the current one and
+         * writes to the other. Only life and fade are mirrored on the CPU,
+         * so that we know which particles are alive without reading back. */
+        static constexpr int gpu_floats_per_particle = 16;
+        struct {
+            GLuint id = 0;
+            GLuint pos_speed, g_start, life, color;
+
+            GLuint buffers[2] = {0, 0};
+            int current = 0;
+            /* Number of particles the buffers have space for */
+            int allocated = 0;
+        } gpu;
+
         void exec_worker_threads(std::function<void(int, int)> spawn_worker);
         void update_worker(float time, int start, int end);
+        void spawn_particle(int i);
         void create_program();
+
+        bool create_gpu_program();
+        void gpu_resize_buffers();
+        int gpu_spawn(int num);
+        void gpu_update();
+        void gpu_update_life_worker(int start, int end);
+        void set_gpu_state_attribs(GLuint pos_speed, GLuint g_start,
+            GLuint life, GLuint color);
 };
 
 
@@ -7,10 +7,13 @@ R"(
 
 attribute mediump float radius;
 attribute mediump vec2 position;
-attribute mediump vec2 center;
-attribute mediump vec4 color;
+attribute mediump float center_x;
+attribute mediump float center_y;
+attribute mediump vec3 color;
+attribute mediump float alpha;
 
 uniform mat4 matrix;
+uniform mediump float color_factor;
 
 varying mediump vec2 uv;
 varying mediump vec4 out_color;
@@ -18,10 +21,10 @@ varying mediump float R;
 
 void main() {
     uv = position * radius;
-    gl_Position = matrix * vec4(center.x + uv.x * 0.75, center.y + uv.y, 0.0, 1.0);
+    gl_Position = matrix * vec4(center_x + uv.x * 0.75, center_y + uv.y, 0.0, 1.0);
 
     R = radius;
-    out_color = color;
+    out_color = vec4(color, alpha) * color_factor;
 }
 )";
 
@@ -50,4 +53,65 @@ void main()
 }
 )";
 
+/* Advances the simulation of a single particle by one step. The state of
+ * each particle is written back with transform feedback, and must match
+ * update_particles() in particle.cpp */
+static const char *particle_update_vert_source =
+R"(
+#version 300 es
+
+/* position.xy, speed.xy */
+in vec4 pos_speed;
+/* gravity.xy, start position.xy */
+in vec4 g_start;
+/* life, fade, base radius, radius */
+in vec4 life;
+in vec4 color;
+
+out vec4 out_pos_speed;
+out vec4 out_g_start;
+out vec4 out_life;
+out vec4 out_color;
+
+const float slowdown = 0.8;
+
+void main()
+{
+    out_pos_speed = pos_speed;
+    out_g_start = g_start;
+    out_life = life;
+    out_color = color;
+
+    if (life.x <= 0.0)
+        return;
+
+    out_pos_speed.xy += pos_speed.zw * 0.2 * slowdown;
+    out_pos_speed.zw += g_start.xy * 0.3 * slowdown;
+
+    /* Alpha is proportional to the remaining life */
+    out_life.x = life.x - life.y * 0.3 * slowdown;
+    out_color.a = color.a / life.x * out_life.x;
+
+    out_life.w = life.z * sqrt(max(out_life.x, 0.0));
+    out_g_start.x = (g_start.z < out_pos_speed.x) ? -1.0 : 1.0;
+
+    /* move outside */
+    if (out_life.x <= 0.0)
+        out_pos_speed.xy = vec2(-10000.0);
+}
+)";
+
+/* Nothing is rasterized during the update */
+static const char *particle_update_frag_source =
+R"(
+#version 300 es
+
+out mediump vec4 frag_color;
+
+void main()
+{
+    frag_color = vec4(0.0);
+}
+)";
+
 #endif /* end of include guard: PARTICLE_ANIMATION_SHADER */
@@ -76,9 +76,9 @@ wf_blur_base::~wf_blur_base()
     OpenGL::render_begin();
     fb[0].release();
     fb[1].release();
-    GL_CALL(glDeleteProgram(program[0]));
-    GL_CALL(glDeleteProgram(program[1]));
-    GL_CALL(glDeleteProgram(blend_program));
+    OpenGL::destroy_program(program[0]);
+    OpenGL::destroy_program(program[1]);
+    OpenGL::destroy_program(blend_program);
     OpenGL::render_end();
 }
 
@@ -68,7 +68,7 @@ class wayfire_cube : public wayfire_plugin_t
         else if (last_background_mode == "skydome")
             background = std::make_unique<wf_cube_background_skydome> (output);
         else if (last_background_mode == "cubemap")
-            background = std::make_unique<wf_cube_background_cubemap> ();
+            background = std::make_unique<wf_cube_background_cubemap> (output);
         else
         {
             log_error("cube: Unrecognized background mode %s. Using default \"simple\"",
@@ -169,7 +169,6 @@ class wayfire_cube : public wayfire_plugin_t
         std::string ext_string(reinterpret_cast<const char*> (glGetString(GL_EXTENSIONS)));
         tessellation_support =
             ext_string.find(std::string("GL_EXT_tessellation_shader")) != std::string::npos;
-        GLuint tcs = -1, tes = -1, gss = -1;
 #else
         tessellation_support = false;
 #endif
@@ -181,42 +180,22 @@ class wayfire_cube : public wayfire_plugin_t
             shaderSrcPath = INSTALL_PREFIX "/share/wayfire/cube/shaders_2.0";
         }
 
-        program.id = GL_CALL(glCreateProgram());
-        GLuint vss, fss;
-
-        /* Vertex and fragment shaders are used in both GLES 2.0 and 3.2 modes */
-        vss = OpenGL::load_shader(shaderSrcPath + "/vertex.glsl", GL_VERTEX_SHADER);
-        fss = OpenGL::load_shader(shaderSrcPath + "/frag.glsl", GL_FRAGMENT_SHADER);
-        GL_CALL(glAttachShader(program.id, vss));
-        GL_CALL(glAttachShader(program.id, fss));
-
-        if (tessellation_support)
-        {
+        /* Vertex and fragment shaders are used in both GLES 2.0 and 3.2 modes,
+         * the 3.2 mode adds tessellation and geometry shaders */
+        std::vector<OpenGL::shader_stage_t> extra_stages;
 #ifdef USE_GLES32
-            tcs = OpenGL::load_shader(shaderSrcPath + "/tcs.glsl", GL_TESS_CONTROL_SHADER);
-            tes = OpenGL::load_shader(shaderSrcPath + "/tes.glsl", GL_TESS_EVALUATION_SHADER);
-            gss = OpenGL::load_shader(shaderSrcPath + "/geom.glsl", GL_GEOMETRY_SHADER);
-
-            GL_CALL(glAttachShader(program.id, tcs));
-            GL_CALL(glAttachShader(program.id, tes));
-            GL_CALL(glAttachShader(program.id, gss));
-#endif
-        }
-
-        GL_CALL(glLinkProgram(program.id));
-        GL_CALL(glUseProgram(program.id));
-
-        GL_CALL(glDeleteShader(vss));
-        GL_CALL(glDeleteShader(fss));
-
         if (tessellation_support)
         {
-#ifdef USE_GLES32
-            GL_CALL(glDeleteShader(tcs));
-            GL_CALL(glDeleteShader(tes));
-            GL_CALL(glDeleteShader(gss));
-#endif
+            extra_stages = {
+                {GL_TESS_CONTROL_SHADER, shaderSrcPath + "/tcs.glsl"},
+                {GL_TESS_EVALUATION_SHADER, shaderSrcPath + "/tes.glsl"},
+                {GL_GEOMETRY_SHADER, shaderSrcPath + "/geom.glsl"},
+            };
         }
+#endif
+
+        program.id = OpenGL::create_program(shaderSrcPath + "/vertex.glsl",
+            shaderSrcPath + "/frag.glsl", extra_stages);
 
         program.vpID = GL_CALL(glGetUniformLocation(program.id, "VP"));
         program.uvID = GL_CALL(glGetAttribLocation(program.id, "uvPosition"));
@@ -585,6 +564,7 @@ class wayfire_cube : public wayfire_plugin_t
         OpenGL::render_begin();
         for (size_t i = 0; i < streams.size(); i++)
             streams[i]->buffer.release();
+        OpenGL::destroy_program(program.id);
         OpenGL::render_end();
 
         output->rem_binding(&activate_binding);
@@ -6,9 +6,12 @@
 #include <config.h>
 #include <core.hpp>
 #include <img.hpp>
+#include <output.hpp>
+#include <render-manager.hpp>
 
-wf_cube_background_cubemap::wf_cube_background_cubemap()
+wf_cube_background_cubemap::wf_cube_background_cubemap(wayfire_output *output)
 {
+    this->output = output;
     create_program();
 
     background_image = (*core->config)["cube"]->get_option("cubemap_image", "");
@@ -17,8 +20,10 @@ wf_cube_background_cubemap::wf_cube_background_cubemap()
 
 wf_cube_background_cubemap::~wf_cube_background_cubemap()
 {
+    image_io::cancel_load(pending_load);
+
     OpenGL::render_begin();
-    GL_CALL(glDeleteProgram(program));
+    OpenGL::destroy_program(program);
     OpenGL::render_end();
 }
 
@@ -43,37 +48,27 @@ void wf_cube_background_cubemap::reload_texture()
 
     last_background_image = background_image->as_string();
 
-    OpenGL::render_begin();
-    if (tex == (uint32_t)-1)
-    {
-        GL_CALL(glGenTextures(1, &tex));
-    }
-
-    GL_CALL(glBindTexture(GL_TEXTURE_CUBE_MAP, tex));
-    for (int i = 0; i < 6; i++)
-    {
-        if (!image_io::load_from_file(last_background_image, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i))
-        {
-            log_error("Failed to load cubemap background image from \"%s\".",
-                last_background_image.c_str());
-
-            GL_CALL(glDeleteTextures(1, &tex));
-            tex = -1;
-            break;
-        }
-    }
+    /* Decoding a big image takes a while, keep showing the old one until then */
+    image_io::cancel_load(pending_load);
+    pending_load = image_io::load_texture_async(last_background_image,
+        GL_TEXTURE_CUBE_MAP,
+        [=] (std::shared_ptr<const image_io::texture_t> loaded) {
+            pending_load = 0;
+            set_texture(loaded);
+        });
+}
 
-    if (tex != (uint32_t)-1)
+void wf_cube_background_cubemap::set_texture(
+    std::shared_ptr<const image_io::texture_t> loaded)
+{
+    if (!loaded)
     {
-        GL_CALL(glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR));
-        GL_CALL(glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
-        GL_CALL(glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
-        GL_CALL(glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
-        GL_CALL(glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE));
+        log_error("Failed to load cubemap background image from \"%s\".",
+            last_background_image.c_str());
     }
 
-    GL_CALL(glBindTexture(GL_TEXTURE_CUBE_MAP, 0));
-    OpenGL::render_end();
+    texture = loaded;
+    output->render->damage_whole();
 }
 
 #include "cubemap-vertex-data.hpp"
@@ -84,9 +79,17 @@ void wf_cube_background_cubemap::render_frame(const wf_framebuffer& fb,
     reload_texture();
 
     OpenGL::render_begin(fb);
-    if (tex == (uint32_t)-1)
+    if (!texture)
     {
-        GL_CALL(glClearColor(TEX_ERROR_FLAG_COLOR));
+        /* Not an error if the image is still being loaded */
+        if (pending_load)
+        {
+            GL_CALL(glClearColor(0, 0, 0, 1));
+        } else
+        {
+            GL_CALL(glClearColor(TEX_ERROR_FLAG_COLOR));
+        }
+
         GL_CALL(glClear(GL_COLOR_BUFFER_BIT));
         return;
     }
@@ -94,7 +97,7 @@ void wf_cube_background_cubemap::render_frame(const wf_framebuffer& fb,
     GL_CALL(glUseProgram(program));
     GL_CALL(glDepthMask(GL_FALSE));
 
-    GL_CALL(glBindTexture(GL_TEXTURE_CUBE_MAP, tex));
+    GL_CALL(glBindTexture(GL_TEXTURE_CUBE_MAP, texture->tex));
 
     GL_CALL(glEnableVertexAttribArray(posID));
     GL_CALL(glVertexAttribPointer(posID, 3, GL_FLOAT, GL_FALSE, 0, skyboxVertices));
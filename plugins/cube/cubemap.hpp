@@ -2,24 +2,32 @@
 #define WF_CUBE_CUBEMAP_HPP
 
 #include "cube-background.hpp"
+#include <img.hpp>
 
 class wf_cube_background_cubemap : public wf_cube_background_base
 {
     public:
-    wf_cube_background_cubemap();
+    wf_cube_background_cubemap(wayfire_output *output);
     virtual void render_frame(const wf_framebuffer& fb,
         wf_cube_animation_attribs& attribs) override;
 
     ~wf_cube_background_cubemap();
 
     private:
+    wayfire_output *output;
+
     void reload_texture();
+    void set_texture(std::shared_ptr<const image_io::texture_t> loaded);
     void create_program();
 
-    GLuint program = -1, tex = -1;
+    GLuint program = -1;
+    /* Shared with the other outputs which use the same image */
+    std::shared_ptr<const image_io::texture_t> texture;
     GLuint matrixID, posID;
 
     std::string last_background_image;
+    /* The image being loaded in the background, 0 if none */
+    uint32_t pending_load = 0;
     wf_option background_image;
 };
 
@@ -4,6 +4,7 @@
 #include <img.hpp>
 
 #include <output.hpp>
+#include <render-manager.hpp>
 #include <workspace-manager.hpp>
 
 
@@ -24,8 +25,10 @@ wf_cube_background_skydome::wf_cube_background_skydome(wayfire_output *output)
 
 wf_cube_background_skydome::~wf_cube_background_skydome()
 {
+    image_io::cancel_load(pending_load);
+
     OpenGL::render_begin();
-    GL_CALL(glDeleteProgram(program));
+    OpenGL::destroy_program(program);
     OpenGL::render_end();
 }
 
@@ -52,33 +55,27 @@ void wf_cube_background_skydome::reload_texture()
         return;
 
     last_background_image = background_image->as_string();
-    OpenGL::render_begin();
-
-    if (tex == (uint32_t)-1)
-    {
-        GL_CALL(glGenTextures(1, &tex));
-    }
 
-    GL_CALL(glBindTexture(GL_TEXTURE_2D, tex));
+    /* Decoding a big image takes a while, keep showing the old one until then */
+    image_io::cancel_load(pending_load);
+    pending_load = image_io::load_texture_async(last_background_image,
+        GL_TEXTURE_2D, [=] (std::shared_ptr<const image_io::texture_t> loaded) {
+            pending_load = 0;
+            set_texture(loaded);
+        });
+}
 
-    if (image_io::load_from_file(last_background_image, GL_TEXTURE_2D))
-    {
-        GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
-        GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR));
-        GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
-        GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
-    }
-    else
+void wf_cube_background_skydome::set_texture(
+    std::shared_ptr<const image_io::texture_t> loaded)
+{
+    if (!loaded)
     {
         log_error("Failed to load skydome image from \"%s\".",
             last_background_image.c_str());
-        GL_CALL(glDeleteTextures(1, &tex));
-        tex = -1;
     }
 
-    GL_CALL(glBindTexture(GL_TEXTURE_2D, 0));
-
-    OpenGL::render_end();
+    texture = loaded;
+    output->render->damage_whole();
 }
 
 void wf_cube_background_skydome::fill_vertices()
@@ -141,9 +138,17 @@ void wf_cube_background_skydome::render_frame(const wf_framebuffer& fb,
     fill_vertices();
     reload_texture();
 
-    if (tex == (uint32_t)-1)
+    if (!texture)
     {
-        GL_CALL(glClearColor(TEX_ERROR_FLAG_COLOR));
+        /* Not an error if the image is still being loaded */
+        if (pending_load)
+        {
+            GL_CALL(glClearColor(0, 0, 0, 1));
+        } else
+        {
+            GL_CALL(glClearColor(TEX_ERROR_FLAG_COLOR));
+        }
+
         GL_CALL(glClear(GL_COLOR_BUFFER_BIT));
         return;
     }
@@ -180,7 +185,7 @@ void wf_cube_background_skydome::render_frame(const wf_framebuffer& fb,
     GL_CALL(glUniformMatrix4fv(modelID, 1, GL_FALSE, &model[0][0]));
 
     GL_CALL(glActiveTexture(GL_TEXTURE0));
-    GL_CALL(glBindTexture(GL_TEXTURE_2D, tex));
+    GL_CALL(glBindTexture(GL_TEXTURE_2D, texture->tex));
 
     GL_CALL(glDrawElements(GL_TRIANGLES,
             6 * SKYDOME_GRID_WIDTH * (SKYDOME_GRID_HEIGHT - 2),
@@ -2,6 +2,7 @@
 #define WF_CUBE_BACKGROUND_SKYDOME
 
 #include "cube-background.hpp"
+#include <img.hpp>
 #include <vector>
 
 class wf_cube_background_skydome : public wf_cube_background_base
@@ -19,8 +20,11 @@ class wf_cube_background_skydome : public wf_cube_background_base
     void load_program();
     void fill_vertices();
     void reload_texture();
+    void set_texture(std::shared_ptr<const image_io::texture_t> loaded);
 
-    GLuint program = -1, tex = -1;
+    GLuint program = -1;
+    /* Shared with the other outputs which use the same image */
+    std::shared_ptr<const image_io::texture_t> texture;
     GLuint posID, uvID, modelID, vpID;
 
     std::vector<GLfloat> vertices;
@@ -28,6 +32,8 @@ class wf_cube_background_skydome : public wf_cube_background_base
     std::vector<GLuint> indices;
 
     std::string last_background_image;
+    /* The image being loaded in the background, 0 if none */
+    uint32_t pending_load = 0;
     int last_mirror = -1;
 
     wf_option background_image, mirror_opt;
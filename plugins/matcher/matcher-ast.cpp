@@ -61,28 +61,37 @@ namespace wf
 
         namespace matchers
         {
-            using func_t = std::function<bool(string, string)>;
-            func_t exact = [] (string text, string pattern)
+            /* Checks whether the given text matches */
+            using func_t = std::function<bool(const string&)>;
+            /* Creates a matcher for the given pattern. The pattern is
+             * processed only once, when the expression is parsed */
+            using factory_t = std::function<func_t(string)>;
+
+            factory_t exact = [] (string pattern) -> func_t
             {
                 if (pattern == "any")
-                    return true;
+                    return [] (const string&) { return true; };
 
-                bool result = false;
                 try {
-                    result = std::regex_match(text, std::regex(pattern));
+                    auto regex = std::make_shared<std::regex> (pattern);
+                    return [regex] (const string& text) {
+                        return std::regex_match(text, *regex);
+                    };
                 } catch (const std::exception& e) {
                     log_error ("Invalid regular expression: %s", pattern.c_str());
                 }
 
-                return result;
+                return [] (const string&) { return false; };
             };
 
-            func_t contains = [] (string text, string pattern)
+            factory_t contains = [] (string pattern) -> func_t
             {
-                return text.find(pattern) != text.npos;
+                return [pattern] (const string& text) {
+                    return text.find(pattern) != text.npos;
+                };
             };
 
-            std::map<string, func_t> matchers = {
+            std::map<string, factory_t> matchers = {
                 {"is", exact},
                 {"contains", contains},
             };
@@ -109,7 +118,6 @@ namespace wf
         {
             match_field field;
             matchers::func_t matcher;
-            string matcher_arg;
 
             single_expression_t(string expr)
             {
@@ -126,29 +134,24 @@ namespace wf
                     throw std::invalid_argument("Invalid match mode: " + tokens[1]);
 
                 this->field = match_fields[tokens[0]];
-                this->matcher = matchers::matchers[tokens[1]];
-                this->matcher_arg = tokens[2];
+                this->matcher = matchers::matchers[tokens[1]](tokens[2]);
             }
 
             bool evaluate(const view_t& view) override
             {
-                string view_field_data;
                 switch (this->field)
                 {
                     case FIELD_TITLE:
-                        view_field_data = view.title;
-                        break;
+                        return this->matcher(view.title);
                     case FIELD_APP_ID:
-                        view_field_data = view.app_id;
-                        break;
+                        return this->matcher(view.app_id);
                     case FIELD_TYPE:
-                        view_field_data = view.type;
-                        break;
+                        return this->matcher(view.type);
                     case FIELD_FOCUSEABLE:
-                        view_field_data = view.focuseable;
+                        return this->matcher(view.focuseable);
                 }
 
-                return this->matcher(view_field_data, this->matcher_arg);
+                return false;
             }
         };
 
@@ -6,6 +6,8 @@
 #include <core.hpp>
 #include <output.hpp>
 #include <workspace-manager.hpp>
+#include <signal-definitions.hpp>
+#include <unordered_map>
 
 namespace wf
 {
@@ -32,11 +34,73 @@ namespace wf
             return "unknown";
         };
 
+        /* The data of a view which expressions are evaluated against, and
+         * the results of the matchers evaluated since it last changed */
+        class view_match_cache : public wf_custom_data_t
+        {
+            wayfire_view view;
+            bool valid = false;
+            bool focuseable;
+            wf_view_role role;
+
+            signal_callback_t invalidate = [=] (signal_data *data)
+            {
+                valid = false;
+            };
+
+            public:
+            view_t data;
+            /* matcher id -> result */
+            std::unordered_map<uint64_t, bool> results;
+
+            view_match_cache(wayfire_view view)
+            {
+                this->view = view;
+                view->connect_signal("title-changed", &invalidate);
+                view->connect_signal("app-id-changed", &invalidate);
+                view->connect_signal("layer-changed", &invalidate);
+                view->connect_signal("set-output", &invalidate);
+            }
+
+            ~view_match_cache()
+            {
+                view->disconnect_signal("title-changed", &invalidate);
+                view->disconnect_signal("app-id-changed", &invalidate);
+                view->disconnect_signal("layer-changed", &invalidate);
+                view->disconnect_signal("set-output", &invalidate);
+            }
+
+            /* Refresh the view data if it has changed */
+            void update()
+            {
+                /* There are no signals for these, but they are cheap to check */
+                if (valid && focuseable == view->is_focuseable() &&
+                    role == view->role)
+                {
+                    return;
+                }
+
+                focuseable = view->is_focuseable();
+                role = view->role;
+
+                data.title = view->get_title();
+                data.app_id = view->get_app_id();
+                data.type = get_view_type(view);
+                data.focuseable = focuseable ?  "true" : "false";
+
+                results.clear();
+                valid = true;
+            }
+        };
+
         class default_view_matcher : public view_matcher
         {
             std::unique_ptr<expression_t> expr;
             wf_option match_option;
 
+            /* Identifies the current expression in the views' caches */
+            uint64_t id;
+
             wf_option_callback on_match_string_updated = [=] ()
             {
                 auto result = parse_expression(match_option->as_string());
@@ -47,6 +111,9 @@ namespace wf
                 }
 
                 this->expr = std::move(result.first);
+
+                static uint64_t last_id = 0;
+                this->id = ++last_id;
             };
 
             public:
@@ -67,13 +134,19 @@ namespace wf
                 if (!expr || !view->is_mapped())
                     return false;
 
-                view_t data;
-                data.title = view->get_title();
-                data.app_id = view->get_app_id();
-                data.type = get_view_type(view);
-                data.focuseable = view->is_focuseable() ?  "true" : "false";
+                if (!view->has_data<view_match_cache>())
+                    view->store_data(std::make_unique<view_match_cache> (view));
+
+                auto cache = view->get_data<view_match_cache>();
+                cache->update();
+
+                auto it = cache->results.find(id);
+                if (it != cache->results.end())
+                    return it->second;
 
-                return expr->evaluate(data);
+                bool result = expr->evaluate(cache->data);
+                cache->results[id] = result;
+                return result;
             }
         };
 
@@ -229,7 +229,7 @@ class wayfire_fisheye : public wayfire_plugin_t
                 finalize();
 
             OpenGL::render_begin();
-            GL_CALL(glDeleteProgram(program));
+            OpenGL::destroy_program(program);
             OpenGL::render_end();
 
             output->rem_binding(&toggle_cb);
@@ -132,7 +132,7 @@ class wayfire_invert_screen : public wayfire_plugin_t
             output->render->rem_post(&hook);
 
         OpenGL::render_begin();
-        GL_CALL(glDeleteProgram(program));
+        OpenGL::destroy_program(program);
         OpenGL::render_end();
 
         output->rem_binding(&toggle_cb);
@@ -6,8 +6,12 @@
 #include <render-manager.hpp>
 #include <signal-definitions.hpp>
 #include <opengl.hpp>
-#include <list>
 #include <algorithm>
+#include <map>
+#include <tuple>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
 
 struct wf_default_workspace_implementation : public wf_workspace_implementation
 {
@@ -16,18 +20,232 @@ struct wf_default_workspace_implementation : public wf_workspace_implementation
     virtual ~wf_default_workspace_implementation() {}
 };
 
-using wf_layer_container = std::list<wayfire_view>;
+/* Views in a layer, the topmost view comes first */
+using wf_layer_container = std::vector<wayfire_view>;
+
+/* A uniform grid over the bounding boxes of the views, used to find the views
+ * under a given point without visiting every view.
+ *
+ * Every change of a view's bounding box is accompanied by damage, so views are
+ * marked as dirty when they are damaged or their transformers change, and are
+ * re-indexed lazily on the next query */
+class view_grid_index_t
+{
+    static constexpr int cell_size = 256;
+    /* Views covering more cells than this are kept in a separate list, which
+     * is checked on every query */
+    static constexpr int max_cells_per_view = 1024;
+
+    struct entry_t
+    {
+        wf_geometry box = {0, 0, 0, 0};
+        wf_geometry wm_geometry = {0, 0, 0, 0};
+        bool oversized = false;
+        /* Whether the view had transformers, which changes its visibility */
+        bool transformed = false;
+        signal_callback_t on_damage, on_transformer_changed;
+    };
+
+    /* Incremented whenever the geometry or the transformers of an indexed
+     * view change */
+    uint64_t geometry_generation = 0;
+
+    std::unordered_map<wayfire_view_t*, entry_t> entries;
+    std::unordered_map<uint64_t, std::vector<wayfire_view_t*>> cells;
+    std::unordered_set<wayfire_view_t*> oversized, dirty;
+
+    static int cell_coordinate(int x)
+    {
+        return x >= 0 ? x / cell_size : (x - cell_size + 1) / cell_size;
+    }
+
+    static uint64_t cell_key(int cx, int cy)
+    {
+        return (uint64_t(uint32_t(cx)) << 32) | uint32_t(cy);
+    }
+
+    template<class Func> void for_each_cell(const wf_geometry& box, Func func)
+    {
+        int x1 = cell_coordinate(box.x), x2 = cell_coordinate(box.x + box.width - 1);
+        int y1 = cell_coordinate(box.y), y2 = cell_coordinate(box.y + box.height - 1);
+
+        for (int i = x1; i <= x2; i++)
+        {
+            for (int j = y1; j <= y2; j++)
+                func(cell_key(i, j));
+        }
+    }
+
+    static bool is_oversized(const wf_geometry& box)
+    {
+        int64_t w = box.width / cell_size + 2, h = box.height / cell_size + 2;
+        return w * h > max_cells_per_view;
+    }
+
+    void unlink(wayfire_view_t *view, entry_t& entry)
+    {
+        if (entry.oversized)
+        {
+            oversized.erase(view);
+        }
+        else if (entry.box.width > 0 && entry.box.height > 0)
+        {
+            for_each_cell(entry.box, [&] (uint64_t key)
+            {
+                auto& cell = cells[key];
+                cell.erase(std::remove(cell.begin(), cell.end(), view), cell.end());
+                if (cell.empty())
+                    cells.erase(key);
+            });
+        }
+
+        entry.box = {0, 0, 0, 0};
+        entry.oversized = false;
+    }
+
+    void link(wayfire_view_t *view, entry_t& entry, const wf_geometry& box)
+    {
+        entry.box = box;
+        if (entry.box.width <= 0 || entry.box.height <= 0)
+            return;
+
+        entry.oversized = is_oversized(entry.box);
+        if (entry.oversized)
+        {
+            oversized.insert(view);
+        } else
+        {
+            for_each_cell(entry.box, [&] (uint64_t key)
+                { cells[key].push_back(view); });
+        }
+    }
+
+    void update_dirty()
+    {
+        for (auto view : dirty)
+        {
+            auto& entry = entries[view];
+            auto old_wm_geometry = entry.wm_geometry;
+            bool old_transformed = entry.transformed;
+            bool moved = false;
+
+            /* Most damage comes from surface commits which don't change the
+             * bounding box, in which case the cells stay the same */
+            auto box = view->get_bounding_box();
+            if (box != entry.box)
+            {
+                unlink(view, entry);
+                link(view, entry, box);
+                moved = true;
+            }
+
+            entry.wm_geometry = view->get_wm_geometry();
+            entry.transformed = view->has_transformer();
+            if (moved || entry.wm_geometry != old_wm_geometry ||
+                entry.transformed != old_transformed)
+            {
+                ++geometry_generation;
+            }
+        }
+
+        dirty.clear();
+    }
+
+    public:
+    void add(wayfire_view view)
+    {
+        auto raw = view.get();
+        if (entries.count(raw))
+            return;
+
+        auto& entry = entries[raw];
+        entry.on_damage = [=] (signal_data*) { dirty.insert(raw); };
+        entry.on_transformer_changed = entry.on_damage;
+        view->connect_signal("damaged-region", &entry.on_damage);
+        view->connect_signal("transformer-changed", &entry.on_transformer_changed);
+        dirty.insert(raw);
+    }
+
+    void remove(wayfire_view view)
+    {
+        auto raw = view.get();
+        auto it = entries.find(raw);
+        if (it == entries.end())
+            return;
+
+        view->disconnect_signal("damaged-region", &it->second.on_damage);
+        view->disconnect_signal("transformer-changed",
+            &it->second.on_transformer_changed);
+        unlink(raw, it->second);
+        dirty.erase(raw);
+        entries.erase(it);
+        ++geometry_generation;
+    }
+
+    /* Returns a counter which changes whenever the bounding box, the WM
+     * geometry or the transformers of an indexed view change */
+    uint64_t get_geometry_generation()
+    {
+        update_dirty();
+        return geometry_generation;
+    }
+
+    /* Returns the indexed views whose bounding box contains the point,
+     * in no particular order */
+    std::vector<wayfire_view_t*> query(wf_point point)
+    {
+        update_dirty();
+
+        std::vector<wayfire_view_t*> result;
+        auto it = cells.find(cell_key(cell_coordinate(point.x),
+                cell_coordinate(point.y)));
+
+        if (it != cells.end())
+        {
+            for (auto view : it->second)
+            {
+                if (entries[view].box & point)
+                    result.push_back(view);
+            }
+        }
+
+        for (auto view : oversized)
+        {
+            if (entries[view].box & point)
+                result.push_back(view);
+        }
+
+        return result;
+    }
+
+    ~view_grid_index_t()
+    {
+        for (auto& entry : entries)
+        {
+            entry.first->disconnect_signal("damaged-region", &entry.second.on_damage);
+            entry.first->disconnect_signal("transformer-changed",
+                &entry.second.on_transformer_changed);
+        }
+    }
+};
 
 class viewport_manager : public workspace_manager
 {
     struct custom_viewport_layer_data_t : public wf_custom_data_t
     {
         uint32_t layer = 0;
+        /* Position in the stacking order, higher is above */
+        uint64_t stacking_index = 0;
     };
 
+    nonstd::observer_ptr<custom_viewport_layer_data_t> _get_layer_data(wayfire_view view)
+    {
+        return view->get_data_safe<custom_viewport_layer_data_t>();
+    }
+
     uint32_t& _get_view_layer(wayfire_view view)
     {
-        return view->get_data_safe<custom_viewport_layer_data_t>()->layer;
+        return _get_layer_data(view)->layer;
     }
 
     private:
@@ -37,6 +255,34 @@ class viewport_manager : public workspace_manager
 
         wf_layer_container layers[WF_TOTAL_LAYERS];
 
+        view_grid_index_t view_index;
+        uint64_t next_stacking_index = 0;
+
+        /* Incremented whenever a layer or the output geometry changes.
+         *
+         * View lists returned by the queries below are cached until either
+         * the layers or the geometry of a view changes. Callers of for_each_view
+         * hold a reference to the list they iterate over, so it stays valid
+         * even if the callback changes the layers */
+        uint64_t layers_generation = 0;
+        using view_list_t = std::shared_ptr<const std::vector<wayfire_view>>;
+
+        struct cached_layer_views_t
+        {
+            uint64_t layers_generation = -1;
+            view_list_t views;
+        };
+        std::unordered_map<uint32_t, cached_layer_views_t> cached_layer_views;
+        view_list_t get_views_in_layers(uint32_t layers_mask);
+
+        struct cached_workspace_views_t
+        {
+            uint64_t layers_generation = -1, geometry_generation = -1;
+            view_list_t views;
+        };
+        std::map<std::tuple<int, int, uint32_t, bool>, cached_workspace_views_t>
+            cached_workspace_views;
+
         inline int layer_index_from_mask(uint32_t layer_mask) const
         { return __builtin_ctz(layer_mask); }
 
@@ -62,11 +308,16 @@ class viewport_manager : public workspace_manager
 
         std::vector<wayfire_view>
             get_views_on_workspace(std::tuple<int, int> ws, uint32_t layer_mask, bool wm_only);
+        view_list_t get_views_on_workspace_shared(std::tuple<int, int> ws,
+            uint32_t layer_mask, bool wm_only);
         void for_each_view(view_callback_proc_t call, uint32_t layers_mask);
         void for_each_view_reverse(view_callback_proc_t call, uint32_t layers_mask);
 
+        std::vector<wayfire_view> get_views_at(wf_point point, uint32_t layers_mask);
+
         /* Directly move the view to the given layer */
         void _add_view_to_layer(wayfire_view view, uint32_t layer);
+        void emit_layer_changed(wayfire_view view);
 
         /* The difference to the previous function is that this one will adjust
          * the fullscreen layer if necessary */
@@ -134,6 +385,7 @@ void viewport_manager::init(wayfire_output *o)
 
     output_geometry_changed = [=] (signal_data *data)
     {
+        ++layers_generation;
         update_output_geometry();
         reflow_reserved_areas();
     };
@@ -168,14 +420,20 @@ void viewport_manager::_add_view_to_layer(wayfire_view view, uint32_t layer)
     view->damage();
 
     auto& current_layer = _get_view_layer(view);
+    ++layers_generation;
 
     /* Just remove from layer */
     if (layer == 0)
     {
+        bool layer_changed = (current_layer != 0);
         if (current_layer)
             remove_from_layer(view, layer_index_from_mask(current_layer));
 
         current_layer = 0;
+        view_index.remove(view);
+
+        if (layer_changed)
+            emit_layer_changed(view);
         return;
     }
 
@@ -192,10 +450,25 @@ void viewport_manager::_add_view_to_layer(wayfire_view view, uint32_t layer)
     if (current_layer)
         remove_from_layer(view, layer_index_from_mask(current_layer));
 
+    bool layer_changed = (current_layer != layer);
+
     auto& layer_container = layers[layer_index_from_mask(layer)];
-    layer_container.push_front(view);
+    layer_container.insert(layer_container.begin(), view);
     current_layer = layer;
+    _get_layer_data(view)->stacking_index = ++next_stacking_index;
+    view_index.add(view);
     view->damage();
+
+    if (layer_changed)
+        emit_layer_changed(view);
+}
+
+void viewport_manager::emit_layer_changed(wayfire_view view)
+{
+    layer_changed_signal data;
+    data.view = view;
+    output->emit_signal("view-layer-changed", &data);
+    view->emit_signal("layer-changed", &data);
 }
 
 void viewport_manager::add_view_to_layer(wayfire_view view, uint32_t layer)
@@ -267,35 +540,64 @@ bool viewport_manager::view_visible_on(wayfire_view view, std::tuple<int, int> v
         return g & view->get_wm_geometry();
 }
 
-void viewport_manager::for_each_view(view_callback_proc_t call, uint32_t layers_mask)
+viewport_manager::view_list_t
+viewport_manager::get_views_in_layers(uint32_t layers_mask)
 {
-    std::vector<wayfire_view> views;
+    auto& cached = cached_layer_views[layers_mask];
+    if (cached.layers_generation == layers_generation)
+        return cached.views;
 
+    auto views = std::make_shared<std::vector<wayfire_view>>();
     for (int i = WF_TOTAL_LAYERS - 1; i >= 0; i--)
     {
         if ((1 << i) & layers_mask)
-            for (auto v : layers[i])
-                views.push_back(v);
+            views->insert(views->end(), layers[i].begin(), layers[i].end());
     }
 
-    for (auto v : views)
+    cached.layers_generation = layers_generation;
+    cached.views = std::move(views);
+    return cached.views;
+}
+
+void viewport_manager::for_each_view(view_callback_proc_t call, uint32_t layers_mask)
+{
+    auto views = get_views_in_layers(layers_mask);
+    for (auto& v : *views)
         call(v);
 }
 
 void viewport_manager::for_each_view_reverse(view_callback_proc_t call, uint32_t layers_mask)
 {
-    std::vector<wayfire_view> views;
+    auto views = get_views_in_layers(layers_mask);
 
-    for (int i = WF_TOTAL_LAYERS - 1; i >= 0; i--)
+    auto it = views->rbegin();
+    while(it != views->rend())
+        call(*it++);
+}
+
+std::vector<wayfire_view> viewport_manager::get_views_at(wf_point point,
+    uint32_t layers_mask)
+{
+    std::vector<std::pair<uint64_t, wayfire_view>> candidates;
+    for (auto view : view_index.query(point))
     {
-        if ((1 << i) & layers_mask)
-            for (auto v : layers[i])
-                views.push_back(v);
+        auto data = _get_layer_data(wayfire_view(view));
+        if (data->layer & layers_mask)
+        {
+            /* Higher layers have higher masks, so this sorts by layer first */
+            uint64_t key = (uint64_t(data->layer) << 48) | data->stacking_index;
+            candidates.push_back({key, wayfire_view(view)});
+        }
     }
 
-    auto it = views.rbegin();
-    while(it != views.rend())
-        call(*it++);
+    std::sort(candidates.begin(), candidates.end(),
+        [] (const auto& a, const auto& b) { return a.first > b.first; });
+
+    std::vector<wayfire_view> views;
+    for (auto& c : candidates)
+        views.push_back(c.second);
+
+    return views;
 }
 
 wf_workspace_implementation* viewport_manager::get_implementation(std::tuple<int, int> vt)
@@ -337,9 +639,10 @@ void viewport_manager::set_workspace(std::tuple<int, int> nPos)
 
     if (nx == vx && ny == vy)
     {
-        auto views = get_views_on_workspace(std::make_tuple(vx, vy), WF_MIDDLE_LAYERS, true);
-        if (views.size() >= 1)
-            output->focus_view(views[0]);
+        auto views = get_views_on_workspace_shared(std::make_tuple(vx, vy),
+            WF_MIDDLE_LAYERS, true);
+        if (views->size() >= 1)
+            output->focus_view((*views)[0]);
         return;
     }
 
@@ -359,14 +662,16 @@ void viewport_manager::set_workspace(std::tuple<int, int> nPos)
 
     vx = nx;
     vy = ny;
+    ++layers_generation;
     output->emit_signal("viewport-changed", &data);
 
     output->focus_view(nullptr);
     /* we iterate through views on current viewport from bottom to top
      * that way we ensure that they will be focused befor all others */
-    auto views = get_views_on_workspace(std::make_tuple(vx, vy), WF_MIDDLE_LAYERS, true);
-    auto it = views.rbegin();
-    while(it != views.rend()) {
+    auto views = get_views_on_workspace_shared(std::make_tuple(vx, vy),
+        WF_MIDDLE_LAYERS, true);
+    auto it = views->rbegin();
+    while(it != views->rend()) {
         if ((*it)->is_mapped() && !(*it)->destroyed)
             output->focus_view(*it);
         ++it;
@@ -379,29 +684,44 @@ std::vector<wayfire_view>
 viewport_manager::get_views_on_workspace(std::tuple<int, int> vp,
                                          uint32_t layers_mask, bool wm_only)
 {
+    return *get_views_on_workspace_shared(vp, layers_mask, wm_only);
+}
 
-    std::vector<wayfire_view> views;
+viewport_manager::view_list_t
+viewport_manager::get_views_on_workspace_shared(std::tuple<int, int> vp,
+                                                uint32_t layers_mask, bool wm_only)
+{
+    GetTuple(tx, ty, vp);
+    auto& cached = cached_workspace_views[
+        std::make_tuple(tx, ty, layers_mask, wm_only)];
 
-    for (int i = WF_TOTAL_LAYERS - 1; i >= 0; i--)
+    auto geometry_generation = view_index.get_geometry_generation();
+    if (cached.layers_generation == layers_generation &&
+        cached.geometry_generation == geometry_generation)
     {
-        if ((1 << i) & layers_mask)
+        return cached.views;
+    }
+
+    /* Build a new list, the old one may still be held by someone */
+    auto views = std::make_shared<std::vector<wayfire_view>>();
+    for (auto& v : *get_views_in_layers(layers_mask))
+    {
+        if (wm_only &&
+            (output->get_relative_geometry() & v->get_wm_geometry()))
         {
-            for (auto v : layers[i])
-            {
-                if (wm_only &&
-                    (output->get_relative_geometry() & v->get_wm_geometry()))
-                {
-                    views.push_back(v);
-                }
-                else if (!wm_only && view_visible_on(v, vp))
-                {
-                    views.push_back(v);
-                }
-            }
+            views->push_back(v);
+        }
+        else if (!wm_only && view_visible_on(v, vp))
+        {
+            views->push_back(v);
         }
     }
 
-    return views;
+    cached.layers_generation = layers_generation;
+    cached.geometry_generation = geometry_generation;
+    cached.views = std::move(views);
+
+    return cached.views;
 }
 
 wf_geometry viewport_manager::get_workarea()
@@ -4,6 +4,9 @@
 #include <cstdio>
 #include <signal-definitions.hpp>
 #include <assert.h>
+#include <algorithm>
+#include <queue>
+#include <unordered_map>
 
 using std::string;
 
@@ -49,48 +52,127 @@ static bool ends_with(string x, string y)
 }
 
 
-class wayfire_window_rules : public wayfire_plugin_t
+/* Finds which of a set of patterns occur in a text, with a single pass over
+ * the text (Aho-Corasick) */
+class substring_matcher
 {
+    struct node
+    {
+        std::map<char, int> next;
+        int fail = 0;
+        /* The ids of the patterns which end here */
+        std::vector<int> ids;
+    };
+
+    std::vector<node> nodes = std::vector<node>(1);
+
+    public:
+    void add(const string& pattern, int id)
+    {
+        int current = 0;
+        for (char c : pattern)
+        {
+            auto it = nodes[current].next.find(c);
+            if (it == nodes[current].next.end())
+            {
+                nodes[current].next[c] = nodes.size();
+                current = nodes.size();
+                nodes.emplace_back();
+            } else
+            {
+                current = it->second;
+            }
+        }
+
+        nodes[current].ids.push_back(id);
+    }
+
+    /* Must be called after all patterns have been added */
+    void build()
+    {
+        std::queue<int> queue;
+        for (auto& child : nodes[0].next)
+            queue.push(child.second);
+
+        while (!queue.empty())
+        {
+            int current = queue.front();
+            queue.pop();
 
+            for (auto& child : nodes[current].next)
+            {
+                int fail = nodes[current].fail;
+                while (fail && !nodes[fail].next.count(child.first))
+                    fail = nodes[fail].fail;
+
+                auto it = nodes[fail].next.find(child.first);
+                if (it != nodes[fail].next.end() && it->second != child.second)
+                    fail = it->second;
+
+                nodes[child.second].fail = fail;
+
+                /* Patterns which end in the fail node end here too. The
+                 * empty pattern is handled separately in find_all() */
+                if (fail)
+                {
+                    auto& ids = nodes[child.second].ids;
+                    ids.insert(ids.end(), nodes[fail].ids.begin(),
+                        nodes[fail].ids.end());
+                }
+
+                queue.push(child.second);
+            }
+        }
+    }
+
+    /* Append the ids of all patterns found in text to result.
+     * The same id may be appended several times */
+    void find_all(const string& text, std::vector<int>& result) const
+    {
+        result.insert(result.end(), nodes[0].ids.begin(), nodes[0].ids.end());
+
+        int current = 0;
+        for (char c : text)
+        {
+            auto it = nodes[current].next.find(c);
+            while (current && it == nodes[current].next.end())
+            {
+                current = nodes[current].fail;
+                it = nodes[current].next.find(c);
+            }
+
+            if (it != nodes[current].next.end())
+                current = it->second;
 
-    using verification_func = std::function<bool(wayfire_view, std::string)>;
+            result.insert(result.end(), nodes[current].ids.begin(),
+                nodes[current].ids.end());
+        }
+    }
+};
+
+class wayfire_window_rules : public wayfire_plugin_t
+{
+    enum rule_match_type
+    {
+        MATCH_TITLE,
+        MATCH_TITLE_CONTAINS,
+        MATCH_APP_ID,
+        MATCH_APP_ID_CONTAINS,
+    };
 
     struct verificator
     {
-        verification_func func;
+        rule_match_type type;
         std::string atom;
     };
 
+    /* "contains" must come first, since the other atoms are its prefixes */
     std::vector<verificator> verficators =
     {
-        {  [] (wayfire_view view, std::string match) -> bool
-            {
-                auto title = view->get_title();
-                return title.find(match) != std::string::npos;
-            },
-            "title contains"
-        },
-        { [] (wayfire_view view, std::string match) -> bool
-            {
-                auto title = view->get_title();
-                return title == match;
-            },
-            "title"
-        },
-        {  [] (wayfire_view view, std::string match) -> bool
-            {
-                auto app_id = view->get_app_id();
-                return app_id.find(match) != std::string::npos;
-            },
-            "app-id contains"
-        },
-        {  [] (wayfire_view view, std::string match) -> bool
-            {
-                auto app_id = view->get_app_id();
-                return app_id == match;
-            },
-            "app-id"
-        },
+        {MATCH_TITLE_CONTAINS, "title contains"},
+        {MATCH_TITLE, "title"},
+        {MATCH_APP_ID_CONTAINS, "app-id contains"},
+        {MATCH_APP_ID, "app-id"},
     };
 
     std::vector<std::string> events = {
@@ -99,18 +181,12 @@ class wayfire_window_rules : public wayfire_plugin_t
 
     using action_func = std::function<void(wayfire_view view)>;
 
-    struct lambda_executor
-    {
-        verification_func verify;
-        std::string verification_string;
-        action_func action;
-    };
-
-    using rule_func = std::function<void(wayfire_view)>;
     struct rule
     {
         std::string signal;
-        std::function<void(wayfire_view)> func;
+        rule_match_type match;
+        std::string pattern;
+        action_func action;
     };
 
     rule parse_add_rule(std::string rule)
@@ -143,23 +219,21 @@ class wayfire_window_rules : public wayfire_plugin_t
             }
         }
 
-        lambda_executor exec;
-        exec.verify = nullptr;
-        exec.action = nullptr;
-
+        bool verified = false;
         for (const auto& pred : verficators)
         {
             if (starts_with(predicate, pred.atom))
             {
-                exec.verify = pred.func;
-                exec.verification_string =
+                verified = true;
+                result.match = pred.type;
+                result.pattern =
                     trim(predicate.substr(pred.atom.length(),
                                           predicate.length() - pred.atom.length()));
                 break;
             }
         }
 
-        if (!exec.verify || !event.length())
+        if (!verified || !event.length())
             return result;
 
         if (starts_with(action, "move"))
@@ -170,7 +244,7 @@ class wayfire_window_rules : public wayfire_plugin_t
             if (t != 2)
                 return result;
 
-            exec.action = [x,y] (wayfire_view view) {
+            result.action = [x,y] (wayfire_view view) {
                 auto og = view->get_output()->get_relative_geometry();
                 view->move(og.x + x, og.y + y);
             };
@@ -182,7 +256,7 @@ class wayfire_window_rules : public wayfire_plugin_t
             if (t != 2 || w <= 0 || h <= 0)
                 return result;
 
-            exec.action = [w,h] (wayfire_view view) mutable {
+            result.action = [w,h] (wayfire_view view) mutable {
                 GetTuple(sw, sh, view->get_output()->get_screen_size());
                 if (w > 100000)
                     w = sw;
@@ -192,7 +266,7 @@ class wayfire_window_rules : public wayfire_plugin_t
             };
         } else if (ends_with(action, "set maximized"))
         {
-            exec.action = [action] (wayfire_view view)
+            result.action = [action] (wayfire_view view)
             {
                 view_maximized_signal data;
                 data.view = view;
@@ -203,7 +277,7 @@ class wayfire_window_rules : public wayfire_plugin_t
 
         else if (ends_with(action, "set fullscreen"))
         {
-            exec.action = [action] (wayfire_view view)
+            result.action = [action] (wayfire_view view)
             {
                 view_fullscreen_signal data;
                 data.view = view;
@@ -212,24 +286,82 @@ class wayfire_window_rules : public wayfire_plugin_t
             };
         }
 
+        if (result.action)
+            result.signal = event;
 
-        if (!exec.action)
-            return result;
+        return result;
+    }
+
+    /* The rules of a single event, indexed by what they match. Rules are
+     * identified by their position in the config */
+    struct rule_index
+    {
+        std::unordered_map<std::string, std::vector<int>> title, app_id;
+        substring_matcher title_contains, app_id_contains;
+    };
+
+    std::vector<action_func> actions;
+    std::map<std::string, rule_index> rules_index;
 
-        result.signal = event;
-        result.func = [exec] (wayfire_view view)
+    void add_rule(const rule& rule)
+    {
+        int id = actions.size();
+        actions.push_back(rule.action);
+
+        auto& index = rules_index[rule.signal];
+        switch (rule.match)
+        {
+            case MATCH_TITLE:
+                index.title[rule.pattern].push_back(id);
+                break;
+            case MATCH_TITLE_CONTAINS:
+                index.title_contains.add(rule.pattern, id);
+                break;
+            case MATCH_APP_ID:
+                index.app_id[rule.pattern].push_back(id);
+                break;
+            case MATCH_APP_ID_CONTAINS:
+                index.app_id_contains.add(rule.pattern, id);
+                break;
+        }
+    }
+
+    /* Run the actions of all rules for the event which match the view,
+     * in the order they are in the config */
+    void apply_rules(std::string event, wayfire_view view)
+    {
+        auto it = rules_index.find(event);
+        if (it == rules_index.end())
+            return;
+
+        auto& index = it->second;
+        auto title = view->get_title();
+        auto app_id = view->get_app_id();
+
+        std::vector<int> matched;
+        auto add_exact = [&matched] (
+            const std::unordered_map<std::string, std::vector<int>>& rules,
+            const std::string& key)
         {
-            if (exec.verify(view, exec.verification_string))
-                exec.action(view);
+            auto it = rules.find(key);
+            if (it != rules.end())
+                matched.insert(matched.end(), it->second.begin(), it->second.end());
         };
 
-        return result;
+        add_exact(index.title, title);
+        add_exact(index.app_id, app_id);
+        index.title_contains.find_all(title, matched);
+        index.app_id_contains.find_all(app_id, matched);
+
+        std::sort(matched.begin(), matched.end());
+        matched.erase(std::unique(matched.begin(), matched.end()), matched.end());
+
+        for (int id : matched)
+            actions[id](view);
     }
 
     signal_callback_t created, maximized, fullscreened;
 
-    std::map<std::string, std::vector<rule_func>> rules_list;
-
     public:
     void init(wayfire_config *config)
     {
@@ -237,13 +369,19 @@ class wayfire_window_rules : public wayfire_plugin_t
         for (auto opt : section->options)
         {
             auto rule = parse_add_rule(opt->as_string());
-            rules_list[rule.signal].push_back(rule.func);
+            if (rule.action)
+                add_rule(rule);
+        }
+
+        for (auto& index : rules_index)
+        {
+            index.second.title_contains.build();
+            index.second.app_id_contains.build();
         }
 
         created = [=] (signal_data *data)
         {
-            for (const auto& rule : rules_list["created"])
-                rule(get_signaled_view(data));
+            apply_rules("created", get_signaled_view(data));
         };
         output->connect_signal("map-view", &created);
 
@@ -255,8 +393,7 @@ class wayfire_window_rules : public wayfire_plugin_t
             if (!conv->state)
                 return;
 
-            for (const auto& rule : rules_list["maximized"])
-                rule(conv->view);
+            apply_rules("maximized", conv->view);
         };
         output->connect_signal("view-maximized", &maximized);
 
@@ -268,8 +405,7 @@ class wayfire_window_rules : public wayfire_plugin_t
             if (!conv->state)
                 return;
 
-            for (const auto& rule : rules_list["fullscreened"])
-                rule(conv->view);
+            apply_rules("fullscreened", conv->view);
         };
         output->connect_signal("view-fullscreen", &fullscreened);
     }
@@ -40,49 +40,42 @@
 #define GRID_WIDTH  4
 #define GRID_HEIGHT 4
 
-#define MODEL_MAX_SPRINGS (GRID_WIDTH * GRID_HEIGHT * 2)
+#define MODEL_OBJECTS (GRID_WIDTH * GRID_HEIGHT)
+
+/* The model is advanced in steps of this length, independently of the
+ * frame rate. Frames in between steps interpolate the last two states. */
+#define MODEL_STEP_MS 15.0f
+
+/* One row of the grid. The solver operates on whole rows, which the
+ * compiler maps to SSE/NEON registers where available. */
+typedef float Row __attribute__ ((vector_size (GRID_WIDTH * sizeof (float))));
 
 typedef struct _xy_pair {
     float x, y;
 } Point, Vector;
 
-typedef struct _Edge {
-    float next, prev;
-
-    float start;
-    float end;
-
-    float attract;
-    float velocity;
-} Edge;
-
-typedef struct _Object {
-    Vector	 force;
-    Point	 position;
-    Vector	 velocity;
-    float	 theta;
-    int		 immobile;
-    Edge	 vertEdge;
-    Edge	 horzEdge;
-} Object;
-
-typedef struct _Spring {
-    Object *a;
-    Object *b;
-    Vector offset;
-} Spring;
-
+/* The objects of the grid are kept in structure-of-arrays layout, row by
+ * row: object i is lane i % GRID_WIDTH of row i / GRID_WIDTH.
+ *
+ * Springs connect each object to its right and bottom neighbours. All
+ * horizontal springs have the same rest length, and so do vertical ones. */
 typedef struct _Model {
-    Object	 *objects;
-    int		 numObjects;
-    Spring	 springs[MODEL_MAX_SPRINGS];
-    int		 numSprings;
-    Object	 *anchorObject;
+    Row		 x[GRID_HEIGHT], y[GRID_HEIGHT];
+    /* positions before the last step */
+    Row		 prevX[GRID_HEIGHT], prevY[GRID_HEIGHT];
+    Row		 velocityX[GRID_HEIGHT], velocityY[GRID_HEIGHT];
+    /* 0 for immobile objects, 1 for the others */
+    Row		 mobile[GRID_HEIGHT];
+    /* index of the anchor object, or -1 */
+    int		 anchorObject;
+    Vector	 springOffset;
     float	 steps;
     Point	 topLeft;
     Point	 bottomRight;
 } Model;
 
+#define OBJ(rows, i) ((rows)[(i) / GRID_WIDTH][(i) % GRID_WIDTH])
+
 typedef struct _WobblyWindow {
     Model        *model;
     int          wobbly;
@@ -95,79 +88,115 @@ typedef struct _WobblyWindow {
 #define WobblyForce    (1L << 1)
 #define WobblyVelocity (1L << 2)
 
-static void
-objectInit (Object *object,
-	    float  positionX,
-	    float  positionY,
-	    float  velocityX,
-	    float  velocityY)
+static Row
+rowSplat (float f)
 {
-    object->force.x = 0;
-    object->force.y = 0;
+    Row r;
+    int i;
 
-    object->position.x = positionX;
-    object->position.y = positionY;
+    for (i = 0; i < GRID_WIDTH; i++)
+	r[i] = f;
 
-    object->velocity.x = velocityX;
-    object->velocity.y = velocityY;
+    return r;
+}
 
-    object->theta    = 0;
-    object->immobile = 0;
+static Row
+rowAbs (Row r)
+{
+    int i;
+    for (i = 0; i < GRID_WIDTH; i++)
+	r[i] = fabsf (r[i]);
 
-    object->vertEdge.next = 0.0f;
-    object->horzEdge.next = 0.0f;
+    return r;
 }
 
+static float
+rowSum (Row r)
+{
+    float sum = 0.0f;
+    int   i;
+
+    for (i = 0; i < GRID_WIDTH; i++)
+	sum += r[i];
+
+    return sum;
+}
+
+/* Lane i of the result is lane i - 1 of r, lane 0 is 0 */
+static Row
+rowShiftRight (Row r)
+{
+    Row result;
+    int i;
+
+    result[0] = 0.0f;
+    for (i = 1; i < GRID_WIDTH; i++)
+	result[i] = r[i - 1];
+
+    return result;
+}
+
+/* Lane i of the result is lane i + 1 of r, the last lane is 0 */
+static Row
+rowShiftLeft (Row r)
+{
+    Row result;
+    int i;
+
+    for (i = 0; i < GRID_WIDTH - 1; i++)
+	result[i] = r[i + 1];
+    result[GRID_WIDTH - 1] = 0.0f;
+
+    return result;
+}
+
+/* Set the position of an object without animating the change */
+static void
+objectSetPosition (Model *model,
+		   int   object,
+		   float x,
+		   float y)
+{
+    OBJ (model->x, object) = OBJ (model->prevX, object) = x;
+    OBJ (model->y, object) = OBJ (model->prevY, object) = y;
+}
+
+/* The positions to display, interpolated between the last two steps */
 static void
-springInit (Spring *spring,
-	    Object *a,
-	    Object *b,
-	    float  offsetX,
-	    float  offsetY)
+modelGetDisplayPositions (Model *model,
+			  Row   *x,
+			  Row   *y)
 {
-    spring->a	     = a;
-    spring->b	     = b;
-    spring->offset.x = offsetX;
-    spring->offset.y = offsetY;
+    int r;
+
+    for (r = 0; r < GRID_HEIGHT; r++)
+    {
+	x[r] = model->prevX[r] + (model->x[r] - model->prevX[r]) * model->steps;
+	y[r] = model->prevY[r] + (model->y[r] - model->prevY[r]) * model->steps;
+    }
 }
 
 static void
 modelCalcBounds (Model *model)
 {
+    Row x[GRID_HEIGHT], y[GRID_HEIGHT];
     int i;
 
+    modelGetDisplayPositions (model, x, y);
+
     model->topLeft.x	 = SHRT_MAX;
     model->topLeft.y	 = SHRT_MAX;
     model->bottomRight.x = SHRT_MIN;
     model->bottomRight.y = SHRT_MIN;
 
-    for (i = 0; i < model->numObjects; i++)
+    for (i = 0; i < MODEL_OBJECTS; i++)
     {
-	if (model->objects[i].position.x < model->topLeft.x)
-	    model->topLeft.x = model->objects[i].position.x;
-	else if (model->objects[i].position.x > model->bottomRight.x)
-	    model->bottomRight.x = model->objects[i].position.x;
-
-	if (model->objects[i].position.y < model->topLeft.y)
-	    model->topLeft.y = model->objects[i].position.y;
-	else if (model->objects[i].position.y > model->bottomRight.y)
-	    model->bottomRight.y = model->objects[i].position.y;
-    }
-}
-
-static void
-modelAddSpring (Model  *model,
-		Object *a,
-		Object *b,
-		float  offsetX,
-		float  offsetY)
-{
-    Spring *spring;
+	model->topLeft.x     = fminf (model->topLeft.x, OBJ (x, i));
+	model->bottomRight.x = fmaxf (model->bottomRight.x, OBJ (x, i));
 
-    spring = &model->springs[model->numSprings];
-    model->numSprings++;
-
-    springInit (spring, a, b, offsetX, offsetY);
+	model->topLeft.y     = fminf (model->topLeft.y, OBJ (y, i));
+	model->bottomRight.y = fmaxf (model->bottomRight.y, OBJ (y, i));
+    }
 }
 
 static void
@@ -182,16 +211,14 @@ modelSetMiddleAnchor (Model *model,
     gx = ((GRID_WIDTH  - 1) / 2 * width)  / (float) (GRID_WIDTH  - 1);
     gy = ((GRID_HEIGHT - 1) / 2 * height) / (float) (GRID_HEIGHT - 1);
 
-    if (model->anchorObject)
-	model->anchorObject->immobile = 0;
+    if (model->anchorObject >= 0)
+	OBJ (model->mobile, model->anchorObject) = 1.0f;
 
-    model->anchorObject = &model->objects[GRID_WIDTH *
-					  ((GRID_HEIGHT - 1) / 2) +
-					  (GRID_WIDTH - 1) / 2];
-    model->anchorObject->position.x = x + gx;
-    model->anchorObject->position.y = y + gy;
+    model->anchorObject = GRID_WIDTH * ((GRID_HEIGHT - 1) / 2) +
+	(GRID_WIDTH - 1) / 2;
+    objectSetPosition (model, model->anchorObject, x + gx, y + gy);
 
-    model->anchorObject->immobile = 1;
+    OBJ (model->mobile, model->anchorObject) = 0.0f;
 }
 
 static void
@@ -211,15 +238,18 @@ modelInitObjects (Model *model,
     {
 	for (gridX = 0; gridX < GRID_WIDTH; gridX++)
 	{
-	    objectInit (&model->objects[i],
-			x + (gridX * width) / gw,
-			y + (gridY * height) / gh,
-			0, 0);
+	    objectSetPosition (model, i,
+			       x + (gridX * width) / gw,
+			       y + (gridY * height) / gh);
+
+	    OBJ (model->velocityX, i) = 0.0f;
+	    OBJ (model->velocityY, i) = 0.0f;
+	    OBJ (model->mobile, i) = 1.0f;
 	    i++;
 	}
     }
 
-    if (!model->anchorObject)
+    if (model->anchorObject < 0)
         modelSetMiddleAnchor (model, x, y, width, height);
 }
 
@@ -228,33 +258,8 @@ modelInitSprings (Model *model,
 		  int   width,
 		  int   height)
 {
-    int   gridX, gridY, i = 0;
-    float hpad, vpad;
-
-    model->numSprings = 0;
-
-    hpad = ((float) width) / (GRID_WIDTH  - 1);
-    vpad = ((float) height) / (GRID_HEIGHT - 1);
-
-    for (gridY = 0; gridY < GRID_HEIGHT; gridY++)
-    {
-	for (gridX = 0; gridX < GRID_WIDTH; gridX++)
-	{
-	    if (gridX > 0)
-		modelAddSpring (model,
-				&model->objects[i - 1],
-				&model->objects[i],
-				hpad, 0);
-
-	    if (gridY > 0)
-		modelAddSpring (model,
-				&model->objects[i - GRID_WIDTH],
-				&model->objects[i],
-				0, vpad);
-
-	    i++;
-	}
-    }
+    model->springOffset.x = ((float) width) / (GRID_WIDTH  - 1);
+    model->springOffset.y = ((float) height) / (GRID_HEIGHT - 1);
 }
 
 static Model *
@@ -269,17 +274,7 @@ createModel (int	  x,
     if (!model)
 	return 0;
 
-    model->numObjects = GRID_WIDTH * GRID_HEIGHT;
-    model->objects = malloc (sizeof (Object) * model->numObjects);
-    if (!model->objects)
-    {
-	free (model);
-	return 0;
-    }
-
-    model->anchorObject = 0;
-    model->numSprings = 0;
-
+    model->anchorObject = -1;
     model->steps = 0;
 
     modelInitObjects (model, x, y, width, height);
@@ -290,71 +285,63 @@ createModel (int	  x,
     return model;
 }
 
+/* Advance the model by a single step.
+ *
+ * Each spring pulls both of its ends towards its rest length, with half of
+ * the displacement each. Immobile objects don't move and don't contribute
+ * to the returned sums. */
 static void
-objectApplyForce (Object *object,
-		  float  fx,
-		  float  fy)
-{
-    object->force.x += fx;
-    object->force.y += fy;
-}
-
-static void
-springExertForces (Spring *spring,
-		   float  k)
-{
-    Vector da, db;
-    Vector a, b;
-
-    a = spring->a->position;
-    b = spring->b->position;
-
-    da.x = 0.5f * (b.x - a.x - spring->offset.x);
-    da.y = 0.5f * (b.y - a.y - spring->offset.y);
-
-    db.x = 0.5f * (a.x - b.x + spring->offset.x);
-    db.y = 0.5f * (a.y - b.y + spring->offset.y);
-
-    objectApplyForce (spring->a, k * da.x, k * da.y);
-    objectApplyForce (spring->b, k * db.x, k * db.y);
-}
-
-static float
-modelStepObject ( Object	    *object,
-        float	    friction,
-        float	    *force)
+modelStepOnce (Model *model,
+	       float friction,
+	       float k,
+	       float mass,
+	       float *velocitySum,
+	       float *forceSum)
 {
-    object->theta += 0.05f;
+    Row forceX[GRID_HEIGHT], forceY[GRID_HEIGHT];
+    Row hasLeft = rowShiftRight (rowSplat (1.0f));
+    Row dx, dy;
+    int r;
 
-    if (object->immobile)
+    for (r = 0; r < GRID_HEIGHT; r++)
     {
-	object->velocity.x = 0.0f;
-	object->velocity.y = 0.0f;
+	/* horizontal springs, from lane i - 1 to lane i */
+	dx = 0.5f * (model->x[r] - rowShiftRight (model->x[r]) -
+		     model->springOffset.x) * hasLeft;
+	dy = 0.5f * (model->y[r] - rowShiftRight (model->y[r])) * hasLeft;
 
-	object->force.x = 0.0f;
-	object->force.y = 0.0f;
+	forceX[r] = k * (rowShiftLeft (dx) - dx);
+	forceY[r] = k * (rowShiftLeft (dy) - dy);
 
-	*force = 0.0f;
+	/* vertical springs, from row r - 1 to row r */
+	if (r > 0)
+	{
+	    dx = 0.5f * (model->x[r] - model->x[r - 1]);
+	    dy = 0.5f * (model->y[r] - model->y[r - 1] - model->springOffset.y);
 
-	return 0.0f;
+	    forceX[r - 1] += k * dx;
+	    forceY[r - 1] += k * dy;
+	    forceX[r]     -= k * dx;
+	    forceY[r]     -= k * dy;
+	}
     }
-    else
-    {
-	object->force.x -= friction * object->velocity.x;
-	object->force.y -= friction * object->velocity.y;
 
-	object->velocity.x += object->force.x / wobbly_settings_get_mass();
-	object->velocity.y += object->force.y / wobbly_settings_get_mass();
+    for (r = 0; r < GRID_HEIGHT; r++)
+    {
+	Row mobile = model->mobile[r];
 
-	object->position.x += object->velocity.x;
-	object->position.y += object->velocity.y;
+	forceX[r] -= friction * model->velocityX[r];
+	forceY[r] -= friction * model->velocityY[r];
 
-	*force = fabs (object->force.x) + fabs (object->force.y);
+	model->velocityX[r] = (model->velocityX[r] + forceX[r] / mass) * mobile;
+	model->velocityY[r] = (model->velocityY[r] + forceY[r] / mass) * mobile;
 
-	object->force.x = 0.0f;
-	object->force.y = 0.0f;
+	model->x[r] += model->velocityX[r];
+	model->y[r] += model->velocityY[r];
 
-	return fabs (object->velocity.x) + fabs (object->velocity.y);
+	*forceSum += rowSum ((rowAbs (forceX[r]) + rowAbs (forceY[r])) * mobile);
+	*velocitySum += rowSum (rowAbs (model->velocityX[r]) +
+				rowAbs (model->velocityY[r]));
     }
 }
 
@@ -362,13 +349,14 @@ static int
 modelStep (Model      *model,
 	   float      friction,
 	   float      k,
+	   float      mass,
 	   float      time)
 {
-    int   i, j, steps, wobbly = 0;
+    int   j, steps, wobbly = 0;
     float velocitySum = 0.0f;
-    float force, forceSum = 0.0f;
+    float forceSum = 0.0f;
 
-    model->steps += time / 15.0f;
+    model->steps += time / MODEL_STEP_MS;
     steps = floor (model->steps);
     model->steps -= steps;
 
@@ -377,17 +365,10 @@ modelStep (Model      *model,
 
     for (j = 0; j < steps; j++)
     {
-	for (i = 0; i < model->numSprings; i++)
-	    springExertForces (&model->springs[i], k);
+	memcpy (model->prevX, model->x, sizeof (model->x));
+	memcpy (model->prevY, model->y, sizeof (model->y));
 
-	for (i = 0; i < model->numObjects; i++)
-	{
-	    velocitySum += modelStepObject (
-					    &model->objects[i],
-					    friction,
-					    &force);
-	    forceSum += force;
-	}
+	modelStepOnce (model, friction, k, mass, &velocitySum, &forceSum);
     }
 
     modelCalcBounds (model);
@@ -402,15 +383,16 @@ modelStep (Model      *model,
 }
 
 static void
-bezierPatchEvaluate (Model *model,
+bezierPatchEvaluate (const Row *positionX,
+		     const Row *positionY,
 		     float u,
 		     float v,
 		     float *patchX,
 		     float *patchY)
 {
-    float coeffsU[4], coeffsV[4];
-    float x, y;
-    int   i, j;
+    float coeffsV[4];
+    Row   coeffsU, x, y;
+    int   j;
 
     coeffsU[0] = (1 - u) * (1 - u) * (1 - u);
     coeffsU[1] = 3 * u * (1 - u) * (1 - u);
@@ -422,21 +404,15 @@ bezierPatchEvaluate (Model *model,
     coeffsV[2] = 3 * v * v * (1 - v);
     coeffsV[3] = v * v * v;
 
-    x = y = 0.0f;
-
-    for (i = 0; i < 4; i++)
+    x = y = rowSplat (0.0f);
+    for (j = 0; j < 4; j++)
     {
-	for (j = 0; j < 4; j++)
-	{
-	    x += coeffsU[i] * coeffsV[j] *
-		model->objects[j * GRID_WIDTH + i].position.x;
-	    y += coeffsU[i] * coeffsV[j] *
-		model->objects[j * GRID_HEIGHT + i].position.y;
-	}
+	x += coeffsV[j] * positionX[j];
+	y += coeffsV[j] * positionY[j];
     }
 
-    *patchX = x;
-    *patchY = y;
+    *patchX = rowSum (x * coeffsU);
+    *patchY = rowSum (y * coeffsU);
 }
 
 static int
@@ -454,35 +430,25 @@ wobblyEnsureModel(struct wobbly_surface *surface)
     return 1;
 }
 
-static float
-objectDistance (Object *object,
-		float  x,
-		float  y)
-{
-    float dx, dy;
-
-    dx = object->position.x - x;
-    dy = object->position.y - y;
-
-    return sqrt (dx * dx + dy * dy);
-}
-
-static Object *
+static int
 modelFindNearestObject (Model *model,
 			float x,
 			float y)
 {
-    Object *object = &model->objects[0];
-    float  distance, minDistance = 0.0;
-    int    i;
+    float distance, minDistance = 0.0;
+    float dx, dy;
+    int   i, object = 0;
 
-    for (i = 0; i < model->numObjects; i++)
+    for (i = 0; i < MODEL_OBJECTS; i++)
     {
-	distance = objectDistance (&model->objects[i], x, y);
+	dx = OBJ (model->x, i) - x;
+	dy = OBJ (model->y, i) - y;
+
+	distance = sqrt (dx * dx + dy * dy);
 	if (i == 0 || distance < minDistance)
 	{
 	    minDistance = distance;
-	    object = &model->objects[i];
+	    object = i;
 	}
     }
 
@@ -497,85 +463,64 @@ modelAdjustCorners (Model *model,
 		     int   height,
              int   make_immobile)
 {
-    Object *o;
-
-    o = &model->objects[0];
-    o->position.x = x;
-    o->position.y = y;
-    o->immobile = make_immobile;
-
-    o = &model->objects[GRID_WIDTH - 1];
-    o->position.x = x + width;
-    o->position.y = y;
-    o->immobile = make_immobile;
+    const int corners[] = {
+	0, GRID_WIDTH - 1, GRID_WIDTH * (GRID_HEIGHT - 1), MODEL_OBJECTS - 1
+    };
+    int i;
 
-    o = &model->objects[GRID_WIDTH * (GRID_HEIGHT - 1)];
-    o->position.x = x;
-    o->position.y = y + height;
-    o->immobile = make_immobile;
+    objectSetPosition (model, corners[0], x, y);
+    objectSetPosition (model, corners[1], x + width, y);
+    objectSetPosition (model, corners[2], x, y + height);
+    objectSetPosition (model, corners[3], x + width, y + height);
 
-    o = &model->objects[model->numObjects - 1];
-    o->position.x = x + width;
-    o->position.y = y + height;
-    o->immobile = make_immobile;
+    for (i = 0; i < 4; i++)
+	OBJ (model->mobile, corners[i]) = make_immobile ? 0.0f : 1.0f;
 
-    if (!model->anchorObject)
-	model->anchorObject = &model->objects[0];
+    if (model->anchorObject < 0)
+	model->anchorObject = 0;
 }
 
 static int
 modelRemoveEdgeAnchors (Model *model)
 {
+    const int corners[] = {
+	0, GRID_WIDTH - 1, GRID_WIDTH * (GRID_HEIGHT - 1), MODEL_OBJECTS - 1
+    };
     int result = 0;
-    Object *o;
-
-    o = &model->objects[0];
-    if (o != model->anchorObject)
-    {
-    result |= o->immobile;
-	o->immobile = 0;
-    }
-
-    o = &model->objects[GRID_WIDTH - 1];
-    if (o != model->anchorObject)
-    {
-    result |= o->immobile;
-	o->immobile = 0;
-    }
-
-    o = &model->objects[GRID_WIDTH * (GRID_HEIGHT - 1)];
-    if (o != model->anchorObject)
-    {
-    result |= o->immobile;
-	o->immobile = 0;
-    }
+    int i;
 
-    o = &model->objects[model->numObjects - 1];
-    if (o != model->anchorObject)
+    for (i = 0; i < 4; i++)
     {
-    result |= o->immobile;
-	o->immobile = 0;
+	if (corners[i] != model->anchorObject)
+	{
+	    result |= (OBJ (model->mobile, corners[i]) == 0.0f);
+	    OBJ (model->mobile, corners[i]) = 1.0f;
+	}
     }
 
     return result;
 }
 
 void
-wobbly_prepare_paint(struct wobbly_surface *surface, int msSinceLastPaint)
+wobbly_prepare_paint_batch(struct wobbly_surface **surfaces, int count,
+			   int msSinceLastPaint)
 {
-    WobblyWindow *ww = surface->ww;
-    float  friction, springK;
+    float friction, springK, mass;
+    int   i;
 
     friction = wobbly_settings_get_friction();
     springK  = wobbly_settings_get_spring_k();
+    mass     = wobbly_settings_get_mass();
 
-    if (ww->wobbly)
+    for (i = 0; i < count; i++)
     {
+	struct wobbly_surface *surface = surfaces[i];
+	WobblyWindow *ww = surface->ww;
+
 	if (ww->wobbly & (WobblyInitial | WobblyVelocity | WobblyForce))
 	{
-	    ww->wobbly = modelStep (ww->model, friction, springK,
-				    (ww->wobbly & WobblyVelocity) ?
-				    msSinceLastPaint : 16);
+	    ww->wobbly = modelStep (ww->model, friction, springK, mass,
+				    msSinceLastPaint);
 
 	    if (ww->wobbly)
                 modelCalcBounds (ww->model);
@@ -588,6 +533,12 @@ wobbly_prepare_paint(struct wobbly_surface *surface, int msSinceLastPaint)
     }
 }
 
+void
+wobbly_prepare_paint(struct wobbly_surface *surface, int msSinceLastPaint)
+{
+    wobbly_prepare_paint_batch(&surface, 1, msSinceLastPaint);
+}
+
 void
 wobbly_done_paint(struct wobbly_surface *surface)
 {
@@ -605,6 +556,7 @@ wobbly_add_geometry(struct wobbly_surface *surface)
 {
     WobblyWindow *ww = surface->ww;
 
+    Row      positionX[GRID_HEIGHT], positionY[GRID_HEIGHT];
     float    width, height;
     float    deformedX, deformedY;
     int      x, y, iw, ih;
@@ -628,11 +580,13 @@ wobbly_add_geometry(struct wobbly_surface *surface)
 	surface->v = v;
 	surface->uv = uv;
 
+	modelGetDisplayPositions (ww->model, positionX, positionY);
+
 	for (y = 0; y < ih; y++)
 	{
 	    for (x = 0; x < iw; x++)
 	    {
-	        bezierPatchEvaluate (ww->model,
+	        bezierPatchEvaluate (positionX, positionY,
 	    			 (x * cell_w) / width,
 	    			 (y * cell_h) / height,
 	    			 &deformedX,
@@ -666,8 +620,10 @@ wobbly_move_notify(struct wobbly_surface *surface, int dx, int dy)
     WobblyWindow *ww = surface->ww;
 
     if (ww->grabbed) {
-        ww->model->anchorObject->position.x += dx;
-        ww->model->anchorObject->position.y += dy;
+        int anchor = ww->model->anchorObject;
+        objectSetPosition (ww->model, anchor,
+                           OBJ (ww->model->x, anchor) + dx,
+                           OBJ (ww->model->y, anchor) + dy);
 
         ww->wobbly |= WobblyInitial;
         surface->synced = 0;
@@ -681,32 +637,32 @@ wobbly_grab_notify(struct wobbly_surface *surface, int x, int y)
 
     if (wobblyEnsureModel (surface))
     {
-        Spring *s;
-        int	   i;
+        Model *model = ww->model;
+        int   anchor, anchorX, anchorY;
 
-        if (ww->model->anchorObject)
-            ww->model->anchorObject->immobile = 0;
+        if (model->anchorObject >= 0)
+            OBJ (model->mobile, model->anchorObject) = 1.0f;
 
-        ww->model->anchorObject = modelFindNearestObject (ww->model, x, y);
-        ww->model->anchorObject->immobile = 1;
+        anchor = model->anchorObject = modelFindNearestObject (model, x, y);
+        OBJ (model->mobile, anchor) = 0.0f;
 
         ww->grabbed = 1;
 
-        for (i = 0; i < ww->model->numSprings; i++)
-        {
-            s = &ww->model->springs[i];
-
-            if (s->a == ww->model->anchorObject)
-            {
-                s->b->velocity.x -= s->offset.x * 0.05f;
-                s->b->velocity.y -= s->offset.y * 0.05f;
-            }
-            else if (s->b == ww->model->anchorObject)
-            {
-                s->a->velocity.x += s->offset.x * 0.05f;
-                s->a->velocity.y += s->offset.y * 0.05f;
-            }
-        }
+        /* Push the neighbours of the anchor, i.e. the other ends of the
+         * springs attached to it */
+        anchorX = anchor % GRID_WIDTH;
+        anchorY = anchor / GRID_WIDTH;
+
+        if (anchorX + 1 < GRID_WIDTH)
+            OBJ (model->velocityX, anchor + 1) -= model->springOffset.x * 0.05f;
+        if (anchorY + 1 < GRID_HEIGHT)
+            OBJ (model->velocityY, anchor + GRID_WIDTH) -=
+                model->springOffset.y * 0.05f;
+        if (anchorX > 0)
+            OBJ (model->velocityX, anchor - 1) += model->springOffset.x * 0.05f;
+        if (anchorY > 0)
+            OBJ (model->velocityY, anchor - GRID_WIDTH) +=
+                model->springOffset.y * 0.05f;
 
         ww->wobbly |= WobblyInitial;
     }
@@ -721,10 +677,10 @@ wobbly_ungrab_notify(struct wobbly_surface *surface)
     {
 	if (ww->model)
 	{
-	    if (ww->model->anchorObject)
-		ww->model->anchorObject->immobile = 0;
+	    if (ww->model->anchorObject >= 0)
+		OBJ (ww->model->mobile, ww->model->anchorObject) = 1.0f;
 
-	    ww->model->anchorObject = NULL;
+	    ww->model->anchorObject = -1;
 
 	    ww->wobbly |= WobblyInitial;
 	}
@@ -765,9 +721,9 @@ wobbly_fini(struct wobbly_surface *surface)
 
     if (ww->model)
     {
-	free(ww->model->objects);
 	free(ww->model);
 	free(surface->v);
+	free(surface->uv);
     }
 
     free (ww);
@@ -779,10 +735,10 @@ void wobbly_force_geometry(struct wobbly_surface *surface, int x, int y, int w,
 
     if (wobblyEnsureModel(surface))
     {
-		if (!ww->grabbed && ww->model->anchorObject)
+		if (!ww->grabbed && ww->model->anchorObject >= 0)
 		{
-		    ww->model->anchorObject->immobile = 0;
-		    ww->model->anchorObject = NULL;
+		    OBJ (ww->model->mobile, ww->model->anchorObject) = 1.0f;
+		    ww->model->anchorObject = -1;
 		}
 
         surface->x = x;
@@ -819,10 +775,12 @@ void wobbly_translate(struct wobbly_surface *surface, int dx, int dy)
     WobblyWindow *ww = surface->ww;
     if (wobblyEnsureModel(surface))
     {
-        for (int i = 0; i < ww->model->numObjects; i++)
+        for (int r = 0; r < GRID_HEIGHT; r++)
         {
-            ww->model->objects[i].position.x += dx;
-            ww->model->objects[i].position.y += dy;
+            ww->model->x[r] += (float) dx;
+            ww->model->y[r] += (float) dy;
+            ww->model->prevX[r] += (float) dx;
+            ww->model->prevY[r] += (float) dy;
         }
 
         ww->model->topLeft.x += dx;
@@ -4,6 +4,8 @@
 #include <view-transform.hpp>
 #include <workspace-manager.hpp>
 #include <render-manager.hpp>
+#include <map>
+#include <algorithm>
 
 extern "C"
 {
@@ -43,6 +45,10 @@ void main()
 
     GLuint program, uvID, posID, mvpID;
 
+    /* Index buffers of the grid triangles, they depend only on the grid size
+     * and so are shared between all wobbly windows */
+    std::map<std::pair<int, int>, GLuint> index_buffers;
+
     int times_loaded = 0;
 
     void load_program()
@@ -63,13 +69,62 @@ void main()
         if (--times_loaded == 0)
         {
             OpenGL::render_begin();
-            GL_CALL(glDeleteProgram(program));
+            OpenGL::destroy_program(program);
+            for (auto& ibo : index_buffers)
+                GL_CALL(glDeleteBuffers(1, &ibo.second));
             OpenGL::render_end();
+
+            index_buffers.clear();
         }
     }
 
-    /* Requires bound opengl context */
-    void render_triangles(GLuint tex, glm::mat4 mat, float *pos, float *uv, int cnt)
+    /* Requires bound opengl context
+     *
+     * Returns the index buffer for a grid with (x_cells + 1) * (y_cells + 1)
+     * vertices, stored row by row, with two triangles per cell */
+    GLuint get_index_buffer(int x_cells, int y_cells)
+    {
+        auto it = index_buffers.find({x_cells, y_cells});
+        if (it != index_buffers.end())
+            return it->second;
+
+        std::vector<GLushort> idx;
+        idx.reserve(x_cells * y_cells * 6);
+
+        int per_row = x_cells + 1;
+        for (int j = 0; j < y_cells; j++)
+        {
+            for (int i = 0; i < x_cells; i++)
+            {
+                GLushort tl = j * per_row + i, tr = tl + 1;
+                GLushort bl = tl + per_row, br = bl + 1;
+
+                idx.push_back(tl);
+                idx.push_back(br);
+                idx.push_back(tr);
+
+                idx.push_back(tl);
+                idx.push_back(bl);
+                idx.push_back(br);
+            }
+        }
+
+        GLuint ibo;
+        GL_CALL(glGenBuffers(1, &ibo));
+        GL_CALL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo));
+        GL_CALL(glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+                idx.size() * sizeof(GLushort), idx.data(), GL_STATIC_DRAW));
+        GL_CALL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0));
+
+        index_buffers[{x_cells, y_cells}] = ibo;
+        return ibo;
+    }
+
+    /* Requires bound opengl context
+     *
+     * vbo contains interleaved x, y, u, v for each vertex */
+    void render_triangles(GLuint tex, glm::mat4 mat, GLuint vbo, GLuint ibo,
+        int cnt)
     {
         GL_CALL(glUseProgram(program));
         GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
@@ -80,21 +135,29 @@ void main()
         GL_CALL(glBindTexture(GL_TEXTURE_2D, tex));
         GL_CALL(glActiveTexture(GL_TEXTURE0));
 
-        GL_CALL(glVertexAttribPointer(posID, 2, GL_FLOAT, GL_FALSE, 0, pos));
+        GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, vbo));
+        GL_CALL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo));
+
+        GL_CALL(glVertexAttribPointer(posID, 2, GL_FLOAT, GL_FALSE,
+                4 * sizeof(GLfloat), (void*)0));
         GL_CALL(glEnableVertexAttribArray(posID));
 
-        GL_CALL(glVertexAttribPointer(uvID, 2, GL_FLOAT, GL_FALSE, 0, uv));
+        GL_CALL(glVertexAttribPointer(uvID, 2, GL_FLOAT, GL_FALSE,
+                4 * sizeof(GLfloat), (void*)(2 * sizeof(GLfloat))));
         GL_CALL(glEnableVertexAttribArray(uvID));
 
         GL_CALL(glUniformMatrix4fv(mvpID, 1, GL_FALSE, &mat[0][0]));
         GL_CALL(glEnable(GL_BLEND));
         GL_CALL(glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA));
 
-        GL_CALL(glDrawArrays (GL_TRIANGLES, 0, 3 * cnt));
+        GL_CALL(glDrawElements(GL_TRIANGLES, 3 * cnt, GL_UNSIGNED_SHORT, 0));
         GL_CALL(glDisable(GL_BLEND));
 
         GL_CALL(glDisableVertexAttribArray(uvID));
         GL_CALL(glDisableVertexAttribArray(posID));
+
+        GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, 0));
+        GL_CALL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0));
     }
 };
 
@@ -128,10 +191,67 @@ extern "C"
     }
 }
 
+class wf_wobbly;
+
+/* Steps all wobbly models on an output together, once per frame */
+class wobbly_batch_t : public wf_custom_data_t
+{
+    wayfire_output output;
+    effect_hook_t pre_hook;
+
+    std::vector<wf_wobbly*> models;
+    std::vector<wobbly_surface*> surfaces;
+    uint32_t last_frame;
+
+    void step_all();
+
+    public:
+    wobbly_batch_t(wayfire_output output)
+    {
+        this->output = output;
+        pre_hook = [=] () { step_all(); };
+    }
+
+    ~wobbly_batch_t()
+    {
+        if (!models.empty())
+            output->render->rem_effect(&pre_hook);
+    }
+
+    void add(wf_wobbly *model)
+    {
+        if (models.empty())
+        {
+            last_frame = get_current_time();
+            output->render->add_effect(&pre_hook, WF_OUTPUT_EFFECT_PRE);
+        }
+
+        models.push_back(model);
+    }
+
+    void remove(wf_wobbly *model)
+    {
+        auto it = std::find(models.begin(), models.end(), model);
+        if (it == models.end())
+            return;
+
+        models.erase(it);
+        if (models.empty())
+            output->render->rem_effect(&pre_hook);
+    }
+};
+
+static nonstd::observer_ptr<wobbly_batch_t> get_wobbly_batch(wayfire_output output)
+{
+    if (!output->has_data<wobbly_batch_t>())
+        output->store_data(std::make_unique<wobbly_batch_t> (output));
+
+    return output->get_data<wobbly_batch_t>();
+}
+
 class wf_wobbly : public wf_view_transformer_t
 {
     wayfire_view view;
-    effect_hook_t pre_hook;
     signal_callback_t view_removed, view_geometry_changed, view_output_changed;
     wayfire_grab_interface iface;
 
@@ -141,7 +261,14 @@ class wf_wobbly : public wf_view_transformer_t
     int grab_x = 0, grab_y = 0;
 
     wf_geometry snapped_geometry;
-    uint32_t last_frame;
+
+    /* The vertices of the grid, uploaded on the first render_box() after
+     * they have changed, and then used for all damaged rectangles */
+    GLuint vbo = 0;
+    std::vector<GLfloat> mesh;
+    bool mesh_dirty = true;
+    /* The box the undeformed grid was generated for, if !model->v */
+    wf_geometry mesh_box = {0, 0, 0, 0};
 
     public:
     wf_wobbly(wayfire_view view, wayfire_grab_interface iface)
@@ -165,13 +292,8 @@ class wf_wobbly : public wf_view_transformer_t
         model->v = NULL;
         model->uv = NULL;
 
-        last_frame = get_current_time();
         wobbly_init(model.get());
-
-        pre_hook = [=] () {
-            update_model();
-        };
-        view->get_output()->render->add_effect(&pre_hook, WF_OUTPUT_EFFECT_PRE);
+        get_wobbly_batch(view->get_output())->add(this);
 
         view_removed = [=] (signal_data *data) {
             destroy_self();
@@ -191,8 +313,8 @@ class wf_wobbly : public wf_view_transformer_t
             /* Wobbly is active only when there's already been an output */
             assert(sig->output);
 
-            sig->output->render->rem_effect(&pre_hook);
-            view->get_output()->render->add_effect(&pre_hook, WF_OUTPUT_EFFECT_PRE);
+            get_wobbly_batch(sig->output)->remove(this);
+            get_wobbly_batch(view->get_output())->add(this);
         };
 
         view->connect_signal("unmap", &view_removed);
@@ -221,20 +343,30 @@ class wf_wobbly : public wf_view_transformer_t
         return point;
     }
 
-    void update_model()
+    wobbly_surface *get_model()
+    {
+        return model.get();
+    }
+
+    /* Called before the models on the output are stepped */
+    void prepare_step()
     {
         view->damage();
 
         auto bbox = view->get_bounding_box("wobbly");
         if (snapped_geometry.width <= 0)
             resize(bbox.width, bbox.height);
+    }
 
-        auto now = get_current_time();
-        wobbly_prepare_paint(model.get(), now - last_frame);
-        last_frame = now;
-
+    /* Called after the models on the output have been stepped.
+     * May destroy the transformer */
+    void finish_step()
+    {
+        auto bbox = view->get_bounding_box("wobbly");
         wobbly_add_geometry(model.get());
         wobbly_done_paint(model.get());
+        mesh_dirty = true;
+        damage();
 
         view->damage();
 
@@ -248,64 +380,68 @@ class wf_wobbly : public wf_view_transformer_t
             destroy_self();
     }
 
-    virtual void render_box(uint32_t src_tex, wlr_box src_box,
-        wlr_box scissor_box, const wf_framebuffer& target_fb)
+    /* Requires bound opengl context */
+    void upload_mesh(wlr_box src_box)
     {
-        OpenGL::render_begin(target_fb);
-        target_fb.scissor(scissor_box);
-
-        float x = src_box.x, y = src_box.y, w = src_box.width, h = src_box.height;
-
-        std::vector<float> vert, uv;
-        std::vector<int> idx;
+        bool deformed = model->v && model->uv;
+        if (!mesh_dirty && (deformed || src_box == mesh_box))
+            return;
 
         int per_row = model->x_cells + 1;
+        int vertices = per_row * (model->y_cells + 1);
+        mesh.resize(4 * vertices);
 
-        for (int j = 0; j < model->y_cells; j++)
+        if (!deformed)
         {
-            for (int i = 0; i < model->x_cells; i++)
-            {
-                idx.push_back(i * per_row + j);
-                idx.push_back((i + 1) * per_row + j + 1);
-                idx.push_back(i * per_row + j + 1);
+            float tile_w = 1.0f * src_box.width / model->x_cells;
+            float tile_h = 1.0f * src_box.height / model->y_cells;
 
-                idx.push_back(i * per_row + j);
-                idx.push_back((i + 1) * per_row + j);
-                idx.push_back((i + 1) * per_row + j + 1);
-            }
-        }
-
-        if (!model->v || !model->uv)
-        {
-            for (auto id : idx)
+            for (int k = 0; k < vertices; k++)
             {
-                float tile_w = w / model->x_cells;
-                float tile_h = h / model->y_cells;
-
-                int i = id / per_row;
-                int j = id % per_row;
+                int i = k % per_row;
+                int j = k / per_row;
 
-                vert.push_back(i * tile_w + x);
-                vert.push_back(j * tile_h + y);
-
-                uv.push_back(1.0f * i / model->x_cells);
-                uv.push_back(1.0f - 1.0f * j / model->y_cells);
+                mesh[4 * k]     = i * tile_w + src_box.x;
+                mesh[4 * k + 1] = j * tile_h + src_box.y;
+                mesh[4 * k + 2] = 1.0f * i / model->x_cells;
+                mesh[4 * k + 3] = 1.0f - 1.0f * j / model->y_cells;
             }
         } else
         {
-            for (auto i : idx)
+            for (int k = 0; k < vertices; k++)
             {
-                vert.push_back(model->v[2 * i]);
-                vert.push_back(model->v[2 * i + 1]);
-
-                uv.push_back(model->uv[2 * i]);
-                uv.push_back(model->uv[2 * i + 1]);
+                mesh[4 * k]     = model->v[2 * k];
+                mesh[4 * k + 1] = model->v[2 * k + 1];
+                mesh[4 * k + 2] = model->uv[2 * k];
+                mesh[4 * k + 3] = model->uv[2 * k + 1];
             }
         }
 
+        if (!vbo)
+            GL_CALL(glGenBuffers(1, &vbo));
+
+        GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, vbo));
+        GL_CALL(glBufferData(GL_ARRAY_BUFFER, mesh.size() * sizeof(GLfloat),
+                mesh.data(), GL_STREAM_DRAW));
+        GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, 0));
+
+        mesh_dirty = false;
+        mesh_box = src_box;
+    }
+
+    virtual void render_box(uint32_t src_tex, wlr_box src_box,
+        wlr_box scissor_box, const wf_framebuffer& target_fb)
+    {
+        OpenGL::render_begin(target_fb);
+        target_fb.scissor(scissor_box);
+
+        upload_mesh(src_box);
+        GLuint ibo = wobbly_graphics::get_index_buffer(model->x_cells,
+            model->y_cells);
+
         wobbly_graphics::render_triangles(src_tex,
             target_fb.get_orthographic_projection(),
-            vert.data(), uv.data(), model->x_cells * model->y_cells * 2);
+            vbo, ibo, model->x_cells * model->y_cells * 2);
 
         OpenGL::render_end();
     }
@@ -356,6 +492,8 @@ class wf_wobbly : public wf_view_transformer_t
     {
         wobbly_translate(model.get(), dx, dy);
         wobbly_add_geometry(model.get());
+        mesh_dirty = true;
+        damage();
     }
 
     void destroy_self()
@@ -377,8 +515,15 @@ class wf_wobbly : public wf_view_transformer_t
 
     virtual ~wf_wobbly()
     {
+        if (vbo)
+        {
+            OpenGL::render_begin();
+            GL_CALL(glDeleteBuffers(1, &vbo));
+            OpenGL::render_end();
+        }
+
         wobbly_fini(model.get());
-        view->get_output()->render->rem_effect(&pre_hook);
+        get_wobbly_batch(view->get_output())->remove(this);
 
         view->disconnect_signal("unmap", &view_removed);
         view->disconnect_signal("set-output", &view_output_changed);
@@ -386,6 +531,30 @@ class wf_wobbly : public wf_view_transformer_t
     }
 };
 
+void wobbly_batch_t::step_all()
+{
+    /* finish_step() may destroy the transformer and remove it from models */
+    auto stepped = models;
+
+    surfaces.clear();
+    for (auto model : stepped)
+    {
+        model->prepare_step();
+        surfaces.push_back(model->get_model());
+    }
+
+    auto now = get_current_time();
+    wobbly_prepare_paint_batch(surfaces.data(), surfaces.size(),
+        now - last_frame);
+    last_frame = now;
+
+    for (auto model : stepped)
+    {
+        if (std::find(models.begin(), models.end(), model) != models.end())
+            model->finish_step();
+    }
+}
+
 class wayfire_wobbly : public wayfire_plugin_t
 {
     signal_callback_t wobbly_changed;
@@ -447,6 +616,7 @@ class wayfire_wobbly : public wayfire_plugin_t
                     wobbly->destroy_self();
             }, WF_ALL_LAYERS);
 
+            output->erase_data<wobbly_batch_t>();
             wobbly_graphics::destroy_program();
             output->disconnect_signal("wobbly-event", &wobbly_changed);
         }
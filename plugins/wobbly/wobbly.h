@@ -38,6 +38,9 @@ void wobbly_ungrab_notify(struct wobbly_surface *surface);
 void wobbly_resize_notify(struct wobbly_surface *surface);
 void wobbly_move_notify(struct wobbly_surface *surface, int dx, int dy);
 void wobbly_prepare_paint(struct wobbly_surface *surface, int msSinceLastPaint);
+/* Same as wobbly_prepare_paint, for several surfaces at once */
+void wobbly_prepare_paint_batch(struct wobbly_surface **surfaces, int count,
+    int msSinceLastPaint);
 void wobbly_done_paint(struct wobbly_surface *surface);
 void wobbly_add_geometry(struct wobbly_surface *surface);
 struct wobbly_rect wobbly_boundingbox(struct wobbly_surface *surface);
@@ -4,14 +4,84 @@
 #include "debug.hpp"
 #include <GLES2/gl2.h>
 #include <string>
+#include <vector>
+#include <memory>
+#include <functional>
 
 namespace image_io
 {
+    /* A decoded image. Rows are tightly packed, from top to bottom */
+    struct image_t
+    {
+        int width = 0, height = 0;
+        /* GL_RGBA or GL_RGB */
+        GLenum format = GL_RGBA;
+        std::vector<uint8_t> pixels;
+    };
+
     /* Load the image from the given file, binding it to the given GL texture target
      * Bind the texture before you call this function
      * Guaranteed: doesn't change any GL state except pixel packing */
     bool load_from_file(std::string name, GLuint target);
 
+    /* Decode the image from the given file, returns nullptr on failure.
+     *
+     * Decoded images are cached by path and modification time while they are
+     * in use, so loading the same file again, for ex. on another output,
+     * doesn't decode it again. Can be called from any thread */
+    std::shared_ptr<const image_t> decode_file(std::string name);
+
+    /* Upload the decoded image to the given GL texture target, with the same
+     * guarantees as load_from_file() */
+    void upload(const image_t& image, GLuint target);
+
+    using load_callback_t = std::function<void(std::shared_ptr<const image_t>)>;
+
+    /* Decode the image from the given file in a worker thread, so that big
+     * images don't block the compositor. The callback is called from the main
+     * loop with the decoded image, or with nullptr if it can't be loaded, and
+     * should upload the image itself.
+     *
+     * Returns an ID of the request which can be passed to cancel_load() */
+    uint32_t load_from_file_async(std::string name, load_callback_t callback);
+
+    /* A GL texture with a decoded image uploaded to it */
+    struct texture_t
+    {
+        GLuint tex = 0;
+        /* GL_TEXTURE_2D, or GL_TEXTURE_CUBE_MAP with the image on all faces */
+        GLenum target = GL_TEXTURE_2D;
+        int width = 0, height = 0;
+
+        texture_t() = default;
+        texture_t(const texture_t&) = delete;
+        texture_t& operator = (const texture_t&) = delete;
+
+        /* Deletes the GL texture */
+        ~texture_t();
+    };
+
+    using texture_callback_t = std::function<void(std::shared_ptr<const texture_t>)>;
+
+    /* Like load_from_file_async(), but the callback gets a texture with the
+     * image already uploaded, with linear filtering and clamped to the edges,
+     * or nullptr if the image can't be loaded.
+     *
+     * Textures are shared by everyone who loads the same file with the same
+     * target, as long as someone holds a reference to them and the file isn't
+     * modified, so for ex. outputs which load the same background at different
+     * times share a single decode and a single texture. If the texture is
+     * already loaded, the callback is called immediately and 0 is returned.
+     *
+     * Must be called from the main thread */
+    uint32_t load_texture_async(std::string name, GLenum target,
+        texture_callback_t callback);
+
+    /* Don't call the callback of the given request. Must be called if the
+     * callback uses objects which are destroyed before the image is loaded.
+     * Does nothing if the request has already finished */
+    void cancel_load(uint32_t id);
+
     /* Function that saves the given pixels(in rgba format) to a (currently) png file */
     void write_to_file(std::string name, uint8_t *pixels, int w, int h, std::string type);
 
@@ -1,18 +1,30 @@
 #ifndef WF_SAFE_LIST_HPP
 #define WF_SAFE_LIST_HPP
 
-#include <list>
+#include <deque>
+#include <vector>
 #include <memory>
+#include <utility>
 #include <algorithm>
 #include <functional>
+#include <stdexcept>
 
 #include <wayland-server.h>
 
-/* This is a trimmed-down wrapper of std::list<T>.
+/* This is a trimmed-down list-like container, stored contiguously in a vector.
  *
  * It supports safe iteration over all elements in the collection, where any
  * element can be deleted from the list at any given time (i.e even in a
- * for-each-like loop) */
+ * for-each-like loop).
+ *
+ * Erased elements are left as tombstones, which are compacted when the event
+ * loop goes idle. Elements added while the list is being iterated are queued
+ * and inserted when the outermost iteration finishes. As with a linked list,
+ * elements appended during for_each() are still visited by it, after all the
+ * others. Elements inserted with emplace_at() during an iteration are visited
+ * only by later iterations.
+ *
+ * T must be default-constructible, an erased element is replaced with T() */
 namespace wf
 {
     /* The object type depends on the safe list type, and the safe list type
@@ -29,29 +41,157 @@ namespace wf
     template<class T>
     class safe_list_t
     {
-        std::list<std::unique_ptr<T>> list;
+        public:
+        enum insert_place_t
+        {
+            INSERT_BEFORE,
+            INSERT_AFTER,
+            INSERT_NONE,
+        };
+
+        private:
+        struct slot_t
+        {
+            T value;
+            bool alive;
+        };
+
+        using check_t = std::function<insert_place_t(T&)>;
+
+        struct pending_t
+        {
+            T value;
+            /* Empty for elements appended with push_back() */
+            check_t check;
+            bool alive;
+        };
+
+        /* for_each() is const, but it needs to track the iteration depth and
+         * to apply the insertions queued during the iteration once it ends */
+        mutable std::vector<slot_t> items;
+        /* Insertions requested while iterating. A deque, so that appending
+         * does not move the queued elements which are being visited */
+        mutable std::deque<pending_t> pending;
+        mutable int iteration_depth = 0;
+
+        size_t alive_count = 0;
         wl_event_source *idle_cleanup_source = NULL;
 
         /* Remove all invalidated elements in the list */
-        std::function<void()> do_cleanup = [&] ()
+        std::function<void()> do_cleanup = [this] ()
+        {
+            idle_cleanup_source = NULL;
+            compact();
+        };
+
+        void compact()
+        {
+            /* Erasing would invalidate the running iterations */
+            if (iteration_depth > 0)
+            {
+                schedule_cleanup();
+                return;
+            }
+
+            if (idle_cleanup_source)
+            {
+                wl_event_source_remove(idle_cleanup_source);
+                idle_cleanup_source = NULL;
+            }
+
+            items.erase(std::remove_if(items.begin(), items.end(),
+                    [] (const slot_t& slot) { return !slot.alive; }),
+                items.end());
+        }
+
+        void schedule_cleanup()
+        {
+            /* Be careful to not schedule it twice */
+            if (!idle_cleanup_source)
+            {
+                idle_cleanup_source = wl_event_loop_add_idle(_safe_list_detail::event_loop,
+                    _safe_list_detail::idle_cleanup_func, &do_cleanup);
+            }
+        }
+
+        /* Insert at the place indicated by check, or at the end if check is
+         * empty or does not indicate any place. Does not update alive_count */
+        void insert_now(T&& value, const check_t& check)
         {
-            auto it = list.begin();
-            while (it != list.end())
+            auto it = items.begin();
+            if (check)
             {
-                if (*it) {
-                    ++it;
-                } else {
-                    it = list.erase(it);
+                for (; it != items.end(); ++it)
+                {
+                    /* Skip erased elements */
+                    if (!it->alive)
+                        continue;
+
+                    auto place = check(it->value);
+                    if (place == INSERT_AFTER)
+                    {
+                        ++it;
+                        break;
+                    }
+
+                    if (place == INSERT_BEFORE)
+                        break;
                 }
+            } else
+            {
+                it = items.end();
             }
 
-            idle_cleanup_source = NULL;
-        };
+            items.insert(it, slot_t{std::move(value), true});
+        }
+
+        /* Insert the elements queued during the iteration which just ended */
+        void flush_pending() const
+        {
+            auto self = const_cast<safe_list_t*> (this);
+            if (pending.empty() || iteration_depth > 0)
+                return;
+
+            auto queued = std::move(pending);
+            pending.clear();
+            for (auto& entry : queued)
+            {
+                if (entry.alive)
+                    self->insert_now(std::move(entry.value), entry.check);
+            }
+        }
 
-        /* Return whether the list has invalidated elements */
-        bool is_dirty() const
+        void enqueue(T&& value, check_t check)
         {
-            return idle_cleanup_source;
+            pending.push_back(pending_t{std::move(value), std::move(check), true});
+            ++alive_count;
+        }
+
+        template<class Func>
+        void iterate(bool reverse, const Func& func) const
+        {
+            ++iteration_depth;
+            /* Nothing is inserted or erased from items until the outermost
+             * iteration is finished, so references to it stay valid */
+            size_t count = items.size();
+            for (size_t i = 0; i < count; i++)
+            {
+                auto& slot = items[reverse ? count - i - 1 : i];
+                if (slot.alive)
+                    func(slot.value);
+            }
+
+            /* Appended elements come after all others, so a forward iteration
+             * reaches them, including those appended by func itself */
+            for (size_t i = 0; !reverse && i < pending.size(); i++)
+            {
+                auto& entry = pending[i];
+                if (entry.alive && !entry.check)
+                    func(entry.value);
+            }
+
+            if (--iteration_depth == 0 && !pending.empty())
+                flush_pending();
         }
 
         public:
@@ -61,14 +201,41 @@ namespace wf
         safe_list_t(const safe_list_t& other) { *this = other; }
         safe_list_t& operator = (const safe_list_t& other)
         {
-            this->idle_cleanup_source = NULL;
+            if (this == &other)
+                return *this;
+
+            compact();
+            items.clear();
+            pending.clear();
+            alive_count = 0;
+
             other.for_each([&] (auto& el) {
                 this->push_back(el);
             });
+
+            return *this;
         }
 
-        safe_list_t(safe_list_t&& other) = default;
-        safe_list_t& operator = (safe_list_t&& other) = default;
+        safe_list_t(safe_list_t&& other) { *this = std::move(other); }
+        safe_list_t& operator = (safe_list_t&& other)
+        {
+            if (this == &other)
+                return *this;
+
+            /* The idle source of other refers to other's cleanup function */
+            compact();
+            other.compact();
+
+            items = std::move(other.items);
+            pending = std::move(other.pending);
+            alive_count = other.alive_count;
+
+            other.items.clear();
+            other.pending.clear();
+            other.alive_count = 0;
+
+            return *this;
+        }
 
         ~safe_list_t()
         {
@@ -78,91 +245,63 @@ namespace wf
 
         T& back()
         {
-            /* No invalidated elements */
-            if (!is_dirty())
-                return *list.back();
+            /* An element appended during an iteration is the last one. Elements
+             * queued by emplace_at() are placed when the iteration ends */
+            for (auto it = pending.rbegin(); it != pending.rend(); ++it)
+            {
+                if (it->alive && !it->check)
+                    return it->value;
+            }
 
-            auto it = list.rbegin();
-            while (it != list.rend() && (*it) == nullptr)
-                ++it;
+            auto it = std::find_if(items.rbegin(), items.rend(),
+                [] (const slot_t& slot) { return slot.alive; });
 
-            if (it == list.rend())
+            if (it == items.rend())
                 throw std::out_of_range("back() called on an empty list!");
 
-            return **it;
+            return it->value;
         }
 
         size_t size() const
         {
-            if (!is_dirty())
-                return list.size();
-
-            /* Count non-null elements, because that's the real size */
-            size_t sz = 0;
-            for (auto& it : list)
-                sz += (it != nullptr);
-
-            return sz;
+            return alive_count;
         }
 
         /* Push back by copying */
         void push_back(T value)
         {
-            list.push_back(std::make_unique<T> (std::move(value)));
+            emplace_back(std::move(value));
         }
 
         /* Push back by moving */
         void emplace_back(T&& value)
         {
-            list.push_back(std::make_unique<T> (value));
-        }
+            if (iteration_depth > 0)
+            {
+                enqueue(std::move(value), check_t{});
+                return;
+            }
 
-        enum insert_place_t
-        {
-            INSERT_BEFORE,
-            INSERT_AFTER,
-            INSERT_NONE,
-        };
+            items.push_back(slot_t{std::move(value), true});
+            ++alive_count;
+        }
 
         /* Insert the given value at a position in the list, determined by the
          * check function. The value is inserted at the first position that
          * check indicates, or at the end of the list otherwise */
-        void emplace_at(T&& value, std::function<insert_place_t(T&)> check)
+        void emplace_at(T&& value, check_t check)
         {
-            auto it = list.begin();
-            while (it != list.end())
+            if (iteration_depth > 0)
             {
-                /* Skip empty elements */
-                if (*it == nullptr)
-                {
-                    ++it;
-                    continue;
-                }
-
-                auto place = check(**it);
-                switch (place)
-                {
-                    case INSERT_AFTER:
-                        /* We can safely increment it, because it points to an
-                         * element in the list */
-                        ++it;
-                        // fall through
-                    case INSERT_BEFORE:
-                        list.emplace(it, std::make_unique<T>(value));
-                        return;
-
-                    default:
-                        break;
-                }
-
-                ++it;
+                enqueue(std::move(value), std::move(check));
+                return;
             }
 
-            /* If no place found, insert at the end */
-            emplace_back(std::move(value));
+            insert_now(std::move(value), check);
+            ++alive_count;
         }
 
-        void insert_at(T value, std::function<insert_place_t(T&)> check)
+        void insert_at(T value, check_t check)
         {
             emplace_at(std::move(value), check);
         }
@@ -170,28 +309,13 @@ namespace wf
         /* Call func for each non-erased element of the list */
         void for_each(std::function<void(T&)> func) const
         {
-            for (auto& el : list)
-            {
-                /* The for-each loop here is safe, because no elements will be
-                 * erased util the event loop goes idle */
-                if (el)
-                    func(*el);
-            }
+            iterate(false, func);
         }
 
         /* Call func for each non-erased element of the list in reversed order */
         void for_each_reverse(std::function<void(T&)> func) const
         {
-            auto it = list.rbegin();
-            while (it != list.rend())
-            {
-                /* The loop here is safe, because no elements will be erased
-                 * util the event loop goes idle */
-                if (*it)
-                    func(**it);
-
-                ++it;
-            }
+            iterate(true, func);
         }
 
         /* Safely remove all elements equal to value */
@@ -201,28 +325,43 @@ namespace wf
         }
 
         /* Remove all elements satisfying a given condition.
-         * This function resets their pointers and scheduling a cleanup operation */
+         * This function turns them into tombstones and schedules a cleanup
+         * operation */
         void remove_if(std::function<bool(const T&)> predicate)
         {
-            bool actually_removed = false;
-            for (auto& it : list)
+            /* The removed values are freed only when the list is consistent
+             * again, in case their destructors access the list */
+            std::vector<T> removed;
+
+            for (size_t i = 0; i < items.size(); i++)
             {
-                if (it && predicate(*it))
+                auto& slot = items[i];
+                if (slot.alive && predicate(slot.value))
                 {
-                    actually_removed = true;
-                    /* First reset the element in the list, and then free resources */
-                    auto copy = std::move(it);
-                    it = nullptr;
-                    /* Now copy goes out of scope */
+                    removed.push_back(std::move(slot.value));
+                    slot.value = T();
+                    slot.alive = false;
+                    --alive_count;
                 }
             }
 
-            /* Schedule a clean-up, but be careful to not schedule it twice */
-            if (!idle_cleanup_source && actually_removed)
+            /* Only the tombstones in items need to be compacted */
+            bool left_tombstones = !removed.empty();
+
+            /* Queued elements may be being visited, so they are only marked */
+            for (auto& entry : pending)
             {
-                idle_cleanup_source = wl_event_loop_add_idle(_safe_list_detail::event_loop,
-                    _safe_list_detail::idle_cleanup_func, &do_cleanup);
+                if (entry.alive && predicate(entry.value))
+                {
+                    removed.push_back(std::move(entry.value));
+                    entry.value = T();
+                    entry.alive = false;
+                    --alive_count;
+                }
             }
+
+            if (left_tombstones)
+                schedule_cleanup();
         }
     };
 }
@@ -3,6 +3,7 @@
 
 #include <unordered_map>
 #include <list>
+#include <vector>
 #include <typeinfo>
 
 #include <nonstd/observer_ptr.h>
@@ -17,32 +18,88 @@ class wf_custom_data_t
     virtual ~wf_custom_data_t() {};
 };
 
+/* Signals are identified by an ID, which is the same for all objects.
+ * Code which emits a signal often should look up its ID once and then use the
+ * overloads taking an ID, to avoid hashing the name on each emission. */
+using wf_signal_id = uint32_t;
+
+/* Get the ID of the signal with the given name */
+wf_signal_id wf_get_signal_id(const std::string& name);
+
+/* Custom data names are mapped to slots in the same way */
+using wf_custom_data_slot_id = uint32_t;
+wf_custom_data_slot_id wf_get_custom_data_slot(const std::string& name);
+
 class wf_signal_provider_t
 {
     public:
 
     /* Register a callback to be called whenever the given signal is emitted */
-    void connect_signal(std::string name, signal_callback_t* callback)
+    void connect_signal(wf_signal_id signal, signal_callback_t* callback)
+    {
+        auto handlers = find_handlers(signal);
+        if (!handlers)
+        {
+            signals.emplace_back(signal,
+                std::make_unique<wf::safe_list_t<signal_callback_t*>> ());
+            handlers = signals.back().second.get();
+        }
+
+        handlers->push_back(callback);
+    }
+
+    void connect_signal(const std::string& name, signal_callback_t* callback)
     {
-        signals[name].push_back(callback);
+        connect_signal(wf_get_signal_id(name), callback);
     }
 
     /* Unregister a registered callback */
-    void disconnect_signal(std::string name, signal_callback_t* callback)
+    void disconnect_signal(wf_signal_id signal, signal_callback_t* callback)
+    {
+        auto handlers = find_handlers(signal);
+        if (handlers)
+            handlers->remove_all(callback);
+    }
+
+    void disconnect_signal(const std::string& name, signal_callback_t* callback)
     {
-        signals[name].remove_all(callback);
+        disconnect_signal(wf_get_signal_id(name), callback);
     }
 
     /* Emit the given signal. No type checking for data is required */
-    void emit_signal(std::string name, signal_data *data)
+    void emit_signal(wf_signal_id signal, signal_data *data)
     {
-        signals[name].for_each([data] (auto call) {
+        auto handlers = find_handlers(signal);
+        if (!handlers)
+            return;
+
+        handlers->for_each([data] (auto call) {
             (*call) (data);
         });
     }
 
+    void emit_signal(const std::string& name, signal_data *data)
+    {
+        emit_signal(wf_get_signal_id(name), data);
+    }
+
     private:
-    std::unordered_map<std::string, wf::safe_list_t<signal_callback_t*>> signals;
+    /* Objects have handlers for only a few signals, so a linear search is
+     * faster than a map. The lists are allocated separately, so that they
+     * don't move if a handler connects to another signal during emission. */
+    std::vector<std::pair<wf_signal_id,
+        std::unique_ptr<wf::safe_list_t<signal_callback_t*>>>> signals;
+
+    wf::safe_list_t<signal_callback_t*> *find_handlers(wf_signal_id signal)
+    {
+        for (auto& handlers : signals)
+        {
+            if (handlers.first == signal)
+                return handlers.second.get();
+        }
+
+        return nullptr;
+    }
 };
 
 class wf_object_base : public wf_signal_provider_t
@@ -60,69 +117,85 @@ class wf_object_base : public wf_signal_provider_t
         return object_id;
     }
 
+    /* Custom data is stored in slots. Each name gets a slot index the first
+     * time it is used, and the overloads without a name use the slot of
+     * typeid(T).name(), which is looked up only once per type. The name-based
+     * overloads hash the name on each call, so code which accesses its data
+     * often should prefer the typed ones. */
+
     /* Retrieve custom data stored with the given name. If no such
      * data exists, then it is created with the default constructor
      *
      * REQUIRES a default constructor
      * If your type doesn't have one, use store_data + get_data
      * */
-    template<class T> nonstd::observer_ptr<T> get_data_safe(
-        std::string name = typeid(T).name())
+    template<class T> nonstd::observer_ptr<T> get_data_safe()
     {
-        if (data.count(name) == 0)
-            store_data<T>(std::make_unique<T>(), name);
-        return get_data<T>(name);
+        return get_data_safe<T>(get_type_slot<T>());
+    }
+
+    template<class T> nonstd::observer_ptr<T> get_data_safe(const std::string& name)
+    {
+        return get_data_safe<T>(wf_get_custom_data_slot(name));
     }
 
     /* Retrieve custom data stored with the given name. If no such
      * data exists, NULL is returned */
-    template<class T> nonstd::observer_ptr<T> get_data(
-        std::string name = typeid(T).name())
+    template<class T> nonstd::observer_ptr<T> get_data()
     {
-        return nonstd::make_observer(dynamic_cast<T*> (data[name].get()));
+        return get_data<T>(get_type_slot<T>());
+    }
+
+    template<class T> nonstd::observer_ptr<T> get_data(const std::string& name)
+    {
+        return get_data<T>(wf_get_custom_data_slot(name));
     }
 
     /* Assigns the given data to the given name */
+    template<class T> void store_data(std::unique_ptr<T> stored_data)
+    {
+        store_data<T>(std::move(stored_data), get_type_slot<T>());
+    }
+
     template<class T> void store_data(std::unique_ptr<T> stored_data,
-        std::string name = typeid(T).name())
+        const std::string& name)
     {
-        data[name] = std::move(stored_data);
+        store_data<T>(std::move(stored_data), wf_get_custom_data_slot(name));
     }
 
     /* Returns true if there is saved data under the given name */
     template<class T> bool has_data()
     {
-        return has_data(typeid(T).name());
+        return has_data(get_type_slot<T>());
     }
 
     /* Returns if there is saved data with the given name */
-    bool has_data(std::string name)
+    bool has_data(const std::string& name)
     {
-        return data.count(name);
+        return has_data(wf_get_custom_data_slot(name));
     }
 
     /* Remove the saved data under the given name */
-    void erase_data(std::string name)
+    void erase_data(const std::string& name)
     {
-        data.erase(name);
+        erase_data(wf_get_custom_data_slot(name));
     }
 
     /* Remove the saved data for the type T */
     template<class T> void erase_data()
     {
-        erase_data(typeid(T).name());
+        erase_data(get_type_slot<T>());
     }
 
     /* Erase the saved data from the store and return the pointer */
-    template<class T> std::unique_ptr<T> release_data(std::string name = typeid(T).name())
+    template<class T> std::unique_ptr<T> release_data()
     {
-        if (data.count(name) == 0)
-            return {nullptr};
-
-        auto stored = std::move(data[name]);
-        data.erase(name);
+        return release_data<T>(get_type_slot<T>());
+    }
 
-        return std::unique_ptr<T> (dynamic_cast<T*>(stored.release()));
+    template<class T> std::unique_ptr<T> release_data(const std::string& name)
+    {
+        return release_data<T>(wf_get_custom_data_slot(name));
     }
 
     protected:
@@ -133,7 +206,99 @@ class wf_object_base : public wf_signal_provider_t
     }
 
     uint32_t object_id;
-    std::unordered_map<std::string, std::unique_ptr<wf_custom_data_t>> data;
+
+    private:
+    struct custom_data_slot_t
+    {
+        std::unique_ptr<wf_custom_data_t> data;
+        /* The type the data was stored as, lets lookups of the same type
+         * skip the dynamic_cast */
+        const std::type_info *type = nullptr;
+    };
+
+    /* Indexed by slot, grows up to the largest slot used on this object */
+    std::vector<custom_data_slot_t> data;
+
+    /* Plugins are separate shared objects, so the slot of a type is assigned
+     * by core, and each plugin only caches it */
+    template<class T> static wf_custom_data_slot_id get_type_slot()
+    {
+        static const wf_custom_data_slot_id slot =
+            wf_get_custom_data_slot(typeid(T).name());
+        return slot;
+    }
+
+    custom_data_slot_t *find_slot(wf_custom_data_slot_id slot)
+    {
+        if (slot >= data.size() || !data[slot].data)
+            return nullptr;
+
+        return &data[slot];
+    }
+
+    template<class T> T* cast_slot(custom_data_slot_t& slot)
+    {
+        if (*slot.type == typeid(T))
+            return static_cast<T*> (slot.data.get());
+
+        return dynamic_cast<T*> (slot.data.get());
+    }
+
+    template<class T> nonstd::observer_ptr<T> get_data_safe(wf_custom_data_slot_id slot)
+    {
+        if (!find_slot(slot))
+            store_data<T>(std::make_unique<T>(), slot);
+
+        return get_data<T>(slot);
+    }
+
+    template<class T> nonstd::observer_ptr<T> get_data(wf_custom_data_slot_id slot)
+    {
+        auto stored = find_slot(slot);
+        return nonstd::make_observer(stored ? cast_slot<T>(*stored) : nullptr);
+    }
+
+    template<class T> void store_data(std::unique_ptr<T> stored_data,
+        wf_custom_data_slot_id slot)
+    {
+        if (slot >= data.size())
+            data.resize(slot + 1);
+
+        /* Reset the slot before the old data is destroyed */
+        auto old = std::move(data[slot].data);
+        data[slot].data = std::move(stored_data);
+        data[slot].type = &typeid(T);
+    }
+
+    bool has_data(wf_custom_data_slot_id slot)
+    {
+        return find_slot(slot);
+    }
+
+    void erase_data(wf_custom_data_slot_id slot)
+    {
+        if (slot < data.size())
+        {
+            auto old = std::move(data[slot].data);
+            data[slot].type = nullptr;
+        }
+    }
+
+    template<class T> std::unique_ptr<T> release_data(wf_custom_data_slot_id slot)
+    {
+        auto stored = find_slot(slot);
+        if (!stored)
+            return {nullptr};
+
+        auto result = cast_slot<T>(*stored);
+        if (!result)
+            return {nullptr};
+
+        stored->data.release();
+        stored->type = nullptr;
+
+        return std::unique_ptr<T> (result);
+    }
 };
 
 #endif /* end of include guard: OBJECT_HPP */
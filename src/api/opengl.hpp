@@ -16,6 +16,8 @@ extern "C"
 #define GLM_FORCE_RADIANS
 #include <glm/glm.hpp>
 #include <map>
+#include <vector>
+#include <functional>
 
 class wayfire_output;
 using wf_geometry = wlr_box;
@@ -165,16 +167,61 @@ namespace OpenGL
                                     glm::vec4 color = glm::vec4(1.f),
                                     uint32_t bits = 0);
 
+    /* Batched version of render_transformed_texture().
+     *
+     * All quads added between begin_batch() and flush() use the same texture,
+     * transform, color and bits, and are drawn with a single draw call from a
+     * persistent vertex buffer. Instead of setting a scissor box for each
+     * damaged rectangle, add one quad per rectangle with the clip argument:
+     * the quad geometry and texture coordinates are then cut to the clip box,
+     * which is in the same coordinate system as the quad geometry.
+     *
+     * Starting a new batch or calling render_end() flushes the current one. */
+    void begin_batch(GLuint tex, glm::mat4 transform = glm::mat4(1.0),
+        glm::vec4 color = glm::vec4(1.f), uint32_t bits = 0);
+    void add_quad(const gl_geometry& g, const gl_geometry& texg);
+    void add_quad(const gl_geometry& g, const gl_geometry& texg,
+        const gl_geometry& clip);
+    void flush();
+
     /* Reads the shader source from the given file and compiles it */
     GLuint load_shader(std::string path, GLuint type);
     /* Compiles the given shader source */
     GLuint compile_shader(std::string source, GLuint type);
 
-    /* Create a very simple gl program from the given shader sources */
+    /* A shader stage besides the vertex and the fragment shader, for ex.
+     * GL_GEOMETRY_SHADER */
+    struct shader_stage_t
+    {
+        GLenum type;
+        std::string source;
+    };
+
+    /* Called after the shaders are attached to the program, and before it is
+     * linked, for ex. to call glTransformFeedbackVaryings() */
+    using pre_link_hook_t = std::function<void(GLuint program)>;
+
+    /* Create a gl program from the given shader sources, returns -1 if the
+     * shaders can't be compiled or linked.
+     *
+     * Programs with the same sources are shared, so the program must be freed
+     * with destroy_program() instead of glDeleteProgram(). Linked programs are
+     * also cached on disk, under $XDG_CACHE_HOME/wayfire/programs.
+     *
+     * The program is looked up by its sources, so a pre_link hook needs a
+     * pre_link_key which identifies what it does, for ex. the names of the
+     * varyings it sets. The hook isn't called if the program is found. */
     GLuint create_program_from_source(std::string vertex_source,
-        std::string frag_source);
-    /* Same as create_program_from_source, but loads shaders from files */
-    GLuint create_program(std::string vertex_path, std::string frag_path);
+        std::string frag_source,
+        std::vector<shader_stage_t> extra_stages = {},
+        pre_link_hook_t pre_link = nullptr, std::string pre_link_key = "");
+    /* Same as create_program_from_source, but loads shaders from files. The
+     * source of the extra stages is the path of their file, too */
+    GLuint create_program(std::string vertex_path, std::string frag_path,
+        std::vector<shader_stage_t> extra_stages = {});
+    /* Free a program created with create_program_from_source() or
+     * create_program() */
+    void destroy_program(GLuint program);
 }
 
 /* utils */
@@ -6,6 +6,8 @@
 #include "object.hpp"
 #include "util.hpp"
 #include <list>
+#include <cstdio>
+#include <unordered_set>
 
 /* Emitted whenever a workspace stream is being started or stopped */
 struct wf_stream_signal : public signal_data
@@ -26,6 +28,8 @@ struct wf_workspace_stream
     wf_framebuffer_base buffer;
     bool running = false;
 
+    /* The scale at which the stream buffer was last rendered. The buffer has
+     * the size of the output multiplied by this scale */
     float scale_x, scale_y;
     /* The background color of the stream, when there is no view above it */
     wf_color background = {0.0f, 0.0f, 0.0f, 1.0f};
@@ -51,7 +55,37 @@ using post_hook_t = std::function<void(const wf_framebuffer_base& source,
  * example plugin is cube. Rendering must happen to the indicated framebuffer */
 using render_hook_t = std::function<void(const wf_framebuffer& fb)>;
 
+/* The phases of a single output frame, as timed by the render manager */
+enum wf_frame_phase
+{
+    WF_FRAME_PHASE_PRE_EFFECTS     = 0,
+    WF_FRAME_PHASE_MAKE_CURRENT    = 1,
+    WF_FRAME_PHASE_RENDER          = 2,
+    WF_FRAME_PHASE_OVERLAY_EFFECTS = 3,
+    WF_FRAME_PHASE_SW_CURSORS      = 4,
+    WF_FRAME_PHASE_POST_EFFECTS    = 5,
+    WF_FRAME_PHASE_SWAP            = 6,
+    WF_FRAME_PHASE_POST_PAINT      = 7,
+    /* The whole frame, from the start of paint() to the end of post_paint() */
+    WF_FRAME_PHASE_TOTAL           = 8,
+    WF_FRAME_PHASE_COUNT           = 9
+};
+
+class wayfire_view_t;
+class wayfire_surface_t;
 struct wf_output_damage;
+struct wf_frame_stats;
+
+struct wf_damage_simplification_stats
+{
+    /* Frames whose damage had too many boxes and was simplified */
+    uint64_t simplified_frames = 0;
+    /* Total number of boxes before and after simplification */
+    uint64_t rects_before = 0, rects_after = 0;
+    /* Total area in pixels which was added to the damage */
+    uint64_t overdraw_area = 0;
+};
+
 class render_manager : public wf_signal_provider_t
 {
     friend void redraw_idle_cb(void *data);
@@ -68,6 +102,7 @@ class render_manager : public wf_signal_provider_t
 
         wf_region frame_damage;
         std::unique_ptr<wf_output_damage> output_damage;
+        std::unique_ptr<wf_frame_stats> frame_stats;
 
         std::vector<std::vector<wf_workspace_stream>> output_streams;
         wf_workspace_stream *current_ws_stream = nullptr;
@@ -86,6 +121,18 @@ class render_manager : public wf_signal_provider_t
         int output_inhibit = 0;
         render_hook_t renderer;
 
+        /* Maximal rate (per second) of frame callbacks for views which are
+         * completely covered by other views, 0 to disable throttling */
+        wf_option occluded_frame_rate;
+        std::unordered_set<wayfire_view_t*> get_occluded_views();
+
+        /* If the frame damage has more than this many boxes, it is replaced
+         * by a slightly bigger region with at most this many boxes, so that
+         * fewer scissored draws are needed. 0 disables simplification */
+        wf_option max_damage_rects;
+        wf_damage_simplification_stats damage_stats;
+        void simplify_frame_damage();
+
         void paint();
         void post_paint();
 
@@ -142,9 +189,28 @@ class render_manager : public wf_signal_provider_t
         wf_framebuffer get_target_framebuffer() const;
 
         void workspace_stream_start(wf_workspace_stream *stream);
+        /* Render the damaged parts of the workspace to the stream buffer.
+         * scale_x and scale_y indicate how big the stream will be displayed,
+         * relative to the output size, so that a smaller buffer can be used */
         void workspace_stream_update(wf_workspace_stream *stream,
                 float scale_x = 1, float scale_y = 1);
         void workspace_stream_stop(wf_workspace_stream *stream);
+
+        /* Frame timing statistics. The render manager keeps the durations
+         * of the phases of the last rendered frames in a fixed-size buffer.
+         *
+         * Returns the given percentile (0..100) of the duration of the phase
+         * in microseconds, over the recorded frames, or 0 if there are none */
+        int64_t get_frame_time_percentile(wf_frame_phase phase, float percentile);
+        /* Returns how many frames are currently recorded */
+        size_t get_recorded_frames_count();
+        /* Print the frame timing statistics of this output to the given file.
+         * They are printed regardless of the log level */
+        void dump_frame_stats(FILE *out = stderr);
+
+        /* Returns how the frame damage was simplified since the output was
+         * created */
+        wf_damage_simplification_stats get_damage_simplification_stats();
 };
 
 #endif
@@ -25,6 +25,10 @@ using view_set_parent_signal = _view_signal;
 using move_request_signal    = _view_signal;
 using title_changed_signal   = _view_signal;
 using app_id_changed_signal  = _view_signal;
+/* The view was moved to another layer, or removed from all layers */
+using layer_changed_signal   = _view_signal;
+/* A transformer was added to or removed from the view */
+using transformer_changed_signal = _view_signal;
 
 struct resize_request_signal : public _view_signal
 {
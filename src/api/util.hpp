@@ -89,17 +89,50 @@ struct wf_region
     wf_region& operator ^= (const wlr_box& box);
     wf_region& operator ^= (const wf_region& other);
 
+    /* Get the region as a pixman region, which can also be modified */
     pixman_region32_t *to_pixman();
 
     const pixman_box32_t* begin() const;
     const pixman_box32_t* end() const;
 
+    /* Regions with at most this many boxes are stored inline, without
+     * allocating a pixman region */
+    static constexpr int small_region_boxes = 4;
+
     private:
-    pixman_region32_t _region;
+    enum region_op_t
+    {
+        REGION_UNION,
+        REGION_INTERSECT,
+        REGION_SUBTRACT,
+    };
+
+    /* The number of boxes in small_boxes, or -1 if the region is stored in
+     * _region. The boxes are kept in the same y-x banded form pixman uses,
+     * so iterating over the region gives the same boxes in both cases */
+    mutable int small_count = 0;
+    pixman_box32_t small_boxes[small_region_boxes];
+    /* Initialized only when small_count is -1 */
+    mutable pixman_region32_t _region;
+
     /* Returns a const-casted pixman_region32_t*, useful in const operators
      * where we use this->_region as only source for calculations, but pixman
-     * won't let us pass a const pixman_region32_t* */
+     * won't let us pass a const pixman_region32_t*.
+     * Small regions are converted to a pixman region first. */
     pixman_region32_t* unconst() const;
+
+    /* Set the region to the given boxes, which must be in y-x banded form */
+    void set_boxes(const pixman_box32_t *boxes, int count);
+    /* Set the region to the contents of the given pixman region, and take
+     * ownership of it */
+    void take_pixman(pixman_region32_t *region);
+    /* Free the pixman region, if any, leaving an empty small region */
+    void release_pixman();
+    /* Store the region inline again, if it is small enough */
+    void shrink();
+
+    /* Set the region to a op b, either of which may be this region */
+    void set_op_result(const wf_region& a, const wf_region& b, region_op_t op);
 };
 
 wlr_box wlr_box_from_pixman_box(const pixman_box32_t& box);
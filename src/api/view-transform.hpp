@@ -4,6 +4,7 @@
 #define GLM_FORCE_RADIANS
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <array>
 
 #include "view.hpp"
 #include "opengl.hpp"
@@ -59,7 +60,19 @@ class wf_view_transformer_t
         virtual void render_box(uint32_t src_tex, wlr_box src_box,
             wlr_box scissor_box, const wf_framebuffer& target_fb) {}
 
+        /* Views keep the output of their transformers between frames and
+         * render again only the parts which the view damaged.
+         *
+         * Transformers whose output changes without the view being damaged,
+         * for ex. when their parameters change, must call damage() or
+         * override get_generation(), so that their output is rendered again */
+        void damage() { ++generation; }
+        virtual uint64_t get_generation() { return generation; }
+
         virtual ~wf_view_transformer_t() {}
+
+    protected:
+        uint64_t generation = 0;
 };
 
 enum
@@ -87,8 +100,25 @@ class wf_2D_view : public wf_view_transformer_t
         virtual wf_point local_to_transformed_point(wf_geometry view, wf_point point);
         virtual wf_point transformed_to_local_point(wf_geometry view, wf_point point);
 
+        /* Draws all damaged rectangles with a single batch, unless the view
+         * is rotated */
+        virtual void render_with_damage(uint32_t src_tex, wlr_box src_box,
+            const wf_region& damage, const wf_framebuffer& target_fb);
+
         virtual void render_box(uint32_t src_tex, wlr_box src_box,
             wlr_box scissor_box, const wf_framebuffer& target_fb);
+
+        /* The parameters are set directly, so it checks if they changed */
+        virtual uint64_t get_generation();
+
+    private:
+        /* Calculate the quad and the transform to render src_box with. The
+         * quad is in a coordinate system centered on the framebuffer, with
+         * y pointing up, and offset by the returned translation */
+        glm::mat4 get_render_transform(wlr_box src_box,
+            const wf_framebuffer& fb, gl_geometry& quad, glm::vec2& translation);
+
+        std::array<float, 6> last_params = {0, 1, 1, 0, 0, 1};
 };
 
 /* Those are centered relative to the view's bounding box */
@@ -114,9 +144,17 @@ class wf_3D_view : public wf_view_transformer_t
         virtual void render_box(uint32_t src_tex, wlr_box src_box,
             wlr_box scissor_box, const wf_framebuffer& target_fb);
 
+        /* The parameters are set directly, so it checks if they changed */
+        virtual uint64_t get_generation();
+
         static const float fov; // PI / 8
         static glm::mat4 default_view_matrix();
         static glm::mat4 default_proj_matrix();
+
+    private:
+        glm::mat4 last_view_proj{1.0}, last_translation{1.0},
+                  last_rotation{1.0}, last_scaling{1.0};
+        glm::vec4 last_color{1, 1, 1, 1};
 };
 
 /* create a matrix which corresponds to the inverse of the given transform */
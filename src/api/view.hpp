@@ -192,6 +192,12 @@ class wayfire_view_t : public wayfire_surface_t, public wf_object_base
 
         // the last buffer_age of this view for which the buffer was made
         int64_t last_offscreen_buffer_age = -1;
+        // offset of the WM geometry inside the buffer when it was last made
+        wf_point last_offscreen_wm_offset = {0, 0};
+        // whether the whole offscreen buffer was redrawn since the last render_fb()
+        bool offscreen_buffer_redrawn = true;
+        // damage since the last render_fb(), relative to the WM geometry
+        wf_region transformer_damage;
 
         struct transform_t : public noncopyable_t
         {
@@ -199,6 +205,16 @@ class wayfire_view_t : public wayfire_surface_t, public wf_object_base
             std::unique_ptr<wf_view_transformer_t> transform;
             wf_framebuffer fb;
 
+            /* Unique for each transform, 0 stands for the view's snapshot */
+            uint64_t serial;
+
+            /* The input of the transformer, its output box and generation the
+             * last time fb was rendered. fb is kept across frames and only the
+             * damaged parts are rendered again, as long as they don't change */
+            bool fb_valid = false;
+            uint64_t last_source = 0, last_generation = 0;
+            wf_geometry last_input_box, last_output_box;
+
             transform_t();
             ~transform_t();
         };
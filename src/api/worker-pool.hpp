@@ -0,0 +1,75 @@
+#ifndef WORKER_POOL_HPP
+#define WORKER_POOL_HPP
+
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <vector>
+#include <deque>
+
+namespace wf
+{
+    /* A fixed set of worker threads, shared by core and all plugins.
+     *
+     * The threads are started the first time the pool is used and sleep until
+     * there is work to do, so that per-frame jobs don't have to create and
+     * join threads each time. */
+    class worker_pool_t
+    {
+        public:
+        /* Returns the compositor-wide pool */
+        static worker_pool_t& get();
+
+        /* Split [0, count) into chunks of chunk_size elements and call
+         * func(start, end) for each chunk. Chunks are picked up by the idle
+         * workers and by the calling thread as soon as they are free, so
+         * uneven chunks don't leave threads idle.
+         *
+         * Returns after all chunks have been processed. func must be
+         * thread-safe. Must be called only from the main thread, and not from
+         * inside func. */
+        void parallel_for(int count, int chunk_size,
+            const std::function<void(int, int)>& func);
+
+        /* Run task on one of the workers and return immediately. Tasks are
+         * started in the order they were submitted. A worker which runs a
+         * task doesn't help with parallel_for() until the task is done, so
+         * long tasks, like decoding big images, make parallel_for() slower
+         * while they run.
+         *
+         * Tasks which haven't started when wayfire exits are dropped. */
+        void run_async(std::function<void()> task);
+
+        /* Number of threads which execute parallel_for() jobs, including
+         * the caller */
+        int get_concurrency();
+
+        ~worker_pool_t();
+
+        private:
+        worker_pool_t();
+
+        std::vector<std::thread> workers;
+
+        std::mutex mutex;
+        std::condition_variable work_available, job_finished;
+        bool shutting_down = false;
+
+        /* The current parallel_for() job, valid while it is not null */
+        const std::function<void(int, int)> *job = nullptr;
+        int job_count, job_chunk_size;
+        uint64_t job_serial = 0;
+        /* Workers which have joined the current job and are not done yet */
+        int job_workers = 0;
+        std::atomic<int> next_chunk;
+
+        std::deque<std::function<void()>> tasks;
+
+        void worker_main();
+        void run_chunks();
+    };
+}
+
+#endif /* end of include guard: WORKER_POOL_HPP */
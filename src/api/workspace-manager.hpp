@@ -52,9 +52,20 @@ class workspace_manager
          * the workspace. See view.hpp for a distinction between wm, output and boundingbox geometry */
         virtual std::vector<wayfire_view>
             get_views_on_workspace(std::tuple<int, int> ws, uint32_t layer_mask, bool wm_only) = 0;
+
+        /* same as get_views_on_workspace(), but doesn't copy the list. The
+         * returned list may be shared with other callers and is never modified,
+         * so it stays valid for as long as it is held, even if the views change */
+        virtual std::shared_ptr<const std::vector<wayfire_view>>
+            get_views_on_workspace_shared(std::tuple<int, int> ws, uint32_t layer_mask, bool wm_only) = 0;
         virtual void for_each_view(view_callback_proc_t call, uint32_t layers_mask) = 0;
         virtual void for_each_view_reverse(view_callback_proc_t call, uint32_t layers_mask) = 0;
 
+        /* returns the views in the given layers whose bounding box contains
+         * the given point (in output-local coordinates), topmost view first */
+        virtual std::vector<wayfire_view>
+            get_views_at(wf_point point, uint32_t layer_mask) = 0;
+
         /* TODO: split this api? */
 
         /* if layer_mask == 0, then we remove the view from its layer,
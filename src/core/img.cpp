@@ -1,6 +1,8 @@
 #include "img.hpp"
 #include "opengl.hpp"
 #include "debug.hpp"
+#include "core.hpp"
+#include "worker-pool.hpp"
 
 #ifdef BUILD_WITH_IMAGEIO
 #include <png.h>
@@ -10,15 +12,21 @@
 
 #include <stdint.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 #include <cstdio>
 #include <iostream>
+#include <cctype>
 #include <unordered_map>
 #include <functional>
+#include <algorithm>
+#include <mutex>
+#include <deque>
 
 #define TEXTURE_LOAD_ERROR 0
 
 namespace image_io {
-    using Loader = std::function<bool(const char *, GLuint)>;
+    using Loader = std::function<bool(const char *, image_t&)>;
     using Writer = std::function<void(const char *name, uint8_t *pixels, unsigned long, unsigned long)>;
     namespace {
         std::unordered_map<std::string, Loader> loaders;
@@ -28,24 +36,42 @@ namespace image_io {
 #ifdef BUILD_WITH_IMAGEIO
     /* All backend functions are taken from the internet.
      * If you want to be credited, contact me */
-    bool texture_from_png(const char *filename, GLuint target)
+    bool image_from_png(const char *filename, image_t& image)
     {
         FILE *fp = fopen(filename, "rb");
+        if (!fp)
+        {
+            log_error("failed to read PNG file %s", filename);
+            return false;
+        }
+
         int width, height;
         png_byte color_type;
         png_byte bit_depth;
-        png_bytep *row_pointers;
+        png_bytep * volatile row_pointers = nullptr;
 
         png_structp png = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
         if(!png)
+        {
+            fclose(fp);
             return false;
+        }
 
         png_infop infos = png_create_info_struct(png);
         if(!infos)
+        {
+            png_destroy_read_struct(&png, NULL, NULL);
+            fclose(fp);
             return false;
+        }
 
         if(setjmp(png_jmpbuf(png)))
+        {
+            png_destroy_read_struct(&png, &infos, NULL);
+            delete[] row_pointers;
+            fclose(fp);
             return false;
+        }
 
         png_init_io(png, fp);
         png_read_info(png, infos);
@@ -80,21 +106,22 @@ namespace image_io {
 
         png_read_update_info(png, infos);
 
-        row_pointers = new png_bytep[height];
-        png_byte *data = new png_byte[height * png_get_rowbytes(png, infos)];
+        auto stride = png_get_rowbytes(png, infos);
+        image.width = width;
+        image.height = height;
+        image.format = GL_RGBA;
+        image.pixels.resize(height * stride);
 
+        row_pointers = new png_bytep[height];
         for(int i = 0; i < height; i++)
         {
-            row_pointers[i] = data + i * png_get_rowbytes(png, infos);
+            row_pointers[i] = image.pixels.data() + i * stride;
         }
 
         png_read_image(png, row_pointers);
-        GL_CALL(glTexImage2D(target, 0, GL_RGBA, width, height, 0,
-                             GL_RGBA, GL_UNSIGNED_BYTE, (GLvoid *) data));
 
         png_destroy_read_struct(&png, &infos, NULL);
         delete[] row_pointers;
-        delete[] data;
 
         fclose(fp);
         return true;
@@ -144,61 +171,84 @@ namespace image_io {
         delete[] rows;
     }
 
-    bool texture_from_jpeg(const char *FileName, GLuint target)
+    bool image_from_jpeg(const char *FileName, image_t& image)
     {
-        unsigned long data_size;
         unsigned char *rowptr[1];
-        unsigned char *jdata;
         struct jpeg_decompress_struct infot;
         struct jpeg_error_mgr err;
 
         std::FILE *file = fopen(FileName, "rb");
-        infot.err = jpeg_std_error(& err);
-        jpeg_create_decompress(&infot);
-
         if(!file)
         {
             log_error("failed to read JPEG file %s", FileName);
             return false;
         }
 
+        infot.err = jpeg_std_error(& err);
+        jpeg_create_decompress(&infot);
+
         jpeg_stdio_src(&infot, file);
         jpeg_read_header(&infot, TRUE);
+        /* Grayscale images are converted too, we upload only RGB */
+        infot.out_color_space = JCS_RGB;
         jpeg_start_decompress(&infot);
 
-        data_size = infot.output_width * infot.output_height * 3;
+        image.width = infot.output_width;
+        image.height = infot.output_height;
+        image.format = GL_RGB;
+        image.pixels.resize(infot.output_width * infot.output_height * 3);
 
-        jdata = new unsigned char[data_size];
         while (infot.output_scanline < infot.output_height) {
-            rowptr[0] = (unsigned char *)jdata +  3* infot.output_width * infot.output_scanline;
+            rowptr[0] = image.pixels.data() + 3 * infot.output_width * infot.output_scanline;
             jpeg_read_scanlines(&infot, rowptr, 1);
         }
 
         jpeg_finish_decompress(&infot);
-
-        GL_CALL(glTexImage2D(target, 0, GL_RGB,
-                infot.output_width, infot.output_height,
-                0, GL_RGB, GL_UNSIGNED_BYTE, jdata));
+        jpeg_destroy_decompress(&infot);
 
         fclose(file);
-        delete[] jdata;
-
         return true;
     }
 #endif
 
-    bool load_from_file(std::string name, GLuint target)
+    namespace
     {
-        if (access(name.c_str(), F_OK) == -1) {
+        /* Decoded images which are still used by someone */
+        struct cached_image_t
+        {
+            timespec mtime;
+            off_t size;
+            std::weak_ptr<const image_t> image;
+        };
+
+        struct image_cache_t
+        {
+            std::mutex mutex;
+            std::unordered_map<std::string, cached_image_t> images;
+        };
+
+        /* The async workers may still use it while wayfire exits, so it is
+         * never freed */
+        image_cache_t& get_image_cache()
+        {
+            static auto cache = new image_cache_t;
+            return *cache;
+        }
+    }
+
+    std::shared_ptr<const image_t> decode_file(std::string name)
+    {
+        struct stat st;
+        if (stat(name.c_str(), &st) == -1) {
             if (!name.empty())
                 log_error("%s() cannot access \"%s\"", __func__, name.c_str());
-            return false;
+            return nullptr;
         }
 
         int len = name.length();
         if (len < 4 || name[len - 4] != '.') {
-            log_error("load_from_file() called with file without extension or with invalid extension!");
-            return false;
+            log_error("decode_file() called with file without extension or with invalid extension!");
+            return nullptr;
         }
 
         auto ext = name.substr(len - 3, 3);
@@ -207,11 +257,322 @@ namespace image_io {
 
         auto it = loaders.find(ext);
         if (it == loaders.end()) {
-            log_error("load_from_file() called with unsupported extension %s", ext.c_str());
+            log_error("decode_file() called with unsupported extension %s", ext.c_str());
+            return nullptr;
+        }
+
+        auto& cache = get_image_cache();
+        {
+            std::lock_guard<std::mutex> lock(cache.mutex);
+            auto cached = cache.images.find(name);
+            if (cached != cache.images.end() &&
+                cached->second.mtime.tv_sec == st.st_mtim.tv_sec &&
+                cached->second.mtime.tv_nsec == st.st_mtim.tv_nsec &&
+                cached->second.size == st.st_size)
+            {
+                if (auto image = cached->second.image.lock())
+                    return image;
+            }
+        }
+
+        auto image = std::make_shared<image_t>();
+        if (!it->second(name.c_str(), *image))
+            return nullptr;
+
+        std::lock_guard<std::mutex> lock(cache.mutex);
+        /* Forget the images which are no longer used */
+        for (auto cached = cache.images.begin(); cached != cache.images.end();)
+        {
+            if (cached->second.image.expired())
+                cached = cache.images.erase(cached);
+            else
+                ++cached;
+        }
+
+        cache.images[name] = {st.st_mtim, st.st_size, image};
+        return image;
+    }
+
+    void upload(const image_t& image, GLuint target)
+    {
+        /* RGB rows are not necessarily aligned to 4 bytes */
+        GL_CALL(glPixelStorei(GL_UNPACK_ALIGNMENT, 1));
+        GL_CALL(glTexImage2D(target, 0, image.format, image.width, image.height,
+                0, image.format, GL_UNSIGNED_BYTE, image.pixels.data()));
+        GL_CALL(glPixelStorei(GL_UNPACK_ALIGNMENT, 4));
+    }
+
+    bool load_from_file(std::string name, GLuint target)
+    {
+        auto image = decode_file(name);
+        if (!image)
             return false;
-        } else {
-            return it->second(name.c_str(), target);
+
+        upload(*image, target);
+        return true;
+    }
+
+    /* Asynchronous loading: requests are decoded by the core worker pool,
+     * which then wakes up the main loop through a pipe, and the callbacks are
+     * called from there. Requests for the same file share a single decode. */
+    namespace
+    {
+        struct async_load_t
+        {
+            std::string name;
+            std::vector<std::pair<uint32_t, load_callback_t>> callbacks;
+            std::shared_ptr<const image_t> result;
+        };
+
+        /* Used only from the main thread */
+        std::unordered_map<std::string, std::shared_ptr<async_load_t>> loads_in_flight;
+        std::shared_ptr<async_load_t> dispatched_load;
+        uint32_t last_load_id = 0;
+
+        /* Shared with the workers. Decodes which are still running when
+         * wayfire exits may use it, so it is never freed */
+        struct finished_queue_t
+        {
+            std::mutex mutex;
+            std::deque<std::shared_ptr<async_load_t>> jobs;
+            int wakeup_fds[2] = {-1, -1};
+        };
+
+        finished_queue_t *finished_queue = nullptr;
+
+        void decode_async(std::shared_ptr<async_load_t> job)
+        {
+            job->result = decode_file(job->name);
+
+            std::lock_guard<std::mutex> lock(finished_queue->mutex);
+            finished_queue->jobs.push_back(job);
+
+            /* If the pipe is full, the main loop is going to wake up anyway */
+            char c = 0;
+            if (write(finished_queue->wakeup_fds[1], &c, 1) < 0) {}
+        }
+
+        int handle_finished_jobs(int fd, uint32_t mask, void *data)
+        {
+            char buf[64];
+            while (read(fd, buf, sizeof(buf)) > 0);
+
+            std::deque<std::shared_ptr<async_load_t>> finished;
+            {
+                std::lock_guard<std::mutex> lock(finished_queue->mutex);
+                std::swap(finished, finished_queue->jobs);
+            }
+
+            for (auto& job : finished)
+            {
+                loads_in_flight.erase(job->name);
+
+                /* A callback may cancel the others, so cancel_load() must
+                 * still find them */
+                dispatched_load = job;
+                while (!job->callbacks.empty())
+                {
+                    auto callback = std::move(job->callbacks.front().second);
+                    job->callbacks.erase(job->callbacks.begin());
+                    callback(job->result);
+                }
+            }
+
+            dispatched_load = nullptr;
+            return 0;
+        }
+
+        bool init_finished_queue()
+        {
+            if (finished_queue)
+                return true;
+
+            int fds[2];
+            if (pipe2(fds, O_CLOEXEC | O_NONBLOCK) == -1)
+            {
+                log_error("failed to create image loading pipe");
+                return false;
+            }
+
+            finished_queue = new finished_queue_t;
+            finished_queue->wakeup_fds[0] = fds[0];
+            finished_queue->wakeup_fds[1] = fds[1];
+
+            wl_event_loop_add_fd(core->ev_loop, fds[0], WL_EVENT_READABLE,
+                handle_finished_jobs, NULL);
+
+            return true;
+        }
+    }
+
+    uint32_t load_from_file_async(std::string name, load_callback_t callback)
+    {
+        if (!init_finished_queue())
+        {
+            /* Still deliver the result, but decode synchronously */
+            callback(decode_file(name));
+            return 0;
+        }
+
+        uint32_t id = ++last_load_id;
+
+        auto& job = loads_in_flight[name];
+        if (job)
+        {
+            job->callbacks.emplace_back(id, callback);
+            return id;
+        }
+
+        job = std::make_shared<async_load_t>();
+        job->name = name;
+        job->callbacks.emplace_back(id, callback);
+
+        auto decoded_job = job;
+        wf::worker_pool_t::get().run_async([=] () { decode_async(decoded_job); });
+
+        return id;
+    }
+
+    /* Shared textures, kept while someone holds a reference to them */
+    namespace
+    {
+        struct cached_texture_t
+        {
+            timespec mtime;
+            off_t size;
+            std::weak_ptr<const texture_t> texture;
+        };
+
+        /* Keyed by target and file name. Used only from the main thread */
+        std::unordered_map<std::string, cached_texture_t> textures;
+
+        std::string get_texture_key(const std::string& name, GLenum target)
+        {
+            return std::to_string(target) + ":" + name;
+        }
+
+        std::shared_ptr<const texture_t> find_texture(const std::string& key,
+            const struct stat& st)
+        {
+            auto cached = textures.find(key);
+            if (cached == textures.end() ||
+                cached->second.mtime.tv_sec != st.st_mtim.tv_sec ||
+                cached->second.mtime.tv_nsec != st.st_mtim.tv_nsec ||
+                cached->second.size != st.st_size)
+            {
+                return nullptr;
+            }
+
+            return cached->second.texture.lock();
         }
+
+        std::shared_ptr<const texture_t> create_texture(const image_t& image,
+            GLenum target)
+        {
+            auto texture = std::make_shared<texture_t>();
+            texture->target = target;
+            texture->width = image.width;
+            texture->height = image.height;
+
+            OpenGL::render_begin();
+            GL_CALL(glGenTextures(1, &texture->tex));
+            GL_CALL(glBindTexture(target, texture->tex));
+
+            if (target == GL_TEXTURE_CUBE_MAP)
+            {
+                for (int i = 0; i < 6; i++)
+                    upload(image, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i);
+
+                GL_CALL(glTexParameteri(target, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE));
+            } else
+            {
+                upload(image, target);
+            }
+
+            GL_CALL(glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR));
+            GL_CALL(glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
+            GL_CALL(glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
+            GL_CALL(glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
+
+            GL_CALL(glBindTexture(target, 0));
+            OpenGL::render_end();
+
+            return texture;
+        }
+    }
+
+    texture_t::~texture_t()
+    {
+        OpenGL::render_begin();
+        GL_CALL(glDeleteTextures(1, &tex));
+        OpenGL::render_end();
+    }
+
+    uint32_t load_texture_async(std::string name, GLenum target,
+        texture_callback_t callback)
+    {
+        struct stat st;
+        if (stat(name.c_str(), &st) == -1)
+        {
+            /* decode_file() reports the error */
+            return load_from_file_async(name,
+                [=] (std::shared_ptr<const image_t>) { callback(nullptr); });
+        }
+
+        auto key = get_texture_key(name, target);
+        if (auto texture = find_texture(key, st))
+        {
+            callback(texture);
+            return 0;
+        }
+
+        return load_from_file_async(name,
+            [=] (std::shared_ptr<const image_t> image)
+            {
+                if (!image)
+                {
+                    callback(nullptr);
+                    return;
+                }
+
+                /* The callbacks of requests which share the decode get the
+                 * same texture */
+                auto texture = find_texture(key, st);
+                if (!texture)
+                {
+                    texture = create_texture(*image, target);
+
+                    /* Forget the textures which are no longer used */
+                    for (auto it = textures.begin(); it != textures.end();)
+                    {
+                        if (it->second.texture.expired())
+                            it = textures.erase(it);
+                        else
+                            ++it;
+                    }
+
+                    textures[key] = {st.st_mtim, st.st_size, texture};
+                }
+
+                callback(texture);
+            });
+    }
+
+    void cancel_load(uint32_t id)
+    {
+        auto remove_callback = [=] (async_load_t& job)
+        {
+            auto& callbacks = job.callbacks;
+            callbacks.erase(std::remove_if(callbacks.begin(), callbacks.end(),
+                    [=] (const auto& callback) { return callback.first == id; }),
+                callbacks.end());
+        };
+
+        if (dispatched_load)
+            remove_callback(*dispatched_load);
+
+        for (auto& job : loads_in_flight)
+            remove_callback(*job.second);
     }
 
     void write_to_file(std::string name, uint8_t *pixels, int w, int h, std::string type)
@@ -231,8 +592,8 @@ namespace image_io {
     {
         log_debug("init ImageIO");
 #ifdef BUILD_WITH_IMAGEIO
-        loaders["png"] = Loader(texture_from_png);
-        loaders["jpg"] = Loader(texture_from_jpeg);
+        loaders["png"] = Loader(image_from_png);
+        loaders["jpg"] = Loader(image_from_jpeg);
         writers["png"] = Writer(texture_to_png);
 #endif
     }
@@ -0,0 +1,29 @@
+#include "object.hpp"
+
+wf_signal_id wf_get_signal_id(const std::string& name)
+{
+    static std::unordered_map<std::string, wf_signal_id> ids;
+
+    auto it = ids.find(name);
+    if (it != ids.end())
+        return it->second;
+
+    wf_signal_id id = ids.size();
+    ids[name] = id;
+
+    return id;
+}
+
+wf_custom_data_slot_id wf_get_custom_data_slot(const std::string& name)
+{
+    static std::unordered_map<std::string, wf_custom_data_slot_id> slots;
+
+    auto it = slots.find(name);
+    if (it != slots.end())
+        return it->second;
+
+    wf_custom_data_slot_id slot = slots.size();
+    slots[name] = slot;
+
+    return slot;
+}
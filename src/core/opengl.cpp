@@ -1,4 +1,12 @@
 #include <fstream>
+#include <sstream>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include <cstring>
+#include <cerrno>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "opengl.hpp"
 #include "debug.hpp"
 #include "output.hpp"
@@ -43,6 +51,30 @@ namespace OpenGL
         GLuint position, uvPosition;
     } program;
 
+    /* Enough for a few hundred quads per frame before the storage is orphaned */
+    static const size_t min_vbo_size = 256 * 1024;
+
+    /* The quads of the current batch, see begin_batch() */
+    struct
+    {
+        /* Persistent vertex buffer, reused for all batches */
+        GLuint vbo = 0;
+        /* Size of the vertex buffer storage, in bytes */
+        size_t vbo_size = 0;
+        /* Where the vertices of the next batch are stored, in bytes. The
+         * buffer is used as a ring, see flush() */
+        size_t vbo_offset = 0;
+
+        GLuint tex;
+        glm::mat4 transform;
+        glm::vec4 color;
+        uint32_t bits;
+
+        /* Interleaved x, y, u, v for each vertex, 6 vertices per quad */
+        std::vector<GLfloat> vertices;
+        bool active = false;
+    } batch;
+
     GLuint compile_shader_from_file(std::string path, std::string source, GLuint type)
     {
         GLuint shader = GL_CALL(glCreateShader(type));
@@ -71,50 +103,372 @@ namespace OpenGL
         return compile_shader_from_file("internal", source, type);
     }
 
-    GLuint load_shader(std::string path, GLuint type)
+    /* Read the whole file into contents, returns false if it can't be read */
+    static bool read_file(const std::string& path, std::string& contents)
     {
-        std::fstream file(path, std::ios::in);
-        if(!file.is_open())
+        std::ifstream file(path, std::ios::in | std::ios::binary);
+        if (!file.is_open())
         {
             log_error("cannot open shader file %s", path.c_str());
-            return -1;
+            return false;
         }
 
-        std::string str, line;
-        while(std::getline(file, line))
-            str += line, str += '\n';
+        std::ostringstream stream;
+        stream << file.rdbuf();
+        contents = stream.str();
 
-        return compile_shader(str.c_str(), type);
+        return true;
     }
 
-    GLuint create_program_from_shaders(GLuint vertex_shader,
-        GLuint fragment_shader)
+    GLuint load_shader(std::string path, GLuint type)
+    {
+        std::string source;
+        if (!read_file(path, source))
+            return -1;
+
+        return compile_shader_from_file(path, source, type);
+    }
+
+    GLuint create_program_from_shaders(const std::vector<GLuint>& shaders,
+        const pre_link_hook_t& pre_link, bool retrievable)
     {
         auto result_program = GL_CALL(glCreateProgram());
-        GL_CALL(glAttachShader(result_program, vertex_shader));
-        GL_CALL(glAttachShader(result_program, fragment_shader));
+        for (auto shader : shaders)
+        {
+            GL_CALL(glAttachShader(result_program, shader));
+        }
+
+        if (retrievable)
+        {
+            GL_CALL(glProgramParameteri(result_program,
+                    GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE));
+        }
+
+        if (pre_link)
+            pre_link(result_program);
+
         GL_CALL(glLinkProgram(result_program));
 
         /* won't be really deleted until program is deleted as well */
-        GL_CALL(glDeleteShader(vertex_shader));
-        GL_CALL(glDeleteShader(fragment_shader));
+        for (auto shader : shaders)
+        {
+            GL_CALL(glDeleteShader(shader));
+        }
 
         return result_program;
     }
 
+    /* Program cache.
+     *
+     * Programs created from the same sources are shared, and freed when the
+     * last user calls destroy_program(). Linked programs are also saved with
+     * glGetProgramBinary() in the program cache directory, keyed by a hash of
+     * their sources and of the GL driver, so that the next time wayfire is
+     * started they can be loaded with glProgramBinary() instead of compiled */
+    namespace
+    {
+        struct shared_program_t
+        {
+            GLuint id;
+            int users;
+        };
+
+        /* Maps the sources of the program to the program */
+        std::unordered_map<std::string, shared_program_t> shared_programs;
+        std::unordered_map<GLuint, std::string> shared_program_sources;
+
+        struct program_binary_header_t
+        {
+            char magic[4];
+            uint32_t format;
+            uint32_t length;
+            uint32_t reserved;
+            /* A second hash of the sources, to detect hash collisions */
+            uint64_t check;
+        };
+
+        const char program_binary_magic[4] = {'W', 'F', 'P', '1'};
+
+        uint64_t fnv1a_hash(const std::string& data, uint64_t hash)
+        {
+            for (unsigned char c : data)
+            {
+                hash ^= c;
+                hash *= 1099511628211ull;
+            }
+
+            return hash;
+        }
+
+        /* Returns the directory where program binaries are saved, or an
+         * empty string if program binaries can't be saved */
+        const std::string& get_program_cache_dir()
+        {
+            static bool initialized = false;
+            static std::string cache_dir;
+            if (initialized)
+                return cache_dir;
+
+            initialized = true;
+
+            GLint formats = 0;
+            GL_CALL(glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats));
+            if (formats <= 0)
+            {
+                log_info("GL driver doesn't support program binaries, "
+                    "shaders will not be cached");
+                return cache_dir;
+            }
+
+            std::string base;
+            if (getenv("XDG_CACHE_HOME"))
+                base = getenv("XDG_CACHE_HOME");
+            else if (getenv("HOME"))
+                base = std::string(getenv("HOME")) + "/.cache";
+            else
+                return cache_dir;
+
+            std::string dir = base;
+            for (auto component : {"/wayfire", "/programs"})
+            {
+                dir += component;
+                if (mkdir(dir.c_str(), 0700) != 0 && errno != EEXIST)
+                {
+                    log_error("failed to create shader cache directory %s: %s",
+                        dir.c_str(), strerror(errno));
+                    return cache_dir;
+                }
+            }
+
+            cache_dir = dir;
+            return cache_dir;
+        }
+
+        /* The GL driver, the binaries are valid only for the same driver */
+        const std::string& get_driver_id()
+        {
+            static std::string driver_id;
+            if (driver_id.empty())
+            {
+                for (auto name : {GL_VENDOR, GL_RENDERER, GL_VERSION})
+                {
+                    auto str = GL_CALL(glGetString(name));
+                    driver_id += str ? (const char*)str : "";
+                    driver_id += '\n';
+                }
+            }
+
+            return driver_id;
+        }
+
+        std::string get_binary_path(const std::string& sources)
+        {
+            char name[32];
+            snprintf(name, sizeof(name), "/%016llx.bin", (unsigned long long)
+                fnv1a_hash(get_driver_id() + sources, 14695981039346656037ull));
+
+            return get_program_cache_dir() + name;
+        }
+
+        uint64_t get_binary_check(const std::string& sources)
+        {
+            return fnv1a_hash(sources + get_driver_id(), 0x6a09e667f3bcc908ull);
+        }
+
+        GLuint load_program_binary(const std::string& sources)
+        {
+            if (get_program_cache_dir().empty())
+                return 0;
+
+            std::ifstream file(get_binary_path(sources),
+                std::ios::in | std::ios::binary);
+            if (!file.is_open())
+                return 0;
+
+            program_binary_header_t header;
+            if (!file.read((char*)&header, sizeof(header)) ||
+                std::memcmp(header.magic, program_binary_magic, 4) ||
+                header.check != get_binary_check(sources))
+            {
+                return 0;
+            }
+
+            std::vector<char> binary(header.length);
+            if (!file.read(binary.data(), binary.size()))
+                return 0;
+
+            GLuint program = GL_CALL(glCreateProgram());
+            GL_CALL(glProgramBinary(program, header.format, binary.data(),
+                    binary.size()));
+
+            /* The driver may reject the binary, for ex. after an update */
+            GLint linked;
+            GL_CALL(glGetProgramiv(program, GL_LINK_STATUS, &linked));
+            if (linked == GL_FALSE)
+            {
+                GL_CALL(glDeleteProgram(program));
+                return 0;
+            }
+
+            return program;
+        }
+
+        void save_program_binary(GLuint program, const std::string& sources)
+        {
+            if (get_program_cache_dir().empty())
+                return;
+
+            GLint linked, length;
+            GL_CALL(glGetProgramiv(program, GL_LINK_STATUS, &linked));
+            GL_CALL(glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length));
+            if (linked == GL_FALSE || length <= 0)
+                return;
+
+            program_binary_header_t header;
+            std::memcpy(header.magic, program_binary_magic, 4);
+            header.reserved = 0;
+            header.check = get_binary_check(sources);
+
+            std::vector<char> binary(length);
+            GLenum format;
+            GL_CALL(glGetProgramBinary(program, length, &length, &format,
+                    binary.data()));
+            header.format = format;
+            header.length = length;
+
+            /* Write to a temporary file first, so that other instances never
+             * read a partially written binary */
+            auto path = get_binary_path(sources);
+            auto tmp_path = path + "." + std::to_string(getpid());
+            std::ofstream file(tmp_path, std::ios::out | std::ios::binary);
+            file.write((char*)&header, sizeof(header));
+            file.write(binary.data(), header.length);
+            file.close();
+
+            if (!file || rename(tmp_path.c_str(), path.c_str()) != 0)
+            {
+                log_error("failed to save program binary %s", path.c_str());
+                unlink(tmp_path.c_str());
+            }
+        }
+
+        /* Returns -1 if the program can't be compiled or linked */
+        GLuint link_program(const std::vector<shader_stage_t>& stages,
+            const pre_link_hook_t& pre_link, const std::string& sources)
+        {
+            auto program = load_program_binary(sources);
+            if (program)
+                return program;
+
+            std::vector<GLuint> shaders;
+            for (auto& stage : stages)
+            {
+                auto shader = compile_shader(stage.source, stage.type);
+                if (shader == (GLuint)-1)
+                {
+                    for (auto compiled : shaders)
+                    {
+                        GL_CALL(glDeleteShader(compiled));
+                    }
+
+                    return -1;
+                }
+
+                shaders.push_back(shader);
+            }
+
+            bool save = !get_program_cache_dir().empty();
+            program = create_program_from_shaders(shaders, pre_link, save);
+
+            GLint linked;
+            GL_CALL(glGetProgramiv(program, GL_LINK_STATUS, &linked));
+            if (linked == GL_FALSE)
+            {
+                char log[1024];
+                GL_CALL(glGetProgramInfoLog(program, sizeof(log), NULL, log));
+                log_error("Failed to link program; Errors:\n%s", log);
+
+                GL_CALL(glDeleteProgram(program));
+                return -1;
+            }
+
+            if (save)
+                save_program_binary(program, sources);
+
+            return program;
+        }
+    }
+
     GLuint create_program_from_source(std::string vertex_source,
-        std::string frag_source)
+        std::string frag_source, std::vector<shader_stage_t> extra_stages,
+        pre_link_hook_t pre_link, std::string pre_link_key)
     {
-        return create_program_from_shaders(
-            compile_shader(vertex_source, GL_VERTEX_SHADER),
-            compile_shader(frag_source, GL_FRAGMENT_SHADER));
+        /* Sources never contain \0, so the key is unambiguous. Programs with
+         * only a vertex and a fragment shader keep the key they always had,
+         * so that their cached binaries stay valid */
+        auto sources = vertex_source + '\0' + frag_source;
+        for (auto& stage : extra_stages)
+            sources += '\0' + std::to_string(stage.type) + ':' + stage.source;
+        if (!pre_link_key.empty())
+            sources += '\0' + std::string("pre-link:") + pre_link_key;
+
+        auto it = shared_programs.find(sources);
+        if (it != shared_programs.end())
+        {
+            ++it->second.users;
+            return it->second.id;
+        }
+
+        std::vector<shader_stage_t> stages = {
+            {GL_VERTEX_SHADER, vertex_source},
+            {GL_FRAGMENT_SHADER, frag_source},
+        };
+        stages.insert(stages.end(), extra_stages.begin(), extra_stages.end());
+
+        auto program = link_program(stages, pre_link, sources);
+        if (program == (GLuint)-1)
+            return program;
+
+        shared_programs[sources] = {program, 1};
+        shared_program_sources[program] = sources;
+
+        return program;
     }
 
-    GLuint create_program(std::string vertex_path, std::string frag_path)
+    GLuint create_program(std::string vertex_path, std::string frag_path,
+        std::vector<shader_stage_t> extra_stages)
     {
-        return create_program_from_shaders(
-            load_shader(vertex_path, GL_VERTEX_SHADER),
-            load_shader(frag_path, GL_FRAGMENT_SHADER));
+        std::string vertex_source, frag_source;
+        if (!read_file(vertex_path, vertex_source) ||
+            !read_file(frag_path, frag_source))
+        {
+            return -1;
+        }
+
+        for (auto& stage : extra_stages)
+        {
+            std::string path = stage.source;
+            if (!read_file(path, stage.source))
+                return -1;
+        }
+
+        return create_program_from_source(vertex_source, frag_source,
+            extra_stages);
+    }
+
+    void destroy_program(GLuint program)
+    {
+        auto it = shared_program_sources.find(program);
+        if (it == shared_program_sources.end())
+            return;
+
+        auto& shared = shared_programs[it->second];
+        if (--shared.users > 0)
+            return;
+
+        shared_programs.erase(it->second);
+        shared_program_sources.erase(it);
+        GL_CALL(glDeleteProgram(program));
     }
 
     void init()
@@ -131,13 +485,16 @@ namespace OpenGL
         program.position   = GL_CALL(glGetAttribLocation(program.id, "position"));
         program.uvPosition = GL_CALL(glGetAttribLocation(program.id, "uvPosition"));
 
+        GL_CALL(glGenBuffers(1, &batch.vbo));
+
         render_end();
     }
 
     void fini()
     {
         render_begin();
-        GL_CALL(glDeleteProgram(program.id));
+        destroy_program(program.id);
+        GL_CALL(glDeleteBuffers(1, &batch.vbo));
         render_end();
     }
 
@@ -160,53 +517,139 @@ namespace OpenGL
         const gl_geometry& g, const gl_geometry& texg,
         glm::mat4 model, glm::vec4 color, uint32_t bits)
     {
-        GL_CALL(glUseProgram(program.id));
+        begin_batch(tex, model, color, bits);
+        add_quad(g, texg);
+        flush();
+    }
 
-        gl_geometry final_g = g;
-        if (bits & TEXTURE_TRANSFORM_INVERT_Y)
-            std::swap(final_g.y1, final_g.y2);
-        if (bits & TEXTURE_TRANSFORM_INVERT_X)
-            std::swap(final_g.x1, final_g.x2);
-
-        GLfloat vertexData[] = {
-            final_g.x1, final_g.y2,
-            final_g.x2, final_g.y2,
-            final_g.x2, final_g.y1,
-            final_g.x1, final_g.y1,
+    void begin_batch(GLuint tex, glm::mat4 transform, glm::vec4 color,
+        uint32_t bits)
+    {
+        if (batch.active)
+            flush();
+
+        batch.tex = tex;
+        batch.transform = transform;
+        batch.color = color;
+        batch.bits = bits;
+        batch.vertices.clear();
+        batch.active = true;
+    }
+
+    void add_quad(const gl_geometry& g, const gl_geometry& texg)
+    {
+        add_quad(g, texg, {-1e9, -1e9, 1e9, 1e9});
+    }
+
+    void add_quad(const gl_geometry& g, const gl_geometry& texg,
+        const gl_geometry& clip)
+    {
+        if (!batch.active)
+        {
+            log_error("OpenGL::add_quad() called without begin_batch()");
+            return;
+        }
+
+        gl_geometry pos = g;
+        gl_geometry uv = {0.0f, 1.0f, 1.0f, 0.0f};
+        if (batch.bits & TEXTURE_USE_TEX_GEOMETRY)
+            uv = texg;
+
+        /* Inverting the geometry is the same as inverting the texture */
+        if (batch.bits & TEXTURE_TRANSFORM_INVERT_Y)
+            std::swap(uv.y1, uv.y2);
+        if (batch.bits & TEXTURE_TRANSFORM_INVERT_X)
+            std::swap(uv.x1, uv.x2);
+
+        /* Make sure x1 <= x2 and y1 <= y2, so that we can clip */
+        if (pos.x1 > pos.x2)
+            std::swap(pos.x1, pos.x2), std::swap(uv.x1, uv.x2);
+        if (pos.y1 > pos.y2)
+            std::swap(pos.y1, pos.y2), std::swap(uv.y1, uv.y2);
+
+        gl_geometry clipped = {
+            std::max(pos.x1, clip.x1), std::max(pos.y1, clip.y1),
+            std::min(pos.x2, clip.x2), std::min(pos.y2, clip.y2),
         };
 
-        GLfloat coordData[] = {
-            0.0f, 0.0f,
-            1.0f, 0.0f,
-            1.0f, 1.0f,
-            0.0f, 1.0f,
+        if (clipped.x1 >= clipped.x2 || clipped.y1 >= clipped.y2)
+            return;
+
+        /* Texture coordinates are interpolated linearly over the quad */
+        auto lerp_u = [&] (float x) {
+            return uv.x1 + (x - pos.x1) / (pos.x2 - pos.x1) * (uv.x2 - uv.x1);
+        };
+        auto lerp_v = [&] (float y) {
+            return uv.y1 + (y - pos.y1) / (pos.y2 - pos.y1) * (uv.y2 - uv.y1);
         };
 
-        if (bits & TEXTURE_USE_TEX_GEOMETRY) {
-            coordData[0] = texg.x1; coordData[1] = texg.y2;
-            coordData[2] = texg.x2; coordData[3] = texg.y2;
-            coordData[4] = texg.x2; coordData[5] = texg.y1;
-            coordData[6] = texg.x1; coordData[7] = texg.y1;
-        }
+        float u1 = lerp_u(clipped.x1), u2 = lerp_u(clipped.x2);
+        float v1 = lerp_v(clipped.y1), v2 = lerp_v(clipped.y2);
 
-        GL_CALL(glBindTexture(GL_TEXTURE_2D, tex));
+        GLfloat quad[] = {
+            clipped.x1, clipped.y2, u1, v2,
+            clipped.x2, clipped.y2, u2, v2,
+            clipped.x2, clipped.y1, u2, v1,
+
+            clipped.x2, clipped.y1, u2, v1,
+            clipped.x1, clipped.y1, u1, v1,
+            clipped.x1, clipped.y2, u1, v2,
+        };
+
+        batch.vertices.insert(batch.vertices.end(), std::begin(quad), std::end(quad));
+    }
+
+    void flush()
+    {
+        if (!batch.active)
+            return;
+
+        batch.active = false;
+        if (batch.vertices.empty())
+            return;
+
+        GL_CALL(glUseProgram(program.id));
+        GL_CALL(glBindTexture(GL_TEXTURE_2D, batch.tex));
         GL_CALL(glActiveTexture(GL_TEXTURE0));
 
-        GL_CALL(glVertexAttribPointer(program.position, 2, GL_FLOAT, GL_FALSE, 0, vertexData));
+        /* Each batch is appended after the previous ones, so that we don't
+         * overwrite vertices which previous draw calls may still be reading.
+         * Only when the buffer is full is the old storage orphaned and we
+         * start again from the beginning */
+        size_t size = batch.vertices.size() * sizeof(GLfloat);
+        GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, batch.vbo));
+        if (batch.vbo_offset + size > batch.vbo_size)
+        {
+            batch.vbo_size = std::max({size, batch.vbo_size, min_vbo_size});
+            batch.vbo_offset = 0;
+            GL_CALL(glBufferData(GL_ARRAY_BUFFER, batch.vbo_size, NULL,
+                    GL_STREAM_DRAW));
+        }
+
+        GL_CALL(glBufferSubData(GL_ARRAY_BUFFER, batch.vbo_offset, size,
+                batch.vertices.data()));
+        auto offset = reinterpret_cast<char*> (batch.vbo_offset);
+        batch.vbo_offset += size;
+
+        const GLsizei stride = 4 * sizeof(GLfloat);
+        GL_CALL(glVertexAttribPointer(program.position, 2, GL_FLOAT, GL_FALSE,
+                stride, offset));
         GL_CALL(glEnableVertexAttribArray(program.position));
 
-        GL_CALL(glVertexAttribPointer(program.uvPosition, 2, GL_FLOAT, GL_FALSE, 0, coordData));
+        GL_CALL(glVertexAttribPointer(program.uvPosition, 2, GL_FLOAT, GL_FALSE,
+                stride, offset + 2 * sizeof(GLfloat)));
         GL_CALL(glEnableVertexAttribArray(program.uvPosition));
 
-        GL_CALL(glUniformMatrix4fv(program.mvpID, 1, GL_FALSE, &model[0][0]));
-        GL_CALL(glUniform4fv(program.colorID, 1, &color[0]));
+        GL_CALL(glUniformMatrix4fv(program.mvpID, 1, GL_FALSE, &batch.transform[0][0]));
+        GL_CALL(glUniform4fv(program.colorID, 1, &batch.color[0]));
 
         GL_CALL(glEnable(GL_BLEND));
         GL_CALL(glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA));
-        GL_CALL(glDrawArrays(GL_TRIANGLE_FAN, 0, 4));
+        GL_CALL(glDrawArrays(GL_TRIANGLES, 0, batch.vertices.size() / 4));
 
         GL_CALL(glDisableVertexAttribArray(program.uvPosition));
         GL_CALL(glDisableVertexAttribArray(program.position));
+        GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, 0));
     }
 
     void render_begin()
@@ -237,6 +680,7 @@ namespace OpenGL
 
     void render_end()
     {
+        flush();
         GL_CALL(glBindFramebuffer(GL_FRAMEBUFFER, 0));
         wlr_renderer_scissor(core->renderer, NULL);
         wlr_renderer_end(core->renderer);
@@ -102,17 +102,13 @@ bool input_manager::handle_pointer_button(wlr_event_pointer_button *ev)
         GetTuple(ox, oy, core->get_active_output()->get_cursor_position());
 
         auto mod_state = get_modifiers();
-        for (auto& binding : bindings[WF_BINDING_BUTTON])
+        for (auto binding : find_bindings(WF_BINDING_BUTTON,
+                core->get_active_output(), mod_state, ev->button))
         {
-            if (binding->output == core->get_active_output() &&
-                binding->value->as_cached_button().matches(
-                    {mod_state, ev->button}))
-            {
-                /* We must be careful because the callback might be erased,
-                 * so force copy the callback into the lambda */
-                auto callback = binding->call.button;
-                callbacks.push_back([=] () {(*callback) (ev->button, ox, oy);});
-            }
+            /* We must be careful because the callback might be erased,
+             * so force copy the callback into the lambda */
+            auto callback = binding->call.button;
+            callbacks.push_back([=] () {(*callback) (ev->button, ox, oy);});
         }
 
         for (auto& binding : bindings[WF_BINDING_ACTIVATOR])
@@ -230,11 +226,10 @@ void input_manager::handle_pointer_axis(wlr_event_pointer_axis *ev)
 
     auto mod_state = get_modifiers();
 
-    for (auto& binding : bindings[WF_BINDING_AXIS])
+    for (auto binding : find_bindings(WF_BINDING_AXIS,
+            core->get_active_output(), mod_state, 0))
     {
-        if (binding->output == core->get_active_output() &&
-            binding->value->as_cached_key().matches({mod_state, 0}))
-            callbacks.push_back(binding->call.axis);
+        callbacks.push_back(binding->call.axis);
     }
 
     for (auto call : callbacks)
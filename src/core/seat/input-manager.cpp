@@ -128,8 +128,12 @@ input_manager::input_manager()
         }
     };
 
+    modifier_binding_timeout = core->config->get_section("input")->get_option(
+        "modifier_binding_timeout", "0");
+
     config_updated = [=] (signal_data *)
     {
+        binding_index_dirty = true;
         for (auto& dev : input_devices)
             dev->update_options();
         for (auto& kbd : keyboards)
@@ -253,15 +257,14 @@ wayfire_surface_t* input_manager::input_surface_at(int x, int y,
     y -= og.y;
 
     wayfire_surface_t *new_focus = nullptr;
-    output->workspace->for_each_view(
-        [&] (wayfire_view view)
-        {
-            if (new_focus) return; // we already found a focus surface
+    for (auto& view : output->workspace->get_views_at({x, y}, WF_VISIBLE_LAYERS))
+    {
+        if (can_focus_surface(view.get())) // make sure focusing this surface isn't disabled
+            new_focus = view->map_input_coordinates(x, y, lx, ly);
 
-            if (can_focus_surface(view.get())) // make sure focusing this surface isn't disabled
-                new_focus = view->map_input_coordinates(x, y, lx, ly);
-        },
-        WF_VISIBLE_LAYERS);
+        if (new_focus) // we already found a focus surface
+            break;
+    }
 
     return new_focus;
 }
@@ -298,8 +301,12 @@ wf_binding* input_manager::new_binding(wf_binding_type type, wf_option value,
     binding->output = output;
     binding->call.raw = callback;
 
+    binding->value_updated = [=] () { binding_index_dirty = true; };
+    value->add_updated_handler(&binding->value_updated);
+
     auto raw = binding.get();
     bindings[type].push_back(std::move(binding));
+    binding_index_dirty = true;
 
     return raw;
 }
@@ -313,7 +320,9 @@ void input_manager::rem_binding(binding_criteria criteria)
         while (it != container.end())
         {
             if (criteria((*it).get())) {
+                (*it)->value->rem_updated_handler(&(*it)->value_updated);
                 it = container.erase(it);
+                binding_index_dirty = true;
             } else {
                 ++it;
             }
@@ -321,6 +330,52 @@ void input_manager::rem_binding(binding_criteria criteria)
     }
 }
 
+void input_manager::rebuild_binding_index()
+{
+    binding_index.clear();
+
+    for (auto& binding : bindings[WF_BINDING_KEY])
+    {
+        auto key = binding->value->as_cached_key();
+        binding_index[{WF_BINDING_KEY, binding->output, key.mod, key.keyval}]
+            .push_back(binding.get());
+    }
+
+    for (auto& binding : bindings[WF_BINDING_BUTTON])
+    {
+        auto button = binding->value->as_cached_button();
+        binding_index[{WF_BINDING_BUTTON, binding->output, button.mod, button.button}]
+            .push_back(binding.get());
+    }
+
+    for (auto& binding : bindings[WF_BINDING_AXIS])
+    {
+        auto key = binding->value->as_cached_key();
+        /* Axis bindings match only the modifiers */
+        if (key.keyval == 0)
+        {
+            binding_index[{WF_BINDING_AXIS, binding->output, key.mod, 0}]
+                .push_back(binding.get());
+        }
+    }
+
+    binding_index_dirty = false;
+}
+
+const std::vector<wf_binding*>& input_manager::find_bindings(
+    wf_binding_type type, wayfire_output *output, uint32_t mod, uint32_t key)
+{
+    if (binding_index_dirty)
+        rebuild_binding_index();
+
+    static const std::vector<wf_binding*> none;
+    auto it = binding_index.find({type, output, mod, key});
+    if (it == binding_index.end())
+        return none;
+
+    return it->second;
+}
+
 void input_manager::rem_binding(wf_binding *binding)
 {
     rem_binding([=] (wf_binding *ptr) { return binding == ptr; });
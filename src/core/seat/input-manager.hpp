@@ -2,6 +2,7 @@
 #define INPUT_MANAGER_HPP
 
 #include <unordered_set>
+#include <unordered_map>
 #include <map>
 #include <vector>
 #include <chrono>
@@ -41,6 +42,9 @@ struct wf_binding
     wf_binding_type type;
     wayfire_output *output;
 
+    /* Invalidates the bindings index when the value changes */
+    wf_option_callback value_updated;
+
     union {
         void *raw;
         key_callback *key;
@@ -75,6 +79,48 @@ class input_manager
         using binding_criteria = std::function<bool(wf_binding*)>;
         void rem_binding(binding_criteria criteria);
 
+        /* Key, button and axis bindings, indexed by their output, modifiers
+         * and key/button (0 for axis bindings). Activator bindings may contain
+         * several keys and buttons, so they are still checked one by one. */
+        struct binding_key_t
+        {
+            wf_binding_type type;
+            wayfire_output *output;
+            uint32_t mod, key;
+
+            bool operator == (const binding_key_t& other) const
+            {
+                return type == other.type && output == other.output &&
+                    mod == other.mod && key == other.key;
+            }
+        };
+
+        struct binding_key_hash_t
+        {
+            size_t operator () (const binding_key_t& key) const
+            {
+                size_t hash = std::hash<wayfire_output*>()(key.output);
+                hash = hash * 31 + key.type;
+                hash = hash * 31 + key.mod;
+                hash = hash * 31 + key.key;
+                return hash;
+            }
+        };
+
+        std::unordered_map<binding_key_t, std::vector<wf_binding*>,
+            binding_key_hash_t> binding_index;
+        /* The index is rebuilt on the next lookup after a binding has been
+         * added or removed, or the value of a binding has changed */
+        bool binding_index_dirty = true;
+        void rebuild_binding_index();
+
+        /* Bindings of the given type on the given output which match the
+         * modifiers and key, in the order they were added */
+        const std::vector<wf_binding*>& find_bindings(wf_binding_type type,
+            wayfire_output *output, uint32_t mod, uint32_t key);
+
+        wf_option modifier_binding_timeout;
+
         bool is_touch_enabled();
 
         void create_seat();
@@ -175,18 +175,15 @@ std::vector<std::function<void()>> input_manager::match_keys(uint32_t mod_state,
 
     uint32_t actual_key = key == 0 ? mod_binding_key : key;
 
-    for (auto& binding : bindings[WF_BINDING_KEY])
+    for (auto binding : find_bindings(WF_BINDING_KEY,
+            core->get_active_output(), mod_state, key))
     {
-        if (binding->value->as_cached_key().matches({mod_state, key}) &&
-            binding->output == core->get_active_output())
-        {
-            /* We must be careful because the callback might be erased,
-             * so force copy the callback into the lambda */
-            auto callback = binding->call.key;
-            callbacks.push_back([actual_key, callback] () {
-                (*callback) (actual_key);
-            });
-        }
+        /* We must be careful because the callback might be erased,
+         * so force copy the callback into the lambda */
+        auto callback = binding->call.key;
+        callbacks.push_back([actual_key, callback] () {
+            (*callback) (actual_key);
+        });
     }
 
     for (auto& binding : bindings[WF_BINDING_ACTIVATOR])
@@ -251,8 +248,7 @@ bool input_manager::handle_keyboard_key(uint32_t key, uint32_t state)
     {
         if (mod_binding_key != 0)
         {
-            auto section = core->config->get_section("input");
-            auto timeout = section->get_option("modifier_binding_timeout", "0")->as_int();
+            auto timeout = modifier_binding_timeout->as_cached_int();
             if (timeout <= 0 ||
                     duration_cast<milliseconds>(steady_clock::now() - mod_binding_start)
                     <= milliseconds(timeout))
@@ -0,0 +1,132 @@
+#include "worker-pool.hpp"
+#include <algorithm>
+
+namespace wf
+{
+    worker_pool_t& worker_pool_t::get()
+    {
+        static worker_pool_t pool;
+        return pool;
+    }
+
+    worker_pool_t::worker_pool_t()
+    {
+        /* The calling thread also works on parallel_for() jobs, so we need one
+         * thread less. Tasks need at least one worker, though. */
+        int num_workers = (int)std::thread::hardware_concurrency() - 1;
+        num_workers = std::max(num_workers, 1);
+        for (int i = 0; i < num_workers; i++)
+            workers.emplace_back([=] () { worker_main(); });
+    }
+
+    worker_pool_t::~worker_pool_t()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            shutting_down = true;
+        }
+
+        work_available.notify_all();
+        for (auto& worker : workers)
+            worker.join();
+    }
+
+    int worker_pool_t::get_concurrency()
+    {
+        return workers.size() + 1;
+    }
+
+    void worker_pool_t::run_chunks()
+    {
+        while (true)
+        {
+            int start = next_chunk.fetch_add(1) * job_chunk_size;
+            if (start >= job_count)
+                return;
+
+            (*job) (start, std::min(job_count, start + job_chunk_size));
+        }
+    }
+
+    void worker_pool_t::worker_main()
+    {
+        uint64_t last_serial = 0;
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true)
+        {
+            work_available.wait(lock, [&] () {
+                return shutting_down || !tasks.empty() ||
+                    (job && job_serial != last_serial);
+            });
+
+            if (shutting_down)
+                return;
+
+            /* Jobs block the main thread, so they go first */
+            if (job && job_serial != last_serial)
+            {
+                last_serial = job_serial;
+                ++job_workers;
+
+                lock.unlock();
+                run_chunks();
+                lock.lock();
+
+                if (--job_workers == 0)
+                    job_finished.notify_one();
+                continue;
+            }
+
+            auto task = std::move(tasks.front());
+            tasks.pop_front();
+
+            lock.unlock();
+            task();
+            /* Destroy the task and what it captured outside of the lock */
+            task = nullptr;
+            lock.lock();
+        }
+    }
+
+    void worker_pool_t::parallel_for(int count, int chunk_size,
+        const std::function<void(int, int)>& func)
+    {
+        chunk_size = std::max(chunk_size, 1);
+
+        /* Not worth waking up the workers */
+        if (count <= chunk_size)
+        {
+            if (count > 0)
+                func(0, count);
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job = &func;
+            job_count = count;
+            job_chunk_size = chunk_size;
+            next_chunk = 0;
+            ++job_serial;
+        }
+
+        work_available.notify_all();
+        run_chunks();
+
+        /* Workers busy with a task don't join the job, so we wait only for
+         * those which did. No worker can join after job is reset. */
+        std::unique_lock<std::mutex> lock(mutex);
+        job_finished.wait(lock, [&] () { return job_workers == 0; });
+        job = nullptr;
+    }
+
+    void worker_pool_t::run_async(std::function<void()> task)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.push_back(std::move(task));
+        }
+
+        work_available.notify_one();
+    }
+}
@@ -4,6 +4,7 @@
 
 #include <sys/inotify.h>
 #include <unistd.h>
+#include <csignal>
 
 #include "debug-func.hpp"
 #include <config.hpp>
@@ -23,6 +24,7 @@ extern "C"
 
 #include "core.hpp"
 #include "output.hpp"
+#include "render-manager.hpp"
 
 wf_runtime_config runtime_config;
 
@@ -62,6 +64,17 @@ static int handle_config_updated(int fd, uint32_t mask, void *data)
     return 1;
 }
 
+/* SIGUSR1 dumps the frame timing statistics of all outputs to stderr */
+static int handle_dump_frame_stats(int signal, void *data)
+{
+    core->for_each_output([] (wayfire_output *output)
+    {
+        output->render->dump_frame_stats();
+    });
+
+    return 0;
+}
+
 std::map<EGLint, EGLint> default_attribs = {
     {EGL_RED_SIZE, 1},
     {EGL_GREEN_SIZE, 1},
@@ -207,6 +220,7 @@ int main(int argc, char *argv[])
     reload_config(inotify_fd);
 
     wl_event_loop_add_fd(core->ev_loop, inotify_fd, WL_EVENT_READABLE, handle_config_updated, NULL);
+    wl_event_loop_add_signal(core->ev_loop, SIGUSR1, handle_dump_frame_stats, NULL);
 
     /*
     ec->idle_time = config->get_section("core")->get_int("idle_time", 300);
@@ -7,6 +7,9 @@
 #include "debug.hpp"
 #include "../main.hpp"
 #include <algorithm>
+#include <cmath>
+#include <array>
+#include <cstdio>
 
 extern "C"
 {
@@ -96,6 +99,223 @@ struct wf_output_damage
     }
 };
 
+/* Keeps the durations of each phase of the last max_frames frames */
+struct wf_frame_stats
+{
+    static constexpr size_t max_frames = 256;
+    using frame_timings_t = std::array<int64_t, WF_FRAME_PHASE_COUNT>;
+
+    std::array<frame_timings_t, max_frames> frames;
+    size_t next_frame = 0, recorded_frames = 0;
+
+    frame_timings_t current;
+    timespec frame_start, last_mark;
+
+    static int64_t usec_between(const timespec& a, const timespec& b)
+    {
+        return (b.tv_sec - a.tv_sec) * 1000000ll +
+            (b.tv_nsec - a.tv_nsec) / 1000ll;
+    }
+
+    void start_frame(const timespec& start)
+    {
+        current.fill(0);
+        frame_start = last_mark = start;
+    }
+
+    /* Add the time since the last mark to the given phase */
+    void mark(wf_frame_phase phase)
+    {
+        timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        current[phase] += usec_between(last_mark, now);
+        last_mark = now;
+    }
+
+    void finish_frame()
+    {
+        current[WF_FRAME_PHASE_TOTAL] = usec_between(frame_start, last_mark);
+
+        frames[next_frame] = current;
+        next_frame = (next_frame + 1) % max_frames;
+        recorded_frames = std::min(recorded_frames + 1, max_frames);
+    }
+
+    int64_t percentile(wf_frame_phase phase, float percentile)
+    {
+        if (recorded_frames == 0)
+            return 0;
+
+        std::vector<int64_t> samples(recorded_frames);
+        for (size_t i = 0; i < recorded_frames; i++)
+            samples[i] = frames[i][phase];
+
+        percentile = std::max(0.0f, std::min(percentile, 100.0f));
+        size_t idx = (recorded_frames - 1) * percentile / 100.0;
+
+        std::nth_element(samples.begin(), samples.begin() + idx, samples.end());
+        return samples[idx];
+    }
+};
+
+static int64_t region_area(const wf_region& region)
+{
+    int64_t area = 0;
+    for (const auto& box : region)
+        area += int64_t(box.x2 - box.x1) * (box.y2 - box.y1);
+
+    return area;
+}
+
+/* Subtract the opaque region of the surface at (x, y) from a region in the
+ * coordinates of a stream rendered at the given scale.
+ *
+ * Opaque regions are in output scale, so for scaled streams they are scaled
+ * too. Scaling rounds the boxes outwards, so we shrink the result by 1px to
+ * keep only pixels which are actually covered. */
+static void subtract_scaled_opaque(wayfire_surface_t *surface, wf_region& region,
+    int x, int y, float output_scale, float scale)
+{
+    if (scale == 1)
+    {
+        surface->subtract_opaque(region, x, y);
+        return;
+    }
+
+    /* Let the surface subtract its opaque region from its own bounds, the
+     * difference is the opaque region */
+    auto box = surface->get_output_geometry();
+    box.x = x;
+    box.y = y;
+
+    wf_region bounds{box};
+    bounds *= output_scale;
+
+    wf_region transparent = bounds;
+    surface->subtract_opaque(transparent, x, y);
+
+    wf_region opaque = bounds ^ transparent;
+    if (opaque.empty())
+        return;
+
+    opaque *= scale;
+    opaque.expand_edges(-1);
+    region ^= opaque;
+}
+
+/* Returns a region which covers the given damage and has at most max_boxes
+ * boxes. The extents of the damage are split into horizontal strips. In each
+ * strip the damage is reduced to its vertical extent and to a few spans, made
+ * by joining the spans separated by the smallest gaps. */
+static wf_region simplify_damage(const wf_region& damage, int max_boxes)
+{
+    int strips = std::max(1, (int)std::sqrt(max_boxes));
+    size_t spans_per_strip = max_boxes / strips;
+
+    auto extents = damage.get_extents();
+    int64_t height = extents.y2 - extents.y1;
+
+    struct strip_t
+    {
+        int y1 = INT32_MAX, y2 = INT32_MIN;
+        std::vector<std::pair<int, int>> spans;
+    };
+    std::vector<strip_t> strip(strips);
+
+    for (const auto& box : damage)
+    {
+        for (int i = 0; i < strips; i++)
+        {
+            int strip_y1 = extents.y1 + height * i / strips;
+            int strip_y2 = extents.y1 + height * (i + 1) / strips;
+
+            int y1 = std::max(box.y1, strip_y1), y2 = std::min(box.y2, strip_y2);
+            if (y1 >= y2)
+                continue;
+
+            strip[i].y1 = std::min(strip[i].y1, y1);
+            strip[i].y2 = std::max(strip[i].y2, y2);
+            strip[i].spans.push_back({box.x1, box.x2});
+        }
+    }
+
+    wf_region result;
+    for (auto& s : strip)
+    {
+        if (s.spans.empty())
+            continue;
+
+        /* Join overlapping and touching spans */
+        std::sort(s.spans.begin(), s.spans.end());
+        std::vector<std::pair<int, int>> spans;
+        for (auto& span : s.spans)
+        {
+            if (spans.size() && span.first <= spans.back().second)
+                spans.back().second = std::max(spans.back().second, span.second);
+            else
+                spans.push_back(span);
+        }
+
+        /* Keep only the largest gaps, all other spans are joined */
+        std::vector<int> gaps;
+        for (size_t i = 1; i < spans.size(); i++)
+            gaps.push_back(spans[i].first - spans[i - 1].second);
+
+        int min_gap = 0;
+        if (spans.size() > spans_per_strip)
+        {
+            auto nth = gaps.begin() + (gaps.size() - (spans_per_strip - 1));
+            std::nth_element(gaps.begin(), nth, gaps.end());
+            min_gap = (nth == gaps.end()) ? INT32_MAX : *nth;
+        }
+
+        size_t added = 0;
+        int x1 = spans[0].first;
+        for (size_t i = 0; i < spans.size(); i++)
+        {
+            bool last = (i + 1 == spans.size());
+            /* Gaps equal to min_gap may be kept more than once, stop
+             * splitting when the strip is full */
+            bool split = !last && added + 1 < spans_per_strip &&
+                spans[i + 1].first - spans[i].second >= min_gap;
+
+            if (last || split)
+            {
+                result |= wlr_box{x1, s.y1, spans[i].second - x1, s.y2 - s.y1};
+                ++added;
+
+                if (!last)
+                    x1 = spans[i + 1].first;
+            }
+        }
+    }
+
+    return result;
+}
+
+void render_manager::simplify_frame_damage()
+{
+    int max_boxes = max_damage_rects->as_cached_int();
+    if (max_boxes <= 0)
+        return;
+
+    size_t boxes = std::distance(frame_damage.begin(), frame_damage.end());
+    if (boxes <= (size_t)max_boxes)
+        return;
+
+    auto simplified = simplify_damage(frame_damage, max_boxes);
+
+    ++damage_stats.simplified_frames;
+    damage_stats.rects_before += boxes;
+    damage_stats.rects_after +=
+        std::distance(simplified.begin(), simplified.end());
+    damage_stats.overdraw_area +=
+        region_area(simplified) - region_area(frame_damage);
+
+    frame_damage = std::move(simplified);
+}
+
 void frame_cb (wl_listener*, void *data)
 {
     auto output_damage = static_cast<wlr_output_damage*>(data);
@@ -113,6 +333,12 @@ render_manager::render_manager(wayfire_output *o)
     /* TODO: do we really need a unique_ptr? */
     output_damage = std::unique_ptr<wf_output_damage>(new wf_output_damage(output->handle));
     output_damage->add();
+    frame_stats = std::unique_ptr<wf_frame_stats>(new wf_frame_stats());
+
+    occluded_frame_rate = (*core->config)["core"]->get_option(
+        "occluded_frame_rate", "1");
+    max_damage_rects = (*core->config)["core"]->get_option(
+        "max_damage_rects", "32");
 
     frame_listener.notify = frame_cb;
     wl_signal_add(&output_damage->damage_manager->events.frame, &frame_listener);
@@ -306,9 +532,11 @@ void render_manager::paint()
     /* Part 1: frame setup: query damage, etc. */
     timespec repaint_started;
     clock_gettime(CLOCK_MONOTONIC, &repaint_started);
+    frame_stats->start_frame(repaint_started);
 
     frame_damage.clear();
     run_effects(effects[WF_OUTPUT_EFFECT_PRE]);
+    frame_stats->mark(WF_FRAME_PHASE_PRE_EFFECTS);
 
     bool needs_swap;
     if (!output_damage->make_current(frame_damage, needs_swap))
@@ -320,6 +548,7 @@ void render_manager::paint()
         return;
     }
 
+    frame_stats->mark(WF_FRAME_PHASE_MAKE_CURRENT);
     OpenGL::bind_output(output);
 
     /* Make sure the default buffer has enough size */
@@ -350,6 +579,7 @@ void render_manager::paint()
     } else
     {
         frame_damage &= get_damage_box();
+        simplify_frame_damage();
         if (!frame_damage.empty())
         {
             swap_damage = frame_damage;
@@ -357,8 +587,11 @@ void render_manager::paint()
         }
     }
 
+    frame_stats->mark(WF_FRAME_PHASE_RENDER);
+
     /* Part 3: finalize the scene: overlay effects and sw cursors */
     run_effects(effects[WF_OUTPUT_EFFECT_OVERLAY]);
+    frame_stats->mark(WF_FRAME_PHASE_OVERLAY_EFFECTS);
 
     if (post_effects.size())
         swap_damage |= get_damage_box();
@@ -366,6 +599,7 @@ void render_manager::paint()
     OpenGL::render_begin(get_target_framebuffer());
     wlr_output_render_software_cursors(output->handle, swap_damage.to_pixman());
     OpenGL::render_end();
+    frame_stats->mark(WF_FRAME_PHASE_SW_CURSORS);
 
     /* Part 4: postprocessing effects */
     run_post_effects();
@@ -376,10 +610,16 @@ void render_manager::paint()
         OpenGL::render_end();
     }
 
+    frame_stats->mark(WF_FRAME_PHASE_POST_EFFECTS);
+
     /* Part 5: finalize frame: swap buffers, send frame_done, etc */
     OpenGL::unbind_output(output);
     output_damage->swap_buffers(&repaint_started, swap_damage);
+    frame_stats->mark(WF_FRAME_PHASE_SWAP);
+
     post_paint();
+    frame_stats->mark(WF_FRAME_PHASE_POST_PAINT);
+    frame_stats->finish_frame();
 }
 
 void render_manager::default_renderer()
@@ -433,6 +673,52 @@ void render_manager::run_post_effects()
     });
 }
 
+/* Saved with each view, used to throttle the frame callbacks of occluded views */
+struct wf_occlusion_throttle_data : public wf_custom_data_t
+{
+    int64_t last_frame_done = 0;
+};
+
+/* Returns the views on the current workspace which are completely covered by
+ * the opaque regions of the views above them */
+std::unordered_set<wayfire_view_t*> render_manager::get_occluded_views()
+{
+    std::unordered_set<wayfire_view_t*> occluded;
+
+    auto fb = get_target_framebuffer();
+    wf_region visible{get_damage_box()};
+
+    auto views = output->workspace->get_views_on_workspace_shared(
+        output->workspace->get_current_workspace(), WF_VISIBLE_LAYERS, false);
+
+    /* views are sorted from top to bottom */
+    for (auto& view : *views)
+    {
+        if (!view->is_visible())
+            continue;
+
+        auto bbox = fb.damage_box_from_geometry_box(view->get_bounding_box());
+        if ((visible & bbox).empty())
+        {
+            occluded.insert(view.get());
+            continue;
+        }
+
+        /* Transformed views are rendered from their snapshot and may be
+         * arbitrarily deformed, so they don't cover anything */
+        if (view->has_transformer() || !view->is_mapped())
+            continue;
+
+        view->for_each_surface([&] (wayfire_surface_t *surface, int x, int y)
+        {
+            if (surface->alpha >= 0.999f)
+                surface->subtract_opaque(visible, x, y);
+        });
+    }
+
+    return occluded;
+}
+
 void render_manager::post_paint()
 {
     run_effects(effects[WF_OUTPUT_EFFECT_POST]);
@@ -440,30 +726,46 @@ void render_manager::post_paint()
     if (constant_redraw)
         schedule_redraw();
 
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int64_t now_msec = timespec_to_msec(now);
+
+    /* Custom renderers may show any view, so we can't know which are occluded */
+    std::unordered_set<wayfire_view_t*> occluded;
+    int throttle_rate = occluded_frame_rate->as_cached_int();
+    if (!renderer && throttle_rate > 0)
+        occluded = get_occluded_views();
+
     auto send_frame_done =
-        [=] (wayfire_view v)
+        [&] (wayfire_view v)
         {
             if (!v->is_mapped())
                 return;
 
-            v->for_each_surface([] (wayfire_surface_t *surface, int, int)
-                                {
-                                    struct timespec now;
-                                    clock_gettime(CLOCK_MONOTONIC, &now);
-                                    surface->send_frame_done(now);
-                                });
+            /* Occluded views get frame callbacks at a lower rate, so that
+             * clients don't repaint at full speed when nothing is visible */
+            if (occluded.count(v.get()))
+            {
+                auto data = v->get_data_safe<wf_occlusion_throttle_data>();
+                if (now_msec - data->last_frame_done < 1000 / throttle_rate)
+                    return;
+
+                data->last_frame_done = now_msec;
+            }
+
+            v->for_each_surface([&] (wayfire_surface_t *surface, int, int)
+                                { surface->send_frame_done(now); });
         };
 
-    /* TODO: do this only if the view isn't fully occluded by another */
     if (renderer)
     {
         output->workspace->for_each_view(send_frame_done, WF_VISIBLE_LAYERS);
     } else
     {
-        auto views = output->workspace->get_views_on_workspace(
+        auto views = output->workspace->get_views_on_workspace_shared(
             output->workspace->get_current_workspace(), WF_MIDDLE_LAYERS, false);
 
-        for (auto v : views)
+        for (auto v : *views)
             send_frame_done(v);
 
         // send to all panels/backgrounds/etc
@@ -524,43 +826,61 @@ void render_manager::workspace_stream_update(wf_workspace_stream *stream,
 
     wf_region ws_damage = get_ws_damage(stream->ws);
 
-    float current_resolution = stream->scale_x * stream->scale_y;
-    float target_resolution = scale_x * scale_y;
-
-    float scaling = std::max(current_resolution / target_resolution,
-                             target_resolution / current_resolution);
+    /* Streams which aren't rendered directly to the screen are rendered at
+     * the requested scale. We use the same scale in both directions, so that
+     * the buffer keeps the aspect ratio of the output, and round it up to a
+     * multiple of 1/8, so that the buffer isn't reallocated on every frame of
+     * a zoom animation. */
+    float scale = 1;
+    if (stream->buffer.fb != 0)
+    {
+        scale = std::ceil(std::max(scale_x, scale_y) * 8) / 8.0;
+        scale = std::max(scale, 1.0f / 8);
+    }
 
-    /* TODO: investigate if this still works */
-    if (scaling > 2 && false)
-        ws_damage |= get_damage_box();
+    auto damage_box = get_damage_box();
+    if (scale != stream->scale_x || scale != stream->scale_y)
+    {
+        stream->scale_x = stream->scale_y = scale;
+        ws_damage |= damage_box;
+    }
 
     /* we don't have to update anything */
     if (ws_damage.empty())
         return;
 
-    if (scale_x != stream->scale_x || scale_y != stream->scale_y)
+    /* Translate the damage into the coordinate system of the stream buffer */
+    if (scale != 1)
     {
-        /* FIXME: enable scaled rendering */
-//        stream->scale_x = scale_x;
-//        stream->scale_y = scale_y;
-
-     //   ws_damage |= get_damage_box();
+        ws_damage *= scale;
+        damage_box.width = std::ceil(damage_box.width * scale);
+        damage_box.height = std::ceil(damage_box.height * scale);
+        ws_damage &= damage_box;
     }
 
-
     OpenGL::render_begin();
-    stream->buffer.allocate(output->handle->width, output->handle->height);
+    stream->buffer.allocate(std::ceil(output->handle->width * scale),
+                            std::ceil(output->handle->height * scale));
 
     auto fb = get_target_framebuffer();
     fb.fb = (stream->buffer.fb == 0) ? fb.fb : stream->buffer.fb;
     fb.tex = (stream->buffer.tex == 0) ? fb.tex : stream->buffer.tex;
+    if (stream->buffer.fb != 0)
+    {
+        fb.scale *= scale;
+        fb.viewport_width = stream->buffer.viewport_width;
+        fb.viewport_height = stream->buffer.viewport_height;
+    }
 
     {
+        static const wf_signal_id stream_pre_signal =
+            wf_get_signal_id("workspace-stream-pre");
+
         wf_stream_signal data(ws_damage, fb);
-        emit_signal("workspace-stream-pre", &data);
+        emit_signal(stream_pre_signal, &data);
     }
 
-    auto views = output->workspace->get_views_on_workspace(
+    auto views = output->workspace->get_views_on_workspace_shared(
         stream->ws, WF_VISIBLE_LAYERS, false);
 
     struct damaged_surface_t
@@ -622,7 +942,10 @@ void render_manager::workspace_stream_update(wf_workspace_stream *stream,
                 ds->surface = surface;
 
                 if (ds->surface->alpha >= 0.999f)
-                    ds->surface->subtract_opaque(ws_damage, x, y);
+                {
+                    subtract_scaled_opaque(ds->surface, ws_damage, x, y,
+                        output->handle->scale, scale);
+                }
 
                 to_render.push_back(std::move(ds));
             }
@@ -644,8 +967,21 @@ void render_manager::workspace_stream_update(wf_workspace_stream *stream,
         }
     }
 
-    auto it = views.begin();
-    while (it != views.end() && !ws_damage.empty())
+    /* Views completely covered by the opaque surfaces above them don't
+     * intersect the remaining damage, so we can skip them without visiting
+     * all of their surfaces */
+    const auto view_intersects_damage =
+        [&] (wayfire_view view, int view_dx, int view_dy)
+        {
+            auto bbox = view->get_bounding_box() + wf_point{-view_dx, -view_dy};
+            bbox = fb.damage_box_from_geometry_box(bbox);
+
+            auto extents = wlr_box_from_pixman_box(ws_damage.get_extents());
+            return extents & bbox;
+        };
+
+    auto it = views->begin();
+    while (it != views->end() && !ws_damage.empty())
     {
         auto view = *it;
         int view_dx = 0, view_dy = 0;
@@ -659,6 +995,9 @@ void render_manager::workspace_stream_update(wf_workspace_stream *stream,
             view_dy = dy;
         }
 
+        if (!view_intersects_damage(view, view_dx, view_dy))
+            goto next;
+
         /* We use the snapshot of a view if either condition is happening:
          * 1. The view has a transform
          * 2. The view is visible, but not mapped
@@ -678,13 +1017,6 @@ void render_manager::workspace_stream_update(wf_workspace_stream *stream,
         next: ++it;
     };
 
-    /*
-     TODO; implement scale != 1
-    glm::mat4 scale = glm::scale(glm::mat4(1.0), glm::vec3(scale_x, scale_y, 1));
-    glm::mat4 translate = glm::translate(glm::mat4(1.0), glm::vec3(scale_x - 1, scale_y - 1, 0));
-    std::swap(wayfire_view_transform::global_scale, scale);
-    std::swap(wayfire_view_transform::global_translate, translate);
-    */
     OpenGL::render_begin(fb);
     for (const auto& rect : ws_damage)
     {
@@ -705,9 +1037,6 @@ void render_manager::workspace_stream_update(wf_workspace_stream *stream,
         ++rev_it;
     }
 
-   // std::swap(wayfire_view_transform::global_scale, scale);
-   // std::swap(wayfire_view_transform::global_translate, translate);
-
     if (!renderer)
     {
         for (auto& icon : core->input->drag_icons)
@@ -718,8 +1047,11 @@ void render_manager::workspace_stream_update(wf_workspace_stream *stream,
     }
 
     {
+        static const wf_signal_id stream_post_signal =
+            wf_get_signal_id("workspace-stream-post");
+
         wf_stream_signal data(ws_damage, fb);
-        emit_signal("workspace-stream-post", &data);
+        emit_signal(stream_post_signal, &data);
     }
 }
 
@@ -728,4 +1060,50 @@ void render_manager::workspace_stream_stop(wf_workspace_stream *stream)
     stream->running = false;
 }
 
+int64_t render_manager::get_frame_time_percentile(wf_frame_phase phase,
+    float percentile)
+{
+    return frame_stats->percentile(phase, percentile);
+}
+
+size_t render_manager::get_recorded_frames_count()
+{
+    return frame_stats->recorded_frames;
+}
+
+void render_manager::dump_frame_stats(FILE *out)
+{
+    static const char *phase_names[WF_FRAME_PHASE_COUNT] = {
+        "pre-effects", "make-current", "render", "overlay-effects",
+        "sw-cursors", "post-effects", "swap", "post-paint", "total"
+    };
+
+    fprintf(out, "frame timings for output %s over the last %zu frames (usec):\n",
+        output->handle->name, get_recorded_frames_count());
+    for (int i = 0; i < WF_FRAME_PHASE_COUNT; i++)
+    {
+        auto phase = wf_frame_phase(i);
+        fprintf(out, "%16s: p50 %6lld p90 %6lld p99 %6lld max %6lld\n",
+            phase_names[i],
+            (long long)get_frame_time_percentile(phase, 50),
+            (long long)get_frame_time_percentile(phase, 90),
+            (long long)get_frame_time_percentile(phase, 99),
+            (long long)get_frame_time_percentile(phase, 100));
+    }
+
+    fprintf(out, "damage simplification: %llu frames, %llu rects merged into "
+        "%llu, %llu pixels overdrawn\n",
+        (unsigned long long)damage_stats.simplified_frames,
+        (unsigned long long)damage_stats.rects_before,
+        (unsigned long long)damage_stats.rects_after,
+        (unsigned long long)damage_stats.overdraw_area);
+
+    fflush(out);
+}
+
+wf_damage_simplification_stats render_manager::get_damage_simplification_stats()
+{
+    return damage_stats;
+}
+
 /* End render_manager */
@@ -1,6 +1,7 @@
 #include "util.hpp"
 #include <debug.hpp>
 #include <ctime>
+#include <algorithm>
 
 extern "C"
 {
@@ -83,34 +84,165 @@ pixman_box32_t pixman_box_from_wlr_box(const wlr_box& box)
     };
 }
 
+constexpr int wf_region::small_region_boxes;
+
+namespace
+{
+    /* Enough for the result of an operation on two small regions. Their boxes
+     * have at most 4 * small_region_boxes distinct y and x coordinates, which
+     * give fewer bands than that, each with at most half as many spans */
+    constexpr int small_op_max_boxes =
+        8 * wf_region::small_region_boxes * wf_region::small_region_boxes;
+
+    int sort_unique(int *values, int count)
+    {
+        std::sort(values, values + count);
+        return std::unique(values, values + count) - values;
+    }
+
+    bool covers(const pixman_box32_t *boxes, int count,
+        int x1, int y1, int x2, int y2)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            if (boxes[i].x1 <= x1 && boxes[i].y1 <= y1 &&
+                boxes[i].x2 >= x2 && boxes[i].y2 >= y2)
+            {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    bool same_spans(const pixman_box32_t *a, const pixman_box32_t *b, int count)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            if (a[i].x1 != b[i].x1 || a[i].x2 != b[i].x2)
+                return false;
+        }
+
+        return true;
+    }
+}
+
+/* Computes the result of op on two small regions in y-x banded form.
+ *
+ * The plane is split into cells along the edges of all boxes, and the cells
+ * in the result are joined into spans and bands. Bands which touch and have
+ * the same spans are coalesced, the same way pixman does, so the result has
+ * the same boxes pixman would produce. */
+static int small_region_op(const pixman_box32_t *a, int na,
+    const pixman_box32_t *b, int nb, bool keep_a_only, bool keep_b_only,
+    bool keep_both, pixman_box32_t *result)
+{
+    int ys[4 * wf_region::small_region_boxes], xs[4 * wf_region::small_region_boxes];
+    int nys = 0, nxs = 0;
+    auto add_edges = [&] (const pixman_box32_t *boxes, int count)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            ys[nys++] = boxes[i].y1;
+            ys[nys++] = boxes[i].y2;
+            xs[nxs++] = boxes[i].x1;
+            xs[nxs++] = boxes[i].x2;
+        }
+    };
+
+    add_edges(a, na);
+    add_edges(b, nb);
+
+    nys = sort_unique(ys, nys);
+    nxs = sort_unique(xs, nxs);
+
+    int count = 0;
+    /* The first box and the number of boxes of the last non-empty band */
+    int last_band = 0, last_band_size = 0;
+    for (int i = 0; i + 1 < nys; i++)
+    {
+        int y1 = ys[i], y2 = ys[i + 1];
+        int band = count;
+
+        for (int j = 0; j + 1 < nxs; j++)
+        {
+            int x1 = xs[j], x2 = xs[j + 1];
+            bool in_a = covers(a, na, x1, y1, x2, y2);
+            bool in_b = covers(b, nb, x1, y1, x2, y2);
+
+            bool inside = (in_a && in_b) ? keep_both :
+                in_a ? keep_a_only : in_b ? keep_b_only : false;
+            if (!inside)
+                continue;
+
+            if (count > band && result[count - 1].x2 == x1)
+                result[count - 1].x2 = x2;
+            else
+                result[count++] = {x1, y1, x2, y2};
+        }
+
+        int band_size = count - band;
+        if (band_size == 0)
+            continue;
+
+        if (band_size == last_band_size && result[last_band].y2 == y1 &&
+            same_spans(result + last_band, result + band, band_size))
+        {
+            for (int k = 0; k < band_size; k++)
+                result[last_band + k].y2 = y2;
+            count = band;
+        } else
+        {
+            last_band = band;
+            last_band_size = band_size;
+        }
+    }
+
+    return count;
+}
+
 wf_region::wf_region()
 {
-    pixman_region32_init(&_region);
 }
 
-wf_region::wf_region(pixman_region32_t *region) : wf_region()
+wf_region::wf_region(pixman_region32_t *region)
 {
-    pixman_region32_copy(this->to_pixman(), region);
+    int count;
+    auto boxes = pixman_region32_rectangles(region, &count);
+    if (count <= small_region_boxes)
+    {
+        set_boxes(boxes, count);
+    } else
+    {
+        pixman_region32_init(&_region);
+        pixman_region32_copy(&_region, region);
+        small_count = -1;
+    }
 }
 
 wf_region::wf_region(const wlr_box& box)
 {
-    pixman_region32_init_rect(&_region, box.x, box.y, box.width, box.height);
+    /* Like pixman, treat invalid boxes as an empty region */
+    if (box.width > 0 && box.height > 0)
+    {
+        small_boxes[0] = pixman_box_from_wlr_box(box);
+        small_count = 1;
+    }
 }
 
 wf_region:: ~wf_region()
 {
-    pixman_region32_fini(&_region);
+    release_pixman();
 }
 
-wf_region::wf_region(const wf_region& other) : wf_region()
+wf_region::wf_region(const wf_region& other)
 {
-    pixman_region32_copy(this->to_pixman(), other.unconst());
+    *this = other;
 }
 
-wf_region::wf_region(wf_region&& other) : wf_region()
+wf_region::wf_region(wf_region&& other)
 {
-    std::swap(this->_region, other._region);
+    *this = std::move(other);
 }
 
 wf_region& wf_region::operator = (const wf_region& other)
@@ -118,7 +250,18 @@ wf_region& wf_region::operator = (const wf_region& other)
     if (&other == this)
         return *this;
 
-    pixman_region32_copy(&_region, other.unconst());
+    if (other.small_count >= 0)
+    {
+        set_boxes(other.small_boxes, other.small_count);
+    } else
+    {
+        if (small_count >= 0)
+            pixman_region32_init(&_region);
+
+        pixman_region32_copy(&_region, other.unconst());
+        small_count = -1;
+    }
+
     return *this;
 }
 
@@ -127,18 +270,31 @@ wf_region& wf_region::operator = (wf_region&& other)
     if (&other == this)
         return *this;
 
-    std::swap(_region, other._region);
+    if (other.small_count >= 0)
+    {
+        set_boxes(other.small_boxes, other.small_count);
+        other.small_count = 0;
+    } else
+    {
+        take_pixman(&other._region);
+        other.small_count = 0;
+    }
+
     return *this;
 }
 
 bool wf_region::empty() const
 {
+    if (small_count >= 0)
+        return small_count == 0;
+
     return !pixman_region32_not_empty(this->unconst());
 }
 
 void wf_region::clear()
 {
-    pixman_region32_clear(&_region);
+    release_pixman();
+    small_count = 0;
 }
 
 void wf_region::expand_edges(int amount)
@@ -146,24 +302,53 @@ void wf_region::expand_edges(int amount)
     /* FIXME: make sure we don't throw pixman errors when amount is bigger
      * than a rectangle size */
     wlr_region_expand(this->to_pixman(), this->to_pixman(), amount);
+    shrink();
 }
 
 pixman_box32_t wf_region::get_extents() const
 {
-    return *pixman_region32_extents(this->unconst());
+    if (small_count < 0)
+        return *pixman_region32_extents(this->unconst());
+
+    if (small_count == 0)
+        return {0, 0, 0, 0};
+
+    /* Boxes are sorted by y, but not by x across bands */
+    pixman_box32_t extents = small_boxes[0];
+    extents.y2 = small_boxes[small_count - 1].y2;
+    for (int i = 1; i < small_count; i++)
+    {
+        extents.x1 = std::min(extents.x1, small_boxes[i].x1);
+        extents.x2 = std::max(extents.x2, small_boxes[i].x2);
+    }
+
+    return extents;
 }
 
 /* Translate the region */
 wf_region wf_region::operator + (const wf_point& vector) const
 {
     wf_region result{*this};
-    pixman_region32_translate(&result._region, vector.x, vector.y);
+    result += vector;
     return result;
 }
 
 wf_region& wf_region::operator += (const wf_point& vector)
 {
-    pixman_region32_translate(&_region, vector.x, vector.y);
+    if (small_count < 0)
+    {
+        pixman_region32_translate(&_region, vector.x, vector.y);
+        return *this;
+    }
+
+    for (int i = 0; i < small_count; i++)
+    {
+        small_boxes[i].x1 += vector.x;
+        small_boxes[i].y1 += vector.y;
+        small_boxes[i].x2 += vector.x;
+        small_boxes[i].y2 += vector.y;
+    }
+
     return *this;
 }
 
@@ -171,12 +356,14 @@ wf_region wf_region::operator * (float scale) const
 {
     wf_region result;
     wlr_region_scale(result.to_pixman(), this->unconst(), scale);
+    result.shrink();
     return result;
 }
 
 wf_region& wf_region::operator *= (float scale)
 {
     wlr_region_scale(this->to_pixman(), this->to_pixman(), scale);
+    shrink();
     return *this;
 }
 
@@ -184,32 +371,26 @@ wf_region& wf_region::operator *= (float scale)
 wf_region wf_region::operator & (const wlr_box& box) const
 {
     wf_region result;
-    pixman_region32_intersect_rect(result.to_pixman(), this->unconst(),
-        box.x, box.y, box.width, box.height);
-
+    result.set_op_result(*this, box, REGION_INTERSECT);
     return result;
 }
 
 wf_region wf_region::operator & (const wf_region& other) const
 {
     wf_region result;
-    pixman_region32_intersect(result.to_pixman(),
-        this->unconst(), other.unconst());
-
+    result.set_op_result(*this, other, REGION_INTERSECT);
     return result;
 }
 
 wf_region& wf_region::operator &= (const wlr_box& box)
 {
-    pixman_region32_intersect_rect(this->to_pixman(), this->to_pixman(),
-        box.x, box.y, box.width, box.height);
+    set_op_result(*this, box, REGION_INTERSECT);
     return *this;
 }
 
 wf_region& wf_region::operator &= (const wf_region& other)
 {
-    pixman_region32_intersect(this->to_pixman(),
-        this->to_pixman(), other.unconst());
+    set_op_result(*this, other, REGION_INTERSECT);
     return *this;
 }
 
@@ -217,28 +398,26 @@ wf_region& wf_region::operator &= (const wf_region& other)
 wf_region wf_region::operator | (const wlr_box& other) const
 {
     wf_region result;
-    pixman_region32_union_rect(result.to_pixman(), this->unconst(),
-        other.x, other.y, other.width, other.height);
+    result.set_op_result(*this, other, REGION_UNION);
     return result;
 }
 
 wf_region wf_region::operator | (const wf_region& other) const
 {
     wf_region result;
-    pixman_region32_union(result.to_pixman(), this->unconst(), other.unconst());
+    result.set_op_result(*this, other, REGION_UNION);
     return result;
 }
 
 wf_region& wf_region::operator |= (const wlr_box& other)
 {
-    pixman_region32_union_rect(this->to_pixman(), this->to_pixman(),
-        other.x, other.y, other.width, other.height);
+    set_op_result(*this, other, REGION_UNION);
     return *this;
 }
 
 wf_region& wf_region::operator |= (const wf_region& other)
 {
-    pixman_region32_union(this->to_pixman(), this->to_pixman(), other.unconst());
+    set_op_result(*this, other, REGION_UNION);
     return *this;
 }
 
@@ -246,57 +425,147 @@ wf_region& wf_region::operator |= (const wf_region& other)
 wf_region wf_region::operator ^ (const wlr_box& box) const
 {
     wf_region result;
-    wf_region sub{box};
-    pixman_region32_subtract(result.to_pixman(), this->unconst(), sub.to_pixman());
+    result.set_op_result(*this, box, REGION_SUBTRACT);
     return result;
 }
 
 wf_region wf_region::operator ^ (const wf_region& other) const
 {
     wf_region result;
-    pixman_region32_subtract(result.to_pixman(),
-        this->unconst(), other.unconst());
+    result.set_op_result(*this, other, REGION_SUBTRACT);
     return result;
 }
 
 wf_region& wf_region::operator ^= (const wlr_box& box)
 {
-    wf_region sub{box};
-    pixman_region32_subtract(this->to_pixman(),
-        this->to_pixman(), sub.to_pixman());
+    set_op_result(*this, box, REGION_SUBTRACT);
     return *this;
 }
 
 wf_region& wf_region::operator ^= (const wf_region& other)
 {
-    pixman_region32_subtract(this->to_pixman(),
-        this->to_pixman(), other.unconst());
+    set_op_result(*this, other, REGION_SUBTRACT);
     return *this;
 }
 
 pixman_region32_t *wf_region::to_pixman()
 {
-    return &_region;
+    return unconst();
 }
 
 pixman_region32_t* wf_region::unconst() const
 {
-    return const_cast<pixman_region32_t*> (&_region);
+    if (small_count >= 0)
+    {
+        pixman_region32_init_rects(&_region, small_boxes, small_count);
+        small_count = -1;
+    }
+
+    return &_region;
 }
 
 const pixman_box32_t* wf_region::begin() const
 {
+    if (small_count >= 0)
+        return small_boxes;
+
     int n;
     return pixman_region32_rectangles(unconst(), &n);
 }
 
 const pixman_box32_t* wf_region::end() const
 {
+    if (small_count >= 0)
+        return small_boxes + small_count;
+
     int n;
     auto data = pixman_region32_rectangles(unconst(), &n);
     return data + n;
 }
 
+void wf_region::set_boxes(const pixman_box32_t *boxes, int count)
+{
+    if (count > small_region_boxes)
+    {
+        release_pixman();
+        pixman_region32_init_rects(&_region, boxes, count);
+        small_count = -1;
+        return;
+    }
+
+    /* boxes may be our own small_boxes */
+    if (boxes != small_boxes)
+        std::copy(boxes, boxes + count, small_boxes);
+
+    release_pixman();
+    small_count = count;
+}
+
+void wf_region::take_pixman(pixman_region32_t *region)
+{
+    release_pixman();
+    _region = *region;
+    small_count = -1;
+    shrink();
+}
+
+void wf_region::release_pixman()
+{
+    if (small_count < 0)
+    {
+        pixman_region32_fini(&_region);
+        small_count = 0;
+    }
+}
+
+void wf_region::shrink()
+{
+    if (small_count >= 0)
+        return;
+
+    int count;
+    auto boxes = pixman_region32_rectangles(&_region, &count);
+    if (count > small_region_boxes)
+        return;
+
+    std::copy(boxes, boxes + count, small_boxes);
+    pixman_region32_fini(&_region);
+    small_count = count;
+}
+
+void wf_region::set_op_result(const wf_region& a, const wf_region& b,
+    region_op_t op)
+{
+    if (a.small_count >= 0 && b.small_count >= 0)
+    {
+        pixman_box32_t result[small_op_max_boxes];
+        int count = small_region_op(a.small_boxes, a.small_count,
+            b.small_boxes, b.small_count,
+            op != REGION_INTERSECT, op == REGION_UNION, op != REGION_SUBTRACT,
+            result);
+
+        set_boxes(result, count);
+        return;
+    }
+
+    pixman_region32_t result;
+    pixman_region32_init(&result);
+    switch (op)
+    {
+        case REGION_UNION:
+            pixman_region32_union(&result, a.unconst(), b.unconst());
+            break;
+        case REGION_INTERSECT:
+            pixman_region32_intersect(&result, a.unconst(), b.unconst());
+            break;
+        case REGION_SUBTRACT:
+            pixman_region32_subtract(&result, a.unconst(), b.unconst());
+            break;
+    }
+
+    take_pixman(&result);
+}
+
 /* Misc helper functions */
 int64_t timespec_to_msec(const timespec& ts)
 {
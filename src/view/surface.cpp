@@ -3,12 +3,15 @@ extern "C"
 {
 #define static
 #include <wlr/render/wlr_renderer.h>
+#include <wlr/render/gles2.h>
 #include <wlr/types/wlr_matrix.h>
 #include <wlr/types/wlr_buffer.h>
 #include <wlr/util/region.h>
 #undef static
 }
 
+#include <glm/gtc/matrix_transform.hpp>
+
 #include "priv-view.hpp"
 #include "opengl.hpp"
 #include "core.hpp"
@@ -211,13 +214,15 @@ wf_geometry wayfire_surface_t::get_output_geometry()
 
 void emit_map_state_change(wayfire_surface_t *surface)
 {
-    std::string state = surface->is_mapped() ? "_surface_mapped" : "_surface_unmapped";
+    static const wf_signal_id mapped_signal = wf_get_signal_id("_surface_mapped");
+    static const wf_signal_id unmapped_signal = wf_get_signal_id("_surface_unmapped");
+
     wayfire_output *wo = surface->get_output();
     if (!wo) return;
 
     _surface_map_state_changed_signal data;
     data.surface = surface;
-    wo->emit_signal(state, &data);
+    wo->emit_signal(surface->is_mapped() ? mapped_signal : unmapped_signal, &data);
 }
 
 void wayfire_surface_t::map(wlr_surface *surface)
@@ -418,25 +423,24 @@ void wayfire_surface_t::for_each_surface(wf_surface_iterator_callback call, bool
     for_each_surface_recursive(call, pos.x, pos.y, reverse);
 }
 
-void wayfire_surface_t::_wlr_render_box(const wf_framebuffer& fb, int x, int y, const wlr_box& scissor)
+/* Computes the matrix used to render the surface buffer at the given
+ * coordinates of the framebuffer */
+static void get_surface_render_matrix(float matrix[9], const wf_framebuffer& fb,
+    const wlr_box& damage_box, wl_output_transform surface_transform)
 {
-    if (!get_buffer())
-        return;
-
-    wlr_box geometry {x, y, surface->current.width, surface->current.height};
-    geometry = fb.damage_box_from_geometry_box(geometry);
-
     float projection[9];
     wlr_matrix_projection(projection, fb.viewport_width, fb.viewport_height,
         (wl_output_transform)fb.wl_transform);
 
-    float matrix[9];
-    wlr_matrix_project_box(matrix, &geometry, wlr_output_transform_invert(surface->current.transform),
-                           0, projection);
+    wlr_matrix_project_box(matrix, &damage_box,
+        wlr_output_transform_invert(surface_transform), 0, projection);
+}
 
-    OpenGL::render_begin(fb);
-    auto sbox = scissor; wlr_renderer_scissor(core->renderer, &sbox);
-    wlr_render_texture_with_matrix(core->renderer, get_buffer()->texture, matrix, alpha);
+static void render_surface_texture(wlr_texture *texture, const float matrix[9],
+    float alpha, wlr_box scissor, const wf_framebuffer& fb)
+{
+    wlr_renderer_scissor(core->renderer, &scissor);
+    wlr_render_texture_with_matrix(core->renderer, texture, matrix, alpha);
 
 #ifdef WAYFIRE_GRAPHICS_DEBUG
     float scissor_proj[9];
@@ -446,17 +450,154 @@ void wayfire_surface_t::_wlr_render_box(const wf_framebuffer& fb, int x, int y,
     float col[4] = {0, 0.2, 0, 0.5};
     wlr_render_rect(core->renderer, &scissor, col, scissor_proj);
 #endif
+}
+
+/* Draws the damaged parts of a client texture with the OpenGL batch API, so
+ * that all of them take a single draw call instead of one per rectangle.
+ *
+ * geometry and damage are in damage coordinates. Returns false if the texture
+ * can't be drawn by our shader, then it has to be drawn by wlroots. */
+static bool render_surface_damage_batched(wlr_texture *texture,
+    wl_output_transform transform, float alpha, const wlr_box& geometry,
+    const wf_region& damage, const wf_framebuffer& fb)
+{
+    /* Buffer transforms and rotated framebuffers would need their own
+     * texture coordinates, wlroots handles them in its matrix */
+    if (!wlr_texture_is_gles2(texture) ||
+        transform != WL_OUTPUT_TRANSFORM_NORMAL || fb.has_nonstandard_transform)
+    {
+        return false;
+    }
 
+    wlr_gles2_texture_attribs attribs;
+    wlr_gles2_texture_get_attribs(texture, &attribs);
+
+    /* Our shader samples only GL_TEXTURE_2D, and uses the alpha channel, which
+     * is undefined for RGBX buffers */
+    if (attribs.target != GL_TEXTURE_2D || !attribs.has_alpha)
+        return false;
+
+    /* wlroots sets the filter each time it renders a texture, the default one
+     * needs mipmaps which client textures don't have */
+    GL_CALL(glBindTexture(GL_TEXTURE_2D, attribs.tex));
+    GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR));
+    GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
+
+    /* Damage coordinates are the output-local coordinates, scaled by the
+     * framebuffer scale */
+    auto projection = fb.get_orthographic_projection() *
+        glm::translate(glm::mat4(1.0),
+            glm::vec3(fb.geometry.x, fb.geometry.y, 0.0)) *
+        glm::scale(glm::mat4(1.0),
+            glm::vec3(1.0 / fb.scale, 1.0 / fb.scale, 1.0));
+
+    /* The first row of client buffers is the top one, unless they are
+     * y-inverted */
+    uint32_t bits = attribs.inverted_y ? 0 : TEXTURE_TRANSFORM_INVERT_Y;
+
+    gl_geometry g = {
+        (float)geometry.x, (float)geometry.y,
+        (float)(geometry.x + geometry.width),
+        (float)(geometry.y + geometry.height),
+    };
+
+    wlr_renderer_scissor(core->renderer, NULL);
+    OpenGL::begin_batch(attribs.tex, projection, glm::vec4(1, 1, 1, alpha), bits);
+    for (const auto& rect : damage)
+    {
+        OpenGL::add_quad(g, {},
+            {(float)rect.x1, (float)rect.y1, (float)rect.x2, (float)rect.y2});
+    }
+
+    OpenGL::flush();
+
+#ifdef WAYFIRE_GRAPHICS_DEBUG
+    float scissor_proj[9];
+    wlr_matrix_projection(scissor_proj, fb.viewport_width, fb.viewport_height,
+        WL_OUTPUT_TRANSFORM_NORMAL);
+
+    float col[4] = {0, 0.2, 0, 0.5};
+    for (const auto& rect : damage)
+    {
+        auto box = fb.framebuffer_box_from_damage_box(wlr_box_from_pixman_box(rect));
+        wlr_render_rect(core->renderer, &box, col, scissor_proj);
+    }
+#endif
+
+    return true;
+}
+
+void wayfire_surface_t::_wlr_render_box(const wf_framebuffer& fb, int x, int y, const wlr_box& scissor)
+{
+    if (!get_buffer())
+        return;
+
+    wlr_box geometry {x, y, surface->current.width, surface->current.height};
+    geometry = fb.damage_box_from_geometry_box(geometry);
+
+    float matrix[9];
+    get_surface_render_matrix(matrix, fb, geometry, surface->current.transform);
+
+    OpenGL::render_begin(fb);
+    render_surface_texture(get_buffer()->texture, matrix, alpha, scissor, fb);
     OpenGL::render_end();
 }
 
 void wayfire_surface_t::simple_render(const wf_framebuffer& fb, int x, int y, const wf_region& damage)
 {
-    for (const auto& rect : damage)
+    /* Surfaces without a client buffer (decorations, color views, etc.)
+     * implement _wlr_render_box() to draw themselves */
+    if (!get_buffer())
+    {
+        for (const auto& rect : damage)
+        {
+            auto box = wlr_box_from_pixman_box(rect);
+            _wlr_render_box(fb, x, y, fb.framebuffer_box_from_damage_box(box));
+        }
+
+        return;
+    }
+
+    wlr_box geometry {x, y, surface->current.width, surface->current.height};
+    geometry = fb.damage_box_from_geometry_box(geometry);
+
+    /* Parts of the damage outside of the surface don't need a draw call */
+    wf_region surface_damage = damage & geometry;
+    if (surface_damage.empty())
+        return;
+
+    auto texture = get_buffer()->texture;
+    OpenGL::render_begin(fb);
+
+    if (render_surface_damage_batched(texture, surface->current.transform,
+            alpha, geometry, surface_damage, fb))
+    {
+        OpenGL::render_end();
+        return;
+    }
+
+    /* The matrix and the renderer state are the same for all damaged
+     * rectangles, so we set them up only once per surface */
+    float matrix[9];
+    get_surface_render_matrix(matrix, fb, geometry, surface->current.transform);
+
+    /* Clients often damage the whole surface, then we draw it just once,
+     * instead of once per damaged rectangle */
+    if ((wf_region{geometry} ^ surface_damage).empty())
+    {
+        render_surface_texture(texture, matrix, alpha,
+            fb.framebuffer_box_from_damage_box(geometry), fb);
+    } else
     {
-        auto box = wlr_box_from_pixman_box(rect);
-        _wlr_render_box(fb, x, y, fb.framebuffer_box_from_damage_box(box));
+        for (const auto& rect : surface_damage)
+        {
+            auto box = wlr_box_from_pixman_box(rect);
+            render_surface_texture(texture, matrix, alpha,
+                fb.framebuffer_box_from_damage_box(box), fb);
+        }
     }
+
+    OpenGL::render_end();
 }
 
 void wayfire_surface_t::render_fb(const wf_region& damage, const wf_framebuffer& fb)
@@ -132,8 +132,8 @@ wf_point wf_2D_view::transformed_to_local_point(wf_geometry geometry, wf_point p
                                              {(int32_t) x, (int32_t) y});
 }
 
-void wf_2D_view::render_box(uint32_t src_tex, wlr_box src_box,
-    wlr_box scissor_box, const wf_framebuffer& fb)
+glm::mat4 wf_2D_view::get_render_transform(wlr_box src_box,
+    const wf_framebuffer& fb, gl_geometry& geometry, glm::vec2& offset)
 {
     auto quad = center_geometry(fb.geometry, src_box, get_center(view->get_wm_geometry()));
 
@@ -141,24 +141,81 @@ void wf_2D_view::render_box(uint32_t src_tex, wlr_box src_box,
     quad.geometry.x2 *= scale_x;
     quad.geometry.y1 *= scale_y;
     quad.geometry.y2 *= scale_y;
+    geometry = quad.geometry;
+    offset = {quad.off_x + translation_x, quad.off_y - translation_y};
 
     auto rotate = glm::rotate(glm::mat4(1.0), angle, {0, 0, 1});
-    auto translate = glm::translate(glm::mat4(1.0),
-                                    {quad.off_x + translation_x,
-                                     quad.off_y - translation_y, 0});
+    auto translate = glm::translate(glm::mat4(1.0), {offset.x, offset.y, 0});
 
     auto ortho = glm::ortho(-fb.geometry.width  / 2.0f, fb.geometry.width  / 2.0f,
                             -fb.geometry.height / 2.0f, fb.geometry.height / 2.0f);
 
-    auto transform = fb.transform * ortho * translate * rotate;
+    return fb.transform * ortho * translate * rotate;
+}
+
+void wf_2D_view::render_with_damage(uint32_t src_tex, wlr_box src_box,
+    const wf_region& damage, const wf_framebuffer& fb)
+{
+    /* The damage can't be expressed as clip boxes of a rotated quad */
+    if (angle != 0.0f)
+    {
+        return wf_view_transformer_t::render_with_damage(src_tex, src_box,
+            damage, fb);
+    }
+
+    gl_geometry quad;
+    glm::vec2 offset;
+    auto transform = get_render_transform(src_box, fb, quad, offset);
+
+    OpenGL::render_begin(fb);
+    OpenGL::begin_batch(src_tex, transform, {1.0f, 1.0f, 1.0f, alpha});
+    for (const auto& rect : damage)
+    {
+        /* Damage is relative to the framebuffer and scaled, map it to the
+         * coordinate system of the quad */
+        float half_width = fb.geometry.width / 2.0f;
+        float half_height = fb.geometry.height / 2.0f;
+        gl_geometry clip = {
+            rect.x1 / fb.scale - half_width - offset.x,
+            half_height - rect.y2 / fb.scale - offset.y,
+            rect.x2 / fb.scale - half_width - offset.x,
+            half_height - rect.y1 / fb.scale - offset.y,
+        };
+
+        OpenGL::add_quad(quad, {}, clip);
+    }
+    OpenGL::flush();
+    OpenGL::render_end();
+}
+
+void wf_2D_view::render_box(uint32_t src_tex, wlr_box src_box,
+    wlr_box scissor_box, const wf_framebuffer& fb)
+{
+    gl_geometry quad;
+    glm::vec2 offset;
+    auto transform = get_render_transform(src_box, fb, quad, offset);
 
     OpenGL::render_begin(fb);
     fb.scissor(scissor_box);
-    OpenGL::render_transformed_texture(src_tex, quad.geometry, {},
+    OpenGL::render_transformed_texture(src_tex, quad, {},
                                        transform, {1.0f, 1.0f, 1.0f, alpha});
     OpenGL::render_end();
 }
 
+uint64_t wf_2D_view::get_generation()
+{
+    std::array<float, 6> params = {angle, scale_x, scale_y,
+        translation_x, translation_y, alpha};
+
+    if (params != last_params)
+    {
+        last_params = params;
+        damage();
+    }
+
+    return generation;
+}
+
 const float wf_3D_view::fov = PI/4;
 glm::mat4 wf_3D_view::default_view_matrix()
 {
@@ -179,6 +236,23 @@ wf_3D_view::wf_3D_view(wayfire_view view)
     view_proj = default_proj_matrix() * default_view_matrix();
 }
 
+uint64_t wf_3D_view::get_generation()
+{
+    if (view_proj != last_view_proj || translation != last_translation ||
+        rotation != last_rotation || scaling != last_scaling ||
+        color != last_color)
+    {
+        last_view_proj = view_proj;
+        last_translation = translation;
+        last_rotation = rotation;
+        last_scaling = scaling;
+        last_color = color;
+        damage();
+    }
+
+    return generation;
+}
+
 /* TODO: cache total_transform, because it is often unnecessarily recomputed */
 glm::mat4 wf_3D_view::calculate_total_transform()
 {
@@ -760,7 +760,9 @@ void wayfire_view_t::damage_raw(const wlr_box& box)
         output->render->damage(damage_box);
     }
 
-    emit_signal("damaged-region", nullptr);
+    static const wf_signal_id damaged_region_signal =
+        wf_get_signal_id("damaged-region");
+    emit_signal(damaged_region_signal, nullptr);
 }
 
 void wayfire_view_t::damage(const wlr_box& box)
@@ -768,8 +770,13 @@ void wayfire_view_t::damage(const wlr_box& box)
     if (!output)
         return;
 
+    /* Damage isn't cached without a transformer, so the snapshot (if any)
+     * has to be redrawn fully the next time it is needed */
     if (!has_transformer())
+    {
+        last_offscreen_buffer_age = -1;
         return damage_raw(box);
+    }
 
     auto wm_geometry = get_wm_geometry();
 
@@ -778,6 +785,7 @@ void wayfire_view_t::damage(const wlr_box& box)
     real_box.y -= wm_geometry.y;
 
     offscreen_buffer.cached_damage |= real_box;
+    transformer_damage |= real_box;
     damage_raw(transform_region(box));
 }
 
@@ -799,10 +807,19 @@ void wayfire_view_t::take_snapshot()
     auto buffer_geometry = get_untransformed_bounding_box();
     offscreen_buffer.geometry = buffer_geometry;
 
+    /* cached_damage is relative to the WM geometry */
+    auto wm_geometry = get_wm_geometry();
+    wf_point wm_offset = {
+        wm_geometry.x - buffer_geometry.x,
+        wm_geometry.y - buffer_geometry.y
+    };
+
     float scale = output->handle->scale;
     if (int(buffer_geometry.width  * scale) != offscreen_buffer.viewport_width ||
         int(buffer_geometry.height * scale) != offscreen_buffer.viewport_height ||
-        offscreen_buffer.scale != scale)
+        offscreen_buffer.scale != scale ||
+        wm_offset.x != last_offscreen_wm_offset.x ||
+        wm_offset.y != last_offscreen_wm_offset.y)
     {
         // scale/size changed, invalidate offscreen buffer
         last_offscreen_buffer_age = -1;
@@ -812,21 +829,42 @@ void wayfire_view_t::take_snapshot()
     if (buffer_age <= last_offscreen_buffer_age)
         return;
 
+    bool full_redraw = (last_offscreen_buffer_age < 0);
     last_offscreen_buffer_age = buffer_age;
+    last_offscreen_wm_offset = wm_offset;
 
     OpenGL::render_begin();
-    offscreen_buffer.allocate(buffer_geometry.width * scale, buffer_geometry.height * scale);
+    full_redraw |= offscreen_buffer.allocate(
+        buffer_geometry.width * scale, buffer_geometry.height * scale);
     offscreen_buffer.scale = scale;
+
+    /* Redraw only the parts of the snapshot which were damaged since the
+     * last time, the rest of the buffer is still valid */
+    wlr_box full_box = {0, 0,
+        offscreen_buffer.viewport_width, offscreen_buffer.viewport_height};
+
+    wf_region redraw_region{full_box};
+    offscreen_buffer_redrawn |= full_redraw;
+    if (!full_redraw)
+    {
+        redraw_region = (offscreen_buffer.cached_damage + wm_offset) * scale;
+        redraw_region &= full_box;
+    }
+    offscreen_buffer.cached_damage.clear();
+
     offscreen_buffer.bind();
-    OpenGL::clear({0, 0, 0, 0});
+    for (const auto& rect : redraw_region)
+    {
+        offscreen_buffer.scissor(offscreen_buffer.framebuffer_box_from_damage_box(
+                wlr_box_from_pixman_box(rect)));
+        OpenGL::clear({0, 0, 0, 0});
+    }
     OpenGL::render_end();
 
-    wf_region full_region{{0, 0, offscreen_buffer.viewport_width,
-        offscreen_buffer.viewport_height}};
     for_each_surface([=] (wayfire_surface_t *surface, int x, int y)
     {
         surface->simple_render(offscreen_buffer,
-            x - buffer_geometry.x, y - buffer_geometry.y, full_region);
+            x - buffer_geometry.x, y - buffer_geometry.y, redraw_region);
     }, true);
 }
 
@@ -844,6 +882,21 @@ void wayfire_view_t::render_fb(const wf_region& damaged_region, const wf_framebu
     obox.width = offscreen_buffer.geometry.width;
     obox.height = offscreen_buffer.geometry.height;
 
+    /* The offscreen buffers of the transformers are kept between frames, and
+     * only the parts affected by the damage of the view are rendered again.
+     * The damage is carried from one transformer to the next by mapping it
+     * with get_bounding_box().
+     *
+     * Transformers whose parameters change without damaging the view bump
+     * their generation, and then they are rendered from scratch. */
+    auto wm_geometry = get_wm_geometry();
+    wf_region stage_damage =
+        transformer_damage + wf_point{wm_geometry.x, wm_geometry.y};
+    transformer_damage.clear();
+
+    bool full_redraw = offscreen_buffer_redrawn;
+    offscreen_buffer_redrawn = false;
+
     /* We keep a shared_ptr to the previous transform which we executed, so that
      * even if it gets removed, its texture remains valid.
      *
@@ -852,6 +905,7 @@ void wayfire_view_t::render_fb(const wf_region& damaged_region, const wf_framebu
      * We only know that the texture is still alive. */
     std::shared_ptr<transform_t> previous_transform = nullptr;
     GLuint previous_texture = offscreen_buffer.tex;
+    uint64_t previous_serial = 0;
 
     /* final_transform is the one that should render to the screen */
     std::shared_ptr<transform_t> final_transform = nullptr;
@@ -868,22 +922,67 @@ void wayfire_view_t::render_fb(const wf_region& damaged_region, const wf_framebu
         /* Calculate size after this transform */
         auto transformed_box = transform->transform->get_bounding_box(obox, obox);
 
+        /* Map the damage through the transform, with a pixel of margin to
+         * account for rounding in get_bounding_box() */
+        wf_region transformed_damage;
+        for (const auto& rect : stage_damage)
+        {
+            auto box = transform->transform->get_bounding_box(obox,
+                wlr_box_from_pixman_box(rect));
+            transformed_damage |= wlr_box{box.x - 1, box.y - 1,
+                box.width + 2, box.height + 2};
+        }
+
+        auto generation = transform->transform->get_generation();
+        bool stage_full_redraw = full_redraw || !transform->fb_valid ||
+            transform->last_source != previous_serial ||
+            transform->last_generation != generation ||
+            transform->last_input_box != obox ||
+            transform->last_output_box != transformed_box;
+
         /* Prepare buffer to store result after the transform */
         OpenGL::render_begin();
-        transform->fb.allocate(transformed_box.width, transformed_box.height);
+        stage_full_redraw |= transform->fb.allocate(
+            transformed_box.width, transformed_box.height);
         transform->fb.geometry = transformed_box;
+
+        wlr_box full_box = {0, 0, transformed_box.width, transformed_box.height};
+        wf_region redraw_region{full_box};
+        if (!stage_full_redraw)
+        {
+            redraw_region = transformed_damage +
+                wf_point{-transformed_box.x, -transformed_box.y};
+            redraw_region &= full_box;
+        }
+
         transform->fb.bind(); // bind buffer to clear
-        OpenGL::clear({0, 0, 0, 0});
+        for (const auto& rect : redraw_region)
+        {
+            transform->fb.scissor(transform->fb.framebuffer_box_from_damage_box(
+                    wlr_box_from_pixman_box(rect)));
+            OpenGL::clear({0, 0, 0, 0});
+        }
         OpenGL::render_end();
 
         /* Actually render the transform to the next framebuffer */
-        wf_region whole_region{wlr_box{0, 0,
-            transformed_box.width, transformed_box.height}};
-        transform->transform->render_with_damage(previous_texture, obox,
-            whole_region, transform->fb);
+        if (!redraw_region.empty())
+        {
+            transform->transform->render_with_damage(previous_texture, obox,
+                redraw_region, transform->fb);
+        }
+
+        transform->fb_valid = true;
+        transform->last_source = previous_serial;
+        transform->last_generation = generation;
+        transform->last_input_box = obox;
+        transform->last_output_box = transformed_box;
+
+        stage_damage = stage_full_redraw ?
+            wf_region{transformed_box} : transformed_damage;
 
         previous_transform = transform;
         previous_texture = previous_transform->fb.tex;
+        previous_serial = previous_transform->serial;
         obox = transformed_box;
     });
 
@@ -899,11 +998,20 @@ void wayfire_view_t::render_fb(const wf_region& damaged_region, const wf_framebu
             1.0f * obox.y + 1.0f * obox.height,
         };
 
+        /* Damage is relative to the framebuffer geometry and scaled */
+        OpenGL::begin_batch(previous_texture, matrix);
         for (const auto& rect : damaged_region)
         {
-            fb.scissor(wlr_box_from_pixman_box(rect));
-            OpenGL::render_transformed_texture(previous_texture, src_geometry, {}, matrix);
+            gl_geometry clip = {
+                fb.geometry.x + rect.x1 / fb.scale,
+                fb.geometry.y + rect.y1 / fb.scale,
+                fb.geometry.x + rect.x2 / fb.scale,
+                fb.geometry.y + rect.y2 / fb.scale,
+            };
+
+            OpenGL::add_quad(src_geometry, {}, clip);
         }
+        OpenGL::flush();
 
         OpenGL::render_end();
     } else
@@ -914,7 +1022,11 @@ void wayfire_view_t::render_fb(const wf_region& damaged_region, const wf_framebu
     }
 }
 
-wayfire_view_t::transform_t::transform_t() {}
+wayfire_view_t::transform_t::transform_t()
+{
+    static uint64_t last_serial = 0;
+    serial = ++last_serial;
+}
 wayfire_view_t::transform_t::~transform_t()
 {
     OpenGL::render_begin();
@@ -922,6 +1034,13 @@ wayfire_view_t::transform_t::~transform_t()
     OpenGL::render_end();
 }
 
+static void emit_transformer_changed(wayfire_view view)
+{
+    transformer_changed_signal data;
+    data.view = view;
+    view->emit_signal("transformer-changed", &data);
+}
+
 void wayfire_view_t::add_transformer(std::unique_ptr<wf_view_transformer_t> transformer, std::string name)
 {
     damage();
@@ -929,14 +1048,18 @@ void wayfire_view_t::add_transformer(std::unique_ptr<wf_view_transformer_t> tran
     tr->transform = std::move(transformer);
     tr->plugin_name = name;
 
-    transforms.emplace_at(std::move(tr), [&] (auto& other)
+    /* The check may run after tr is moved into the list, if transformers are
+     * being iterated right now */
+    auto z_order = tr->transform->get_z_order();
+    transforms.emplace_at(std::move(tr), [=] (auto& other)
     {
-        if (other->transform->get_z_order() >= tr->transform->get_z_order())
+        if (other->transform->get_z_order() >= z_order)
             return transforms.INSERT_BEFORE;
         return transforms.INSERT_NONE;
     });
 
     damage();
+    emit_transformer_changed(self());
 }
 
 void wayfire_view_t::add_transformer(std::unique_ptr<wf_view_transformer_t> transformer)
@@ -965,6 +1088,7 @@ void wayfire_view_t::pop_transformer(nonstd::observer_ptr<wf_view_transformer_t>
     });
 
     output->render->damage_whole_idle();
+    emit_transformer_changed(self());
 }
 
 void wayfire_view_t::pop_transformer(std::string name)
@@ -975,6 +1099,7 @@ void wayfire_view_t::pop_transformer(std::string name)
     });
 
     output->render->damage_whole();
+    emit_transformer_changed(self());
 }
 
 bool wayfire_view_t::has_transformer()
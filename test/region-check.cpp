@@ -0,0 +1,270 @@
+/* region-check: applies random sequences of operations to wf_regions and to
+ * pixman regions side by side, and checks that both end up with the same
+ * boxes. The coordinates are kept small, so that regions often grow past
+ * wf_region::small_region_boxes and shrink back again, exercising the
+ * transitions between inline and pixman storage.
+ *
+ * Exits with a non-zero status on the first mismatch. */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <utility>
+
+#include <util.hpp>
+
+static std::mt19937 rng;
+
+static int random_int(int min, int max)
+{
+    return std::uniform_int_distribution<int>(min, max)(rng);
+}
+
+static wlr_box random_box()
+{
+    /* Empty boxes are valid input too */
+    return {random_int(-2, 12), random_int(-2, 12),
+        random_int(0, 8), random_int(0, 8)};
+}
+
+/* A wf_region together with the pixman region it should be equal to */
+struct checked_region_t
+{
+    wf_region region;
+    pixman_region32_t expected;
+
+    checked_region_t()
+    {
+        pixman_region32_init(&expected);
+    }
+
+    ~checked_region_t()
+    {
+        pixman_region32_fini(&expected);
+    }
+};
+
+static void init_box(pixman_region32_t *region, const wlr_box& box)
+{
+    pixman_region32_init_rect(region, box.x, box.y, box.width, box.height);
+}
+
+static void print_boxes(const char *name, const pixman_box32_t *begin,
+    const pixman_box32_t *end)
+{
+    std::fprintf(stderr, "  %s:", name);
+    for (auto box = begin; box != end; ++box)
+        std::fprintf(stderr, " (%d,%d %d,%d)", box->x1, box->y1, box->x2, box->y2);
+    std::fprintf(stderr, "\n");
+}
+
+static bool matches(const checked_region_t& r)
+{
+    int count;
+    auto expected = pixman_region32_rectangles(
+        const_cast<pixman_region32_t*> (&r.expected), &count);
+
+    bool equal = (r.region.end() - r.region.begin() == count) &&
+        std::memcmp(r.region.begin(), expected, count * sizeof(*expected)) == 0;
+
+    bool expected_empty = !pixman_region32_not_empty(
+        const_cast<pixman_region32_t*> (&r.expected));
+    equal &= r.region.empty() == expected_empty;
+
+    if (!expected_empty)
+    {
+        auto a = r.region.get_extents();
+        auto b = *pixman_region32_extents(
+            const_cast<pixman_region32_t*> (&r.expected));
+        equal &= std::memcmp(&a, &b, sizeof(a)) == 0;
+    }
+
+    if (!equal)
+    {
+        print_boxes("wf_region", r.region.begin(), r.region.end());
+        print_boxes("pixman", expected, expected + count);
+    }
+
+    return equal;
+}
+
+enum op_t
+{
+    OP_UNION_BOX,
+    OP_INTERSECT_BOX,
+    OP_SUBTRACT_BOX,
+    OP_UNION,
+    OP_INTERSECT,
+    OP_SUBTRACT,
+    OP_UNION_ASSIGN,
+    OP_INTERSECT_ASSIGN,
+    OP_SUBTRACT_ASSIGN,
+    OP_UNION_SELF,
+    OP_INTERSECT_SELF,
+    OP_SUBTRACT_SELF,
+    OP_TRANSLATE,
+    OP_COPY,
+    OP_MOVE,
+    OP_FROM_PIXMAN,
+    OP_TO_PIXMAN,
+    OP_CLEAR,
+    OP_COUNT,
+};
+
+static const char *op_names[] = {
+    "|= box", "&= box", "^= box", "a | b", "a & b", "a ^ b", "|= other",
+    "&= other", "^= other", "|= self", "&= self", "^= self", "+= vector",
+    "copy", "move", "from pixman", "to_pixman", "clear",
+};
+
+/* Apply a random operation to r, possibly using other as second operand */
+static op_t apply_random_op(checked_region_t& r, checked_region_t& other)
+{
+    auto op = static_cast<op_t> (random_int(0, OP_COUNT - 1));
+    auto box = random_box();
+
+    pixman_region32_t tmp;
+    pixman_region32_init(&tmp);
+
+    switch (op)
+    {
+        case OP_UNION_BOX:
+            r.region |= box;
+            init_box(&tmp, box);
+            pixman_region32_union(&r.expected, &r.expected, &tmp);
+            break;
+        case OP_INTERSECT_BOX:
+            r.region &= box;
+            init_box(&tmp, box);
+            pixman_region32_intersect(&r.expected, &r.expected, &tmp);
+            break;
+        case OP_SUBTRACT_BOX:
+            r.region ^= box;
+            init_box(&tmp, box);
+            pixman_region32_subtract(&r.expected, &r.expected, &tmp);
+            break;
+        case OP_UNION:
+            r.region = r.region | other.region;
+            pixman_region32_union(&r.expected, &r.expected, &other.expected);
+            break;
+        case OP_INTERSECT:
+            r.region = other.region & r.region;
+            pixman_region32_intersect(&r.expected, &other.expected, &r.expected);
+            break;
+        case OP_SUBTRACT:
+            r.region = other.region ^ r.region;
+            pixman_region32_subtract(&r.expected, &other.expected, &r.expected);
+            break;
+        case OP_UNION_ASSIGN:
+            r.region |= other.region;
+            pixman_region32_union(&r.expected, &r.expected, &other.expected);
+            break;
+        case OP_INTERSECT_ASSIGN:
+            r.region &= other.region;
+            pixman_region32_intersect(&r.expected, &r.expected, &other.expected);
+            break;
+        case OP_SUBTRACT_ASSIGN:
+            r.region ^= other.region;
+            pixman_region32_subtract(&r.expected, &r.expected, &other.expected);
+            break;
+        case OP_UNION_SELF:
+            r.region |= r.region;
+            break;
+        case OP_INTERSECT_SELF:
+            r.region &= r.region;
+            break;
+        case OP_SUBTRACT_SELF:
+            r.region ^= r.region;
+            pixman_region32_clear(&r.expected);
+            break;
+        case OP_TRANSLATE:
+        {
+            wf_point vector = {random_int(-3, 3), random_int(-3, 3)};
+            r.region += vector;
+            pixman_region32_translate(&r.expected, vector.x, vector.y);
+            break;
+        }
+        case OP_COPY:
+        {
+            wf_region copy = other.region;
+            r.region = copy;
+            pixman_region32_copy(&r.expected, &other.expected);
+            break;
+        }
+        case OP_MOVE:
+        {
+            wf_region copy = other.region;
+            r.region = std::move(copy);
+            pixman_region32_copy(&r.expected, &other.expected);
+            break;
+        }
+        case OP_FROM_PIXMAN:
+            r.region = wf_region{&other.expected};
+            pixman_region32_copy(&r.expected, &other.expected);
+            break;
+        case OP_TO_PIXMAN:
+            /* Forces the region to pixman storage, without changing it */
+            pixman_region32_copy(&tmp, r.region.to_pixman());
+            break;
+        case OP_CLEAR:
+            r.region.clear();
+            pixman_region32_clear(&r.expected);
+            break;
+        case OP_COUNT:
+            break;
+    }
+
+    pixman_region32_fini(&tmp);
+    return op;
+}
+
+int main(int argc, char *argv[])
+{
+    int iterations = argc > 1 ? std::atoi(argv[1]) : 20000;
+    unsigned seed = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 1;
+    if (iterations <= 0)
+    {
+        std::fprintf(stderr, "usage: %s [iterations] [seed]\n", argv[0]);
+        return 1;
+    }
+
+    rng.seed(seed);
+
+    int large_regions = 0;
+    for (int i = 0; i < iterations; i++)
+    {
+        checked_region_t regions[2];
+
+        int steps = random_int(1, 24);
+        for (int step = 0; step < steps; step++)
+        {
+            int target = random_int(0, 1);
+            auto op = apply_random_op(regions[target], regions[1 - target]);
+
+            for (auto& r : regions)
+            {
+                if (r.region.end() - r.region.begin() > wf_region::small_region_boxes)
+                    ++large_regions;
+
+                if (!matches(r))
+                {
+                    std::fprintf(stderr, "mismatch in iteration %d, step %d "
+                        "after \"%s\" (seed %u)\n", i, step, op_names[op], seed);
+                    return 1;
+                }
+            }
+        }
+    }
+
+    /* Make sure the transitions to pixman storage were actually tested */
+    if (large_regions == 0)
+    {
+        std::fprintf(stderr, "no region grew past %d boxes\n",
+            wf_region::small_region_boxes);
+        return 1;
+    }
+
+    std::printf("%d iterations passed\n", iterations);
+    return 0;
+}
@@ -0,0 +1,213 @@
+/* safe-list-check: checks that wf::safe_list_t stays consistent when it is
+ * modified from inside for_each(). Exits with a non-zero status if any check
+ * fails. */
+
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+#include <nonstd/safe-list.hpp>
+
+namespace wf
+{
+    namespace _safe_list_detail
+    {
+        wl_event_loop* event_loop;
+        void idle_cleanup_func(void *data)
+        {
+            auto priv = reinterpret_cast<std::function<void()>*> (data);
+            (*priv)();
+        }
+    }
+}
+
+using list_t = wf::safe_list_t<int>;
+
+static int failures = 0;
+
+static void fail(const char *what, const std::vector<int>& actual,
+    const std::vector<int>& expected)
+{
+    ++failures;
+    std::fprintf(stderr, "FAIL: %s: got", what);
+    for (auto el : actual)
+        std::fprintf(stderr, " %d", el);
+    std::fprintf(stderr, ", expected");
+    for (auto el : expected)
+        std::fprintf(stderr, " %d", el);
+    std::fprintf(stderr, "\n");
+}
+
+static void expect_visited(const char *what, const std::vector<int>& visited,
+    const std::vector<int>& expected)
+{
+    if (visited != expected)
+        fail(what, visited, expected);
+}
+
+static void expect(const char *what, const list_t& list,
+    const std::vector<int>& expected)
+{
+    std::vector<int> actual;
+    list.for_each([&] (int& el) { actual.push_back(el); });
+
+    if (actual != expected || list.size() != expected.size())
+        fail(what, actual, expected);
+}
+
+static void idle()
+{
+    wl_event_loop_dispatch_idle(wf::_safe_list_detail::event_loop);
+}
+
+static void check_remove()
+{
+    /* Removing the current, a visited and a not yet visited element */
+    list_t list;
+    for (int i = 0; i < 5; i++)
+        list.push_back(i);
+
+    std::vector<int> visited;
+    list.for_each([&] (int& el) {
+        visited.push_back(el);
+        if (el == 1)
+            list.remove_all(1);
+        if (el == 2)
+            list.remove_if([] (const int& x) { return x == 0 || x == 3; });
+    });
+
+    expect_visited("remove during for_each, visited", visited, {0, 1, 2, 4});
+    expect("remove during for_each", list, {2, 4});
+    idle();
+    expect("remove during for_each, after cleanup", list, {2, 4});
+}
+
+static void check_append()
+{
+    /* Appended elements are visited by a forward iteration, also when they
+     * are appended while visiting an appended element */
+    list_t list;
+    list.push_back(1);
+
+    std::vector<int> visited;
+    list.for_each([&] (int& el) {
+        visited.push_back(el);
+        if (el < 4)
+            list.push_back(el + 1);
+
+        int last = std::min(el + 1, 4);
+        if (list.back() != last || list.size() != size_t(last))
+        {
+            ++failures;
+            std::fprintf(stderr, "FAIL: append during for_each: back() %d, "
+                "size() %zu\n", list.back(), list.size());
+        }
+    });
+    expect_visited("append during for_each, visited", visited, {1, 2, 3, 4});
+    expect("append during for_each", list, {1, 2, 3, 4});
+
+    /* ... but not by a reverse iteration, which has already passed them */
+    visited.clear();
+    list.for_each_reverse([&] (int& el) {
+        visited.push_back(el);
+        if (el == 4)
+            list.push_back(5);
+    });
+    expect_visited("append during for_each_reverse, visited", visited,
+        {4, 3, 2, 1});
+    expect("append during for_each_reverse", list, {1, 2, 3, 4, 5});
+
+    /* A nested iteration sees the elements appended by the outer one, and the
+     * outer one sees those appended by the nested one */
+    visited.clear();
+    list.remove_if([] (const int& x) { return x > 1; });
+    list.for_each([&] (int& el) {
+        if (el == 1)
+            list.push_back(2);
+
+        list.for_each([&] (int& inner) {
+            visited.push_back(inner);
+            if (inner == 2 && el == 1)
+                list.push_back(3);
+        });
+    });
+    expect_visited("nested append, visited", visited,
+        {1, 2, 3, 1, 2, 3, 1, 2, 3});
+    expect("nested append", list, {1, 2, 3});
+}
+
+static void check_insert()
+{
+    list_t list;
+    list.push_back(2);
+    list.push_back(4);
+
+    /* Adding during an iteration, also from a nested one */
+    list.for_each_reverse([&] (int& el) {
+        list.push_back(el + 10);
+        list.for_each([&] (int& inner) {
+            if (inner == el)
+                list.push_back(el + 20);
+        });
+
+        list.insert_at(el + 30, [] (int& other) {
+            return other == 2 ? list_t::INSERT_BEFORE : list_t::INSERT_NONE;
+        });
+    });
+    expect("add during for_each", list,
+        {34, 32, 2, 4, 14, 24, 12, 22});
+
+    /* Removing an element which was queued during the same iteration */
+    std::vector<int> visited;
+    list.for_each([&] (int& el) {
+        visited.push_back(el);
+        if (el == 2)
+            list.push_back(100);
+        if (el == 4)
+            list.remove_all(100);
+    });
+    expect_visited("remove queued element, visited", visited,
+        {34, 32, 2, 4, 14, 24, 12, 22});
+    expect("remove queued element", list, {34, 32, 2, 4, 14, 24, 12, 22});
+}
+
+static void check_copy()
+{
+    list_t list;
+    for (int i = 0; i < 5; i++)
+        list.push_back(i);
+
+    /* Copies and moves do not carry over erased elements */
+    list.remove_if([] (const int& x) { return x % 2; });
+    list_t copy = list;
+    list_t moved = std::move(list);
+    idle();
+    expect("copy", copy, {0, 2, 4});
+    expect("move", moved, {0, 2, 4});
+
+    if (moved.back() != 4)
+    {
+        ++failures;
+        std::fprintf(stderr, "FAIL: back() returned %d\n", moved.back());
+    }
+}
+
+int main()
+{
+    wf::_safe_list_detail::event_loop = wl_event_loop_create();
+
+    check_remove();
+    check_append();
+    check_insert();
+    check_copy();
+
+    wl_event_loop_destroy(wf::_safe_list_detail::event_loop);
+
+    if (failures)
+    {
+        std::fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,111 @@
+/* signal-check: checks which handlers are called when handlers are connected
+ * and disconnected from inside a signal emission. Exits with a non-zero status
+ * if any check fails. */
+
+#include <cstdio>
+#include <string>
+
+#include <object.hpp>
+
+namespace wf
+{
+    namespace _safe_list_detail
+    {
+        wl_event_loop* event_loop;
+        void idle_cleanup_func(void *data)
+        {
+            auto priv = reinterpret_cast<std::function<void()>*> (data);
+            (*priv)();
+        }
+    }
+}
+
+static int failures = 0;
+
+static void expect(const char *what, const std::string& actual,
+    const std::string& expected)
+{
+    if (actual == expected)
+        return;
+
+    ++failures;
+    std::fprintf(stderr, "FAIL: %s: called \"%s\", expected \"%s\"\n", what,
+        actual.c_str(), expected.c_str());
+}
+
+int main()
+{
+    wf::_safe_list_detail::event_loop = wl_event_loop_create();
+
+    wf_signal_provider_t provider;
+    std::string called;
+
+    signal_callback_t a = [&] (signal_data*) { called += "a"; };
+    signal_callback_t b = [&] (signal_data*) { called += "b"; };
+    signal_callback_t c = [&] (signal_data*) { called += "c"; };
+
+    /* Emitting by name and by ID reaches the same handlers, in order */
+    provider.connect_signal("map", &a);
+    provider.connect_signal(wf_get_signal_id("map"), &b);
+    provider.emit_signal("map", nullptr);
+    expect("emit by name", called, "ab");
+
+    called.clear();
+    provider.emit_signal(wf_get_signal_id("map"), nullptr);
+    expect("emit by id", called, "ab");
+
+    /* A handler connected during the emission is called in the same emission,
+     * one disconnected during it is not called anymore */
+    signal_callback_t connect_c = [&] (signal_data*) {
+        called += "+";
+        provider.connect_signal("map", &c);
+        provider.disconnect_signal("map", &b);
+        provider.disconnect_signal("map", &connect_c);
+    };
+
+    provider.disconnect_signal("map", &b);
+    provider.connect_signal("map", &connect_c);
+    provider.connect_signal("map", &b);
+
+    called.clear();
+    provider.emit_signal("map", nullptr);
+    expect("connect and disconnect during emission", called, "a+c");
+
+    called.clear();
+    provider.emit_signal("map", nullptr);
+    expect("emission after connect and disconnect", called, "ac");
+
+    /* Connecting to other signals during the emission */
+    signal_callback_t connect_other = [&] (signal_data*) {
+        called += "+";
+        for (int i = 0; i < 32; i++)
+            provider.connect_signal("other-" + std::to_string(i), &a);
+    };
+
+    provider.connect_signal("unmap", &connect_other);
+    provider.connect_signal("unmap", &b);
+
+    called.clear();
+    provider.emit_signal("unmap", nullptr);
+    expect("connect to other signals during emission", called, "+b");
+
+    called.clear();
+    provider.emit_signal("other-31", nullptr);
+    expect("handler connected to other signal", called, "a");
+
+    /* Signals without handlers */
+    called.clear();
+    provider.emit_signal("no-handlers", nullptr);
+    expect("no handlers", called, "");
+
+    wl_event_loop_dispatch_idle(wf::_safe_list_detail::event_loop);
+    wl_event_loop_destroy(wf::_safe_list_detail::event_loop);
+
+    if (failures)
+    {
+        std::fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+
+    return 0;
+}